@@ -6,6 +6,7 @@
 #define __MOTMOT_H__
 
 #include <stddef.h>
+#include <sys/uio.h>
 #include <glib.h>
 
 /**
@@ -58,6 +59,29 @@ typedef int (*connect_t)(const void *desc, size_t size,
 typedef int (*learn_t)(const void *message, size_t len, void *desc,
     size_t size, void *data);
 
+/**
+ * motmot_chat_t - A learned chat, as handed to a batch learning callback.
+ * The pointers are only valid for the duration of the callback.
+ */
+typedef struct motmot_chat {
+  const void *message;            // the message
+  size_t len;                     // length of the message
+  void *desc;                     // descriptor of the sender
+  size_t size;                    // size of the descriptor
+} motmot_chat_t;
+
+/**
+ * learn_batch_t - Batch learning callback type.
+ *
+ * @param chats     A run of chats learned in order, with no joins or parts
+ *                  falling between them.
+ * @param n         The number of chats in the run.
+ * @param data      Data pointer used by the client to identify the session.
+ * @returns         0 on success, nonzero on error.
+ */
+typedef int (*learn_batch_t)(const motmot_chat_t *chats, size_t n,
+    void *data);
+
 /**
  * enter_t - Chatroom entrance notification callback type.
  *
@@ -78,9 +102,56 @@ typedef void *(*enter_t)(void *data);
 typedef void (*leave_t)(void *data);
 
 /**
- * motmot_init - Initialize libmotmot.
+ * motmot_history_entry_t - A chat read back from a session's history.  The
+ * pointers reference motmot's own storage, and are valid until the session
+ * ends.
+ */
+typedef struct motmot_history_entry {
+  unsigned inum;                  // instance number of the chat
+  unsigned long long time;        // when it was learned, in ms since the epoch
+  const void *desc;               // descriptor of the sender
+  size_t desc_size;               // size of the descriptor
+  const char *message;            // the message
+  size_t len;                     // length of the message
+} motmot_history_entry_t;
+
+/**
+ * motmot_option_t - Tunable protocol behaviors, set with motmot_setopt().
+ */
+typedef enum motmot_option {
+  MOTMOT_OPT_SNAPSHOT_JOIN = 0,   // joiners pull their log from a peer
+  MOTMOT_OPT_THRIFTY,             // decree to a bare majority at first
+  MOTMOT_OPT_MAX_VOTERS,          // later joiners are learners; 0 for no cap
+  MOTMOT_OPT_PREPARE_QUORUM,      // votes needed to elect; 0 for majority
+  MOTMOT_OPT_ACCEPT_QUORUM,       // votes needed to commit; 0 for majority
+  MOTMOT_OPT_INLINE_MAX,          // largest message put in decrees; 0 for none
+  MOTMOT_OPT_BLOB_MIN,            // smallest message fetched lazily; 0 for none
+  MOTMOT_OPT_BLOB_SPILL,          // spill blobs to disk rather than dropping
+  MOTMOT_OPT_ERASURE,             // push erasure-coded fragments of blobs
+  MOTMOT_OPT_RELAY_FANOUT,        // relay decrees down a tree; 0 for direct
+  MOTMOT_OPT_STAR,                // link only to the proposer and n successors
+  MOTMOT_OPT_SYNC_COUNT,          // sync at this many new learns; 0 for none
+  MOTMOT_OPT_SYNC_BYTES,          // sync at this many cached bytes; 0 for none
+  MOTMOT_OPT_SYNC_DELAY,          // max ms we leave learns unsynced; nonzero
+  MOTMOT_OPT_PART_DELAY,          // ms we let the dropped try to resume
+  MOTMOT_OPT_WAL_EACH,            // sync the log per record, not per batch
+} motmot_option_t;
+
+/**
+ * motmot_ctx_t - An independent instance of motmot, with its own callbacks,
+ * options, sessions, and connections.  Any number of contexts may run in
+ * one process.  Functions below which act on a session find its context
+ * from the session; the rest take the context to act on.
+ */
+typedef struct motmot_ctx motmot_ctx_t;
+
+/**
+ * motmot_init - Initialize libmotmot, setting up a default context which
+ * runs on the default main context.
  *
  * This function must be called before using any of the functions below
+ * with a NULL context, and from the thread which will run the default main
+ * context.
  *
  * @param connect   Client callback for setting up connections.
  * @param chat      Client callback invoked when a chat is received.
@@ -93,9 +164,132 @@ typedef void (*leave_t)(void *data);
 int motmot_init(connect_t connect, learn_t chat, learn_t join, learn_t part,
     enter_t enter, leave_t leave);
 
+/**
+ * motmot_ctx_new - Set up a new context, isolated from all others.
+ *
+ * The context's own work, along with its callbacks, runs on the thread
+ * running the given main context, unless it is sharded.  Contexts may share
+ * a main context, or each have their own running on a core of its own.
+ *
+ * @param connect   Client callback for setting up connections.
+ * @param chat      Client callback invoked when a chat is received.
+ * @param join      Client callback invoked when a user joins the chat.
+ * @param part      Client callback invoked when a user parts the chat.
+ * @param enter     Client callback invoked when a chat session is joined.
+ * @param leave     Client callback invoked when a chat session is left.
+ * @param context   The main context to run on, or NULL for the default.
+ * @return          The new context, or NULL on error.
+ */
+motmot_ctx_t *motmot_ctx_new(connect_t connect, learn_t chat, learn_t join,
+    learn_t part, enter_t enter, leave_t leave, GMainContext *context);
+
+/**
+ * motmot_learn_batch - Deliver chats in batches rather than one at a time.
+ *
+ * Once set, chats learned together, as when a gap in the log fills, are
+ * passed to the batch callback in runs instead of to the chat callback.
+ * Joins and parts still go to their own callbacks, in order between runs.
+ *
+ * @param ctx       The context, or NULL for the one set up by motmot_init().
+ * @param chats     Client callback invoked on a run of learned chats, or
+ *                  NULL to return to the chat callback.
+ * @returns         0 on success, nonzero on error.
+ */
+int motmot_learn_batch(motmot_ctx_t *ctx, learn_batch_t chats);
+
+/**
+ * motmot_deliver - Run the learning and leave callbacks from a main context
+ * rather than in the middle of motmot's own processing.
+ *
+ * motmot copies each learn and queues it for the context, so that slow
+ * callbacks no longer hold up the chat.  Callbacks still arrive in order.
+ * If the context runs on a thread other than motmot's, the callbacks must
+ * not call into motmot directly.  This can be set only once, and should be
+ * set before any sessions start.
+ *
+ * @param ctx       The context, or NULL for the one set up by motmot_init().
+ * @param context   The main context on which to run the callbacks.
+ * @returns         0 on success, nonzero on error.
+ */
+int motmot_deliver(motmot_ctx_t *ctx, GMainContext *context);
+
+/**
+ * motmot_threads - Allow motmot_send(), motmot_send_take(), motmot_sendv(),
+ * motmot_invite(), and motmot_invite_learner() to be called from any thread.
+ *
+ * Calls from threads other than the one running the session are queued for
+ * it, and return before the request is actually made; they fail only if the
+ * session is NULL.  A queued request for a session that has since ended is
+ * dropped, releasing any buffer given to motmot_send_take().  The session
+ * must not have been freed by the time of the call, so callers should stop
+ * using it once its leave callback runs.
+ *
+ * This must be called from the thread running the context's main context,
+ * after the context is set up.  Sessions run by shard threads always accept
+ * calls from any thread; see motmot_shards().
+ *
+ * @param ctx       The context, or NULL for the one set up by motmot_init().
+ * @returns         0 on success, nonzero on error.
+ */
+int motmot_threads(motmot_ctx_t *ctx);
+
+/**
+ * motmot_shards - Run sessions across several threads, each with its own
+ * main context.  Each session is run by the shard its ID picks, and sessions
+ * on different shards share nothing, so they proceed in parallel.
+ *
+ * Once sharded, the learning, enter, and leave callbacks for a session run
+ * on its shard's thread unless motmot_deliver() is in use, as do the client's
+ * connect callback and the continuation it is passed; the continuation must
+ * be invoked from the thread which called connect.  Channels passed to
+ * motmot_watch() are handed to the right shard once their first message
+ * arrives, which requires every peer to use the same number of shards.
+ * motmot_send(), motmot_invite(), and motmot_invite_learner() may be called
+ * from any thread; other calls on a session must be made from its shard, for
+ * instance with motmot_invoke().  Sharding cannot be combined with
+ * motmot_wal().  This must be called once, from the thread running the
+ * context's main context, after everything else is configured and before any
+ * sessions start.
+ *
+ * @param ctx       The context, or NULL for the one set up by motmot_init().
+ * @param n         The number of shard threads to start.
+ * @returns         0 on success, nonzero on error.
+ */
+int motmot_shards(motmot_ctx_t *ctx, unsigned n);
+
+/**
+ * motmot_invoke - Call a function on the thread running a session, as with
+ * g_main_context_invoke().  If that is the calling thread, the function is
+ * called immediately.
+ *
+ * @param data      Data pointer used by motmot to identify the session.
+ * @param func      The function to call.
+ * @param arg       The argument to pass it.
+ * @returns         0 on success, nonzero on error.
+ */
+int motmot_invoke(void *data, GSourceFunc func, void *arg);
+
+/**
+ * motmot_io_threads - Read, decode, and write the sockets of all connections
+ * on a pool of I/O threads, rather than on the threads running the sessions.
+ * Messages and output pass between them over lock-free rings, so that socket
+ * calls and parsing overlap with the work of the protocol itself.
+ *
+ * Each connection is served by one I/O thread for its whole life.  This
+ * must be called once, from the thread running the context's main context,
+ * after motmot_shards() if it is used at all, and before any connections are
+ * made or watched.
+ *
+ * @param ctx       The context, or NULL for the one set up by motmot_init().
+ * @param n         The number of I/O threads to start.
+ * @returns         0 on success, nonzero on error.
+ */
+int motmot_io_threads(motmot_ctx_t *ctx, unsigned n);
+
 /**
  * motmot_session - Start a new motmot chat.
  *
+ * @param ctx       The context, or NULL for the one set up by motmot_init().
  * @param desc      Opaque descriptor identifying the chat initiator.
  * @param size      Size of the descriptor object.
  * @param data      Data pointer used by the client to identify the session.
@@ -103,15 +297,17 @@ int motmot_init(connect_t connect, learn_t chat, learn_t join, learn_t part,
  *                  should be treated as opaque by the client and should be
  *                  passed as an argument to relevant motmot functions.
  */
-void *motmot_session(const void *desc, size_t size, void *data);
+void *motmot_session(motmot_ctx_t *ctx, const void *desc, size_t size,
+    void *data);
 
 /**
  * motmot_watch - Watch a given channel for activity.
  *
+ * @param ctx       The context, or NULL for the one set up by motmot_init().
  * @param channel   The channel for motmot to watch.
  * @returns         0 on success, nonzero on error.
  */
-int motmot_watch(GIOChannel *channel);
+int motmot_watch(motmot_ctx_t *ctx, GIOChannel *channel);
 
 /**
  * motmot_invite - Add user to chat.
@@ -124,6 +320,19 @@ int motmot_watch(GIOChannel *channel);
  */
 int motmot_invite(const void *desc, size_t size, void *data);
 
+/**
+ * motmot_invite_learner - Add user to chat as a learner.  Learners receive
+ * the chat like anyone else, but they take no part in agreeing on it, so
+ * they do not slow it down.
+ *
+ * @param desc      Opaque descriptor recognized by the client's connect
+ *                  callback, used to identify the invitee.
+ * @param size      Size of the descriptor object.
+ * @param data      Data pointer used by motmot to identify the session.
+ * @returns         0 on success, nonzero on error.
+ */
+int motmot_invite_learner(const void *desc, size_t size, void *data);
+
 /**
  * motmot_disconnect - Request to disconnect from a chat.
  *
@@ -142,4 +351,119 @@ int motmot_disconnect(void *data);
  */
 int motmot_send(const char *message, size_t len, void *data);
 
+/**
+ * motmot_release_t - Callback type for releasing a message buffer handed to
+ * motmot_send_take().
+ *
+ * @param message   The message buffer.
+ * @param arg       The argument passed along with the buffer.
+ */
+typedef void (*motmot_release_t)(void *message, void *arg);
+
+/**
+ * motmot_send_take - Queue the message for reliable ordered broadcast,
+ * taking ownership of its buffer rather than copying it.  motmot releases
+ * the buffer once it is done with it, including when the call fails.
+ *
+ * @param message   The message to be sent.
+ * @param len       The length of that message.
+ * @param release   Callback to release the buffer, or NULL if it was
+ *                  allocated with g_malloc() and should be g_free()'d.
+ * @param arg       Argument passed to the release callback.
+ * @param data      Data pointer used by motmot to identify the session.
+ * @returns         0 on success, nonzero on error.
+ */
+int motmot_send_take(char *message, size_t len, motmot_release_t release,
+    void *arg, void *data);
+
+/**
+ * motmot_sendv - Queue several messages for reliable ordered broadcast.  This
+ * is equivalent to calling motmot_send() on each in turn, but much cheaper
+ * for bursts of messages.  The call is all or nothing: on error, none of
+ * the messages is sent.
+ *
+ * @param iov       The messages to be sent, in order.
+ * @param count     The number of messages.
+ * @param data      Data pointer used by motmot to identify the session.
+ * @returns         0 on success, nonzero on error.
+ */
+int motmot_sendv(const struct iovec *iov, size_t count, void *data);
+
+/**
+ * motmot_setopt - Set a tunable protocol option.
+ *
+ * Options set with a NULL session are the context's defaults for every
+ * session started or joined afterwards; otherwise, they apply only to the
+ * given session.
+ *
+ * The quorum options must agree across a session, so they can only be set
+ * as defaults.  Sessions take them from their initiator, and they are raised
+ * as needed so that any two quorums for electing and for committing always
+ * overlap.  The blob store and the log are shared by all sessions of a
+ * context, so the spill and log options are likewise global to it.
+ *
+ * @param ctx       The context whose defaults to set, or NULL for the one set
+ *                  up by motmot_init().  It is ignored if data is given.
+ * @param opt       The option to set.
+ * @param value     The new value of the option.
+ * @param data      Data pointer used by motmot to identify the session, or
+ *                  NULL to set the default.
+ * @returns         0 on success, nonzero on error.
+ */
+int motmot_setopt(motmot_ctx_t *ctx, motmot_option_t opt, unsigned value,
+    void *data);
+
+/**
+ * motmot_wal - Log acceptor state durably to a directory, so that it can be
+ * recovered after a restart.  Any sessions already logged there are resumed
+ * under our old identities, and the client's enter callback is invoked for
+ * each.  A session can only be resumed if our part has not yet committed;
+ * see MOTMOT_OPT_PART_DELAY.  This should be called once, after motmot_init
+ * and before starting or joining sessions.  Each context needs a directory
+ * of its own.
+ *
+ * @param ctx       The context, or NULL for the one set up by motmot_init().
+ * @param dir       The directory to log to; it is created if need be.
+ * @returns         0 on success, nonzero on error.
+ */
+int motmot_wal(motmot_ctx_t *ctx, const char *dir);
+
+/**
+ * motmot_history - Keep every chat learned in sessions started, joined, or
+ * resumed afterwards in a history under a directory, one subdirectory per
+ * session.  Histories survive restarts, and a resumed session picks up where
+ * its history left off.  Contexts which may join the same session must not
+ * share a directory.
+ *
+ * @param ctx       The context, or NULL for the one set up by motmot_init().
+ * @param dir       The directory to keep histories in.
+ * @returns         0 on success, nonzero on error.
+ */
+int motmot_history(motmot_ctx_t *ctx, const char *dir);
+
+/**
+ * motmot_history_read - Read chats back from a session's history without
+ * copying them.
+ *
+ * @param from      Instance number to start reading from.  Chats are read in
+ *                  order, starting with the first numbered at least this.
+ * @param entries   Array to fill in with the chats read.
+ * @param n         Maximum number of chats to read.
+ * @param data      Data pointer used by motmot to identify the session.
+ * @returns         The number of chats read; 0 if there are no more, or if
+ *                  the session has no history.
+ */
+size_t motmot_history_read(unsigned from, motmot_history_entry_t *entries,
+    size_t n, void *data);
+
+/**
+ * motmot_history_find - Find the first chat in a session's history learned
+ * at or after a given time, for passing to motmot_history_read().
+ *
+ * @param time      Time to search from, in ms since the epoch.
+ * @param data      Data pointer used by motmot to identify the session.
+ * @returns         Instance number of the chat, or 0 if there is none.
+ */
+unsigned motmot_history_find(unsigned long long time, void *data);
+
 #endif // __MOTMOT_H__
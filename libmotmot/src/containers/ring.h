@@ -0,0 +1,69 @@
+/**
+ * ring.h - Bounded lock-free ring of pointers, for exactly one producer
+ * thread and one consumer thread.
+ *
+ * The producer alone advances the tail and the consumer alone advances the
+ * head, so each side only has to see the other's index; the atomic accesses
+ * order the slot contents against them.
+ */
+
+#ifndef __RING_H__
+#define __RING_H__
+
+#include <stdbool.h>
+#include <glib.h>
+
+struct ring {
+  void **r_slots;         // the slots; a power of 2 of them
+  unsigned r_mask;        // number of slots, less 1
+  int r_head;             // next slot to pop; advanced by the consumer
+  int r_tail;             // next slot to push; advanced by the producer
+};
+
+static inline void
+ring_init(struct ring *r, unsigned size)
+{
+  r->r_slots = g_malloc0(size * sizeof(*r->r_slots));
+  r->r_mask = size - 1;
+  r->r_head = 0;
+  r->r_tail = 0;
+}
+
+static inline void
+ring_destroy(struct ring *r)
+{
+  g_free(r->r_slots);
+}
+
+/* Push an item; returns false if the ring is full.  Producer only. */
+static inline bool
+ring_push(struct ring *r, void *item)
+{
+  unsigned tail = (unsigned)r->r_tail;
+
+  if (tail - (unsigned)g_atomic_int_get(&r->r_head) > r->r_mask) {
+    return false;
+  }
+
+  r->r_slots[tail & r->r_mask] = item;
+  g_atomic_int_set(&r->r_tail, (int)(tail + 1));
+  return true;
+}
+
+/* Pop an item; returns NULL if the ring is empty.  Consumer only. */
+static inline void *
+ring_pop(struct ring *r)
+{
+  void *item;
+  unsigned head = (unsigned)r->r_head;
+
+  if (head == (unsigned)g_atomic_int_get(&r->r_tail)) {
+    return NULL;
+  }
+
+  item = r->r_slots[head & r->r_mask];
+  g_atomic_int_set(&r->r_head, (int)(head + 1));
+  return item;
+}
+
+#endif /* __RING_H__ */
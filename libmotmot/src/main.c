@@ -19,9 +19,14 @@
     exit(1);                                        \
   }
 
+// Tag for the chats of our second context.
+#define SECOND_TAG  "2"
+
 GMainLoop *gmain;
 GIOChannel *self_channel;
 void *session;
+void *second_session;
+unsigned chat_delay;
 
 /**
  * socket_open - Create a local UNIX socket and wrap it in a GIOChannel.
@@ -91,13 +96,116 @@ socket_accept(GIOChannel *source, GIOCondition condition, void *data)
 
   g_free(saddr);
 
-  // Create and watch a channel.
+  // Create and watch a channel, in the context the socket listens for.
   channel = g_io_channel_unix_new(newfd);
-  motmot_watch(channel);
+  motmot_watch(data, channel);
 
   return TRUE;
 }
 
+/**
+ * print_history - Print up to n chats from our session's history, starting
+ * from instance number from.
+ */
+void
+print_history(unsigned from, size_t n)
+{
+  size_t i, count;
+  motmot_history_entry_t *entries;
+
+  entries = g_new(motmot_history_entry_t, n);
+  count = motmot_history_read(from, entries, n, session);
+  for (i = 0; i < count; ++i) {
+    printf("HISTORY(%u): %.*s\n", entries[i].inum, (int)entries[i].len,
+        entries[i].message);
+  }
+  printf("HISTORY: %zu read\n", count);
+  fflush(stdout);
+  g_free(entries);
+}
+
+/**
+ * release_take - Free a chat we handed over with motmot_send_take(), saying
+ * so, so that tests can check each is released exactly once.
+ */
+void
+release_take(void *message, void *arg)
+{
+  printf("RELEASED: %s\n", (char *)message);
+  fflush(stdout);
+  g_free(message);
+}
+
+/**
+ * send_vector - Send each of a list of messages separated by '|' as a chat of
+ * its own, all in one call.
+ */
+void
+send_vector(const char *list)
+{
+  size_t i, n;
+  char **parts;
+  struct iovec *iov;
+
+  parts = g_strsplit(list, "|", 0);
+  n = g_strv_length(parts);
+  iov = g_new(struct iovec, n);
+  for (i = 0; i < n; ++i) {
+    iov[i].iov_base = parts[i];
+    iov[i].iov_len = strlen(parts[i]) + 1;
+  }
+
+  motmot_sendv(iov, n, session);
+
+  g_free(iov);
+  g_strfreev(parts);
+}
+
+/* A thread sending chats of its own. */
+struct spray {
+  char *tag;                          // tag to start our chats with
+  unsigned thread;                    // which thread this is
+  unsigned count;                     // how many chats to send
+  void *session;                      // the session to send them to
+};
+
+/**
+ * spray_main - Send a thread's chats, by each of the ways there are to send
+ * them in turn.
+ */
+void *
+spray_main(void *data)
+{
+  unsigned i;
+  char *tmp;
+  struct spray *spray = data;
+  struct iovec iov;
+
+  for (i = 0; i < spray->count; ++i) {
+    tmp = g_strdup_printf("%s %u %u", spray->tag, spray->thread, i);
+    switch (i % 3) {
+      case 0:
+        motmot_send(tmp, strlen(tmp) + 1, spray->session);
+        g_free(tmp);
+        break;
+      case 1:
+        motmot_send_take(tmp, strlen(tmp) + 1, release_take, NULL,
+            spray->session);
+        break;
+      case 2:
+        iov.iov_base = tmp;
+        iov.iov_len = strlen(tmp) + 1;
+        motmot_sendv(&iov, 1, spray->session);
+        g_free(tmp);
+        break;
+    }
+  }
+
+  g_free(spray->tag);
+  g_free(spray);
+  return NULL;
+}
+
 /**
  * input_loop - Listen for input on stdin, parse, and dispatch.
  */
@@ -105,7 +213,10 @@ int
 input_loop(GIOChannel *channel, GIOCondition condition, void *data)
 {
   char *msg, *tmp;
-  unsigned long eol;
+  int tag;
+  unsigned long eol, from, n, i, count;
+  struct spray *spray;
+  unsigned long long time;
   GError *gerr = NULL;
   GIOStatus status;
 
@@ -133,6 +244,47 @@ input_loop(GIOChannel *channel, GIOCondition condition, void *data)
     tmp = msg + 7;
     while (*++tmp == ' ');  // Move past all the spaces.
     motmot_invite(tmp, strlen(tmp), session);
+  } else if (g_str_has_prefix(msg, "/learner ")) {
+    // \learner socket - Handle inviting others as learners.
+    tmp = msg + 8;
+    while (*++tmp == ' ');  // Move past all the spaces.
+    motmot_invite_learner(tmp, strlen(tmp), session);
+  } else if (g_str_has_prefix(msg, "/take ")) {
+    // \take message - Send a chat without motmot copying it.
+    tmp = g_strdup(msg + 6);
+    motmot_send_take(tmp, strlen(tmp) + 1, release_take, NULL, session);
+  } else if (g_str_has_prefix(msg, "/sendv ")) {
+    // \sendv a|b|c - Send several chats at once.
+    send_vector(msg + 7);
+  } else if (g_str_has_prefix(msg, "/spray ")) {
+    // \spray threads count tag - Send count chats, each starting with the
+    // tag, from each of several threads.
+    if (sscanf(msg + 7, "%lu %lu %n", &n, &count, &tag) == 2) {
+      for (i = 0; i < n; ++i) {
+        spray = g_new(struct spray, 1);
+        spray->tag = g_strdup(msg + 7 + tag);
+        spray->thread = i;
+        spray->count = count;
+        spray->session = session;
+        g_thread_unref(g_thread_new("spray", spray_main, spray));
+      }
+    }
+  } else if (g_str_has_prefix(msg, "/second ")) {
+    // \second message - Send a chat in our second context's session.
+    if (second_session != NULL) {
+      motmot_send(msg + 8, eol - 7, second_session);
+    }
+  } else if (g_str_has_prefix(msg, "/history ")) {
+    // \history from n - Print n chats from our history.
+    if (sscanf(msg + 9, "%lu %lu", &from, &n) == 2) {
+      print_history(from, n);
+    }
+  } else if (g_str_has_prefix(msg, "/find ")) {
+    // \find time - Find the first chat in our history since the time.
+    if (sscanf(msg + 6, "%llu", &time) == 1) {
+      printf("FIND: %u\n", motmot_history_find(time, session));
+      fflush(stdout);
+    }
   } else if (g_str_has_prefix(msg, "/part")) {
     // \part - Only do it if it's followed by a space or EOF.
     if (msg[6] == '\0' || msg[6] == ' ') {
@@ -149,10 +301,35 @@ input_loop(GIOChannel *channel, GIOCondition condition, void *data)
   return TRUE;
 }
 
+/**
+ * print_chat - Print a chat, tagged with the context it came in on, if it's
+ * not the default one.
+ */
 int
 print_chat(const void *buf, size_t len, void *desc, size_t size, void *data)
 {
-  printf("CHAT(%.*s): %.*s\n", (int)size, (char *)desc, (int)len, (char *)buf);
+  // Play a slow client if asked to.
+  if (chat_delay != 0) {
+    g_usleep(chat_delay * 1000);
+  }
+
+  printf("CHAT%s(%.*s): %.*s\n", (data != NULL) ? (char *)data : "",
+      (int)size, (char *)desc, (int)len, (char *)buf);
+  fflush(stdout);
+  return 0;
+}
+
+int
+print_batch(const motmot_chat_t *chats, size_t n, void *data)
+{
+  size_t i;
+
+  printf("BATCH: %zu\n", n);
+  for (i = 0; i < n; ++i) {
+    printf("CHAT%s(%.*s): %.*s\n", (data != NULL) ? (char *)data : "",
+        (int)chats[i].size, (char *)chats[i].desc, (int)chats[i].len,
+        (char *)chats[i].message);
+  }
   fflush(stdout);
   return 0;
 }
@@ -173,6 +350,32 @@ print_part(const void *buf, size_t len, void *desc, size_t size, void *data)
   return 0;
 }
 
+/**
+ * setopt_env - Set a default protocol option from the environment, if it
+ * is given there.
+ */
+void
+setopt_env(const char *name, motmot_option_t opt)
+{
+  const char *value;
+
+  value = getenv(name);
+  if (value != NULL) {
+    err(motmot_setopt(NULL, opt, strtoul(value, NULL, 10), NULL) != 0,
+        "motmot_setopt");
+  }
+}
+
+/**
+ * deliver_main - Run the main context our callbacks are delivered on.
+ */
+void *
+deliver_main(void *data)
+{
+  g_main_loop_run((GMainLoop *)data);
+  return NULL;
+}
+
 void *
 enter(void *data)
 {
@@ -191,10 +394,60 @@ leave(void *data)
   exit(0);
 }
 
+void *
+enter_second(void *data)
+{
+  printf("SECOND: Welcome to your Motmot session!\n");
+  fflush(stdout);
+  second_session = data;
+  return SECOND_TAG;
+}
+
+void
+leave_second(void *data)
+{
+  printf("SECOND: PART succeeded.\n");
+  fflush(stdout);
+  second_session = NULL;
+}
+
+/**
+ * second_start - Run a second context alongside the default one, with its
+ * own socket, callbacks, and session.  The spec lists our socket in it,
+ * and then, if we're to start a session, the sockets to invite to it.
+ */
+void
+second_start(const char *spec)
+{
+  int i;
+  char **socks;
+  motmot_ctx_t *ctx;
+  GIOChannel *channel;
+
+  socks = g_strsplit(spec, " ", 0);
+  ctx = motmot_ctx_new(connect_unix, print_chat, print_join, print_part,
+      enter_second, leave_second, NULL);
+  err(ctx == NULL, "motmot_ctx_new");
+
+  channel = listen_unix(socks[0], strlen(socks[0]));
+  g_io_add_watch(channel, G_IO_IN, socket_accept, ctx);
+
+  if (socks[1] != NULL) {
+    second_session = motmot_session(ctx, socks[0], strlen(socks[0]),
+        SECOND_TAG);
+  }
+  for (i = 1; socks[i] != NULL; i++) {
+    motmot_invite(socks[i], strlen(socks[i]), second_session);
+  }
+
+  g_strfreev(socks);
+}
+
 int
 main(int argc, char *argv[])
 {
   int i;
+  GMainContext *context;
 
   if (argc < 2) {
     printf("Usage: motmot my/sock [other/socks...]\n");
@@ -214,9 +467,70 @@ main(int argc, char *argv[])
   // Initialize motmot.
   motmot_init(connect_unix, print_chat, print_join, print_part, enter, leave);
 
+  // Take any options we are given, for tests and benchmarks.
+  setopt_env("MOTMOT_THRIFTY", MOTMOT_OPT_THRIFTY);
+  setopt_env("MOTMOT_MAX_VOTERS", MOTMOT_OPT_MAX_VOTERS);
+  setopt_env("MOTMOT_PREPARE_QUORUM", MOTMOT_OPT_PREPARE_QUORUM);
+  setopt_env("MOTMOT_ACCEPT_QUORUM", MOTMOT_OPT_ACCEPT_QUORUM);
+  setopt_env("MOTMOT_INLINE_MAX", MOTMOT_OPT_INLINE_MAX);
+  setopt_env("MOTMOT_BLOB_MIN", MOTMOT_OPT_BLOB_MIN);
+  setopt_env("MOTMOT_ERASURE", MOTMOT_OPT_ERASURE);
+  setopt_env("MOTMOT_RELAY_FANOUT", MOTMOT_OPT_RELAY_FANOUT);
+  setopt_env("MOTMOT_STAR", MOTMOT_OPT_STAR);
+  setopt_env("MOTMOT_SYNC_COUNT", MOTMOT_OPT_SYNC_COUNT);
+  setopt_env("MOTMOT_SYNC_BYTES", MOTMOT_OPT_SYNC_BYTES);
+  setopt_env("MOTMOT_SYNC_DELAY", MOTMOT_OPT_SYNC_DELAY);
+  setopt_env("MOTMOT_PART_DELAY", MOTMOT_OPT_PART_DELAY);
+  setopt_env("MOTMOT_WAL_EACH", MOTMOT_OPT_WAL_EACH);
+
+  // Run our callbacks on a thread of their own if asked to, slowly if asked
+  // to that too.
+  if (getenv("MOTMOT_CHAT_DELAY") != NULL) {
+    chat_delay = strtoul(getenv("MOTMOT_CHAT_DELAY"), NULL, 10);
+  }
+  if (getenv("MOTMOT_DELIVER") != NULL) {
+    context = g_main_context_new();
+    g_thread_new("deliver", deliver_main, g_main_loop_new(context, FALSE));
+    err(motmot_deliver(NULL, context) != 0, "motmot_deliver");
+  }
+
+  // Take sends from any thread if asked to.
+  if (getenv("MOTMOT_THREADS") != NULL) {
+    err(motmot_threads(NULL) != 0, "motmot_threads");
+  }
+
+  // Print chats in the runs they're learned in if asked to.
+  if (getenv("MOTMOT_BATCH") != NULL) {
+    err(motmot_learn_batch(NULL, print_batch) != 0, "motmot_learn_batch");
+  }
+
+  // Keep a history of our chats if asked to, before resuming any sessions.
+  if (getenv("MOTMOT_HISTORY") != NULL) {
+    err(motmot_history(NULL, getenv("MOTMOT_HISTORY")) != 0,
+        "motmot_history");
+  }
+
+  // Log to a write-ahead log if asked to, resuming any sessions in it.
+  if (getenv("MOTMOT_WAL") != NULL) {
+    err(motmot_wal(NULL, getenv("MOTMOT_WAL")) != 0, "motmot_wal");
+  }
+
+  // Run our sessions on shard threads if asked to, once all else is set.
+  if (getenv("MOTMOT_SHARDS") != NULL) {
+    err(motmot_shards(NULL, strtoul(getenv("MOTMOT_SHARDS"), NULL, 10)) != 0,
+        "motmot_shards");
+  }
+
+  // Do our socket I/O on threads of its own if asked to.
+  if (getenv("MOTMOT_IO_THREADS") != NULL) {
+    err(motmot_io_threads(NULL,
+          strtoul(getenv("MOTMOT_IO_THREADS"), NULL, 10)) != 0,
+        "motmot_io_threads");
+  }
+
   // Start a new chat.
   if (argc > 2) {
-    session = motmot_session(argv[1], strlen(argv[1]), NULL);
+    session = motmot_session(NULL, argv[1], strlen(argv[1]), NULL);
   }
 
   // Invite our friends!
@@ -224,6 +538,11 @@ main(int argc, char *argv[])
     motmot_invite(argv[i], strlen(argv[i]), session);
   }
 
+  // Run a second, independent context if asked to.
+  if (getenv("MOTMOT_SECOND") != NULL) {
+    second_start(getenv("MOTMOT_SECOND"));
+  }
+
   g_main_loop_run(gmain);
 
   return 0;
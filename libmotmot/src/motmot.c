@@ -1,5 +1,9 @@
 /**
  * motmot.c - libmotmot API
+ *
+ * Every entry point runs against the state of the context it is given, or of
+ * the shard running the session it is given, restoring the caller's state
+ * on the way out so that callbacks may call back into us.
  */
 
 #include <glib.h>
@@ -7,12 +11,51 @@
 #include "motmot.h"
 #include "paxos.h"
 
+// The context set up by motmot_init().
+static motmot_ctx_t *motmot_default;
+
+/**
+ * motmot_enter - Run against a context's state, or the default context's.
+ */
+static struct paxos_state *
+motmot_enter(motmot_ctx_t *ctx)
+{
+  return paxos_enter((ctx != NULL) ? ctx : motmot_default);
+}
+
+/**
+ * motmot_session_id - Read a session's ID on the caller's thread.  Past the
+ * API we go by the ID alone, so that a session its shard has since ended is
+ * found missing rather than read after it is freed.
+ */
+static pax_uuid_t
+motmot_session_id(void *data)
+{
+  return *((struct paxos_session *)data)->session_id;
+}
+
 /**
  * motmot_init - Initialize libmotmot.
  */
 int
 motmot_init(connect_t connect, learn_t chat, learn_t join, learn_t part,
     enter_t enter, leave_t leave)
+{
+  motmot_default = motmot_ctx_new(connect, chat, join, part, enter, leave,
+      NULL);
+
+  // The calling thread runs the default context unless told otherwise.
+  paxos_enter(motmot_default);
+
+  return motmot_default == NULL;
+}
+
+/**
+ * motmot_ctx_new - Set up a new context.
+ */
+motmot_ctx_t *
+motmot_ctx_new(connect_t connect, learn_t chat, learn_t join, learn_t part,
+    enter_t enter, leave_t leave, GMainContext *context)
 {
   struct learn_table learn;
 
@@ -20,25 +63,128 @@ motmot_init(connect_t connect, learn_t chat, learn_t join, learn_t part,
   learn.join = join;
   learn.part = part;
 
-  return paxos_init(connect, &learn, enter, leave);
+  return paxos_init(connect, &learn, enter, leave, context);
+}
+
+/**
+ * motmot_learn_batch - Deliver chats in batches.
+ */
+int
+motmot_learn_batch(motmot_ctx_t *ctx, learn_batch_t chats)
+{
+  int r;
+  struct paxos_state *prev;
+
+  prev = motmot_enter(ctx);
+  r = paxos_learn_batch(chats);
+  paxos_leave(prev);
+
+  return r;
+}
+
+/**
+ * motmot_deliver - Run callbacks from a main context.
+ */
+int
+motmot_deliver(motmot_ctx_t *ctx, GMainContext *context)
+{
+  int r;
+  struct paxos_state *prev;
+
+  prev = motmot_enter(ctx);
+  r = paxos_deliver_init(context);
+  paxos_leave(prev);
+
+  return r;
+}
+
+/**
+ * motmot_threads - Accept sends and invites from any thread.
+ */
+int
+motmot_threads(motmot_ctx_t *ctx)
+{
+  int r;
+  struct paxos_state *prev;
+
+  prev = motmot_enter(ctx);
+  r = paxos_submit_init();
+  paxos_leave(prev);
+
+  return r;
+}
+
+/**
+ * motmot_shards - Run sessions across several threads.
+ */
+int
+motmot_shards(motmot_ctx_t *ctx, unsigned n)
+{
+  int r;
+  struct paxos_state *prev;
+
+  prev = motmot_enter(ctx);
+  r = paxos_shard_init(n);
+  paxos_leave(prev);
+
+  return r;
+}
+
+/**
+ * motmot_invoke - Call a function on the thread running a session.
+ */
+int
+motmot_invoke(void *data, GSourceFunc func, void *arg)
+{
+  return paxos_shard_invoke(data, func, arg);
+}
+
+/**
+ * motmot_io_threads - Read and write sockets on threads of their own.
+ */
+int
+motmot_io_threads(motmot_ctx_t *ctx, unsigned n)
+{
+  int r;
+  struct paxos_state *prev;
+
+  prev = motmot_enter(ctx);
+  r = paxos_io_init(n);
+  paxos_leave(prev);
+
+  return r;
 }
 
 /**
  * motmot_session - Start a new motmot chat.
  */
 void *
-motmot_session(const void *desc, size_t size, void *data)
+motmot_session(motmot_ctx_t *ctx, const void *desc, size_t size, void *data)
 {
-  return paxos_start(desc, size, data);
+  void *r;
+  struct paxos_state *prev;
+
+  prev = motmot_enter(ctx);
+  r = paxos_shard_start(desc, size, data);
+  paxos_leave(prev);
+
+  return r;
 }
 
 /**
  * motmot_watch - Watch a given channel for activity.
  */
 int
-motmot_watch(GIOChannel *channel)
+motmot_watch(motmot_ctx_t *ctx, GIOChannel *channel)
 {
-  return paxos_register_connection(channel);
+  int r;
+  struct paxos_state *prev;
+
+  prev = motmot_enter(ctx);
+  r = paxos_register_connection(channel);
+  paxos_leave(prev);
+
+  return r;
 }
 
 /**
@@ -47,7 +193,38 @@ motmot_watch(GIOChannel *channel)
 int
 motmot_invite(const void *handle, size_t len, void *data)
 {
-  return paxos_request(data, DEC_JOIN, handle, len);
+  int r;
+  struct paxos_state *prev;
+
+  if (data == NULL) {
+    return 1;
+  }
+
+  prev = paxos_enter_session(data);
+  r = paxos_submit(motmot_session_id(data), DEC_JOIN, 0, handle, len);
+  paxos_leave(prev);
+
+  return r;
+}
+
+/**
+ * motmot_invite_learner - Add user to chat as a learner.
+ */
+int
+motmot_invite_learner(const void *handle, size_t len, void *data)
+{
+  int r;
+  struct paxos_state *prev;
+
+  if (data == NULL) {
+    return 1;
+  }
+
+  prev = paxos_enter_session(data);
+  r = paxos_submit(motmot_session_id(data), DEC_JOIN, 1, handle, len);
+  paxos_leave(prev);
+
+  return r;
 }
 
 /**
@@ -56,7 +233,14 @@ motmot_invite(const void *handle, size_t len, void *data)
 int
 motmot_disconnect(void *data)
 {
-  return paxos_end(data);
+  int r;
+  struct paxos_state *prev;
+
+  prev = paxos_enter_session(data);
+  r = paxos_end(data);
+  paxos_leave(prev);
+
+  return r;
 }
 
 /**
@@ -65,5 +249,146 @@ motmot_disconnect(void *data)
 int
 motmot_send(const char *message, size_t len, void *data)
 {
-  return paxos_request(data, DEC_CHAT, message, len);
+  int r;
+  struct paxos_state *prev;
+
+  if (data == NULL) {
+    return 1;
+  }
+
+  prev = paxos_enter_session(data);
+  r = paxos_submit(motmot_session_id(data), DEC_CHAT, 0, message, len);
+  paxos_leave(prev);
+
+  return r;
+}
+
+/**
+ * motmot_send_take - Queue the message for reliable ordered broadcast without
+ * copying it.
+ */
+int
+motmot_send_take(char *message, size_t len, motmot_release_t release,
+    void *arg, void *data)
+{
+  int r;
+  struct paxos_state *prev;
+
+  if (data == NULL) {
+    if (release != NULL) {
+      release(message, arg);
+    } else {
+      g_free(message);
+    }
+    return 1;
+  }
+
+  prev = paxos_enter_session(data);
+  r = paxos_submit_take(motmot_session_id(data), message, len, release, arg);
+  paxos_leave(prev);
+
+  return r;
+}
+
+/**
+ * motmot_sendv - Queue several messages for reliable ordered broadcast.
+ */
+int
+motmot_sendv(const struct iovec *iov, size_t count, void *data)
+{
+  int r;
+  struct paxos_state *prev;
+
+  if (data == NULL) {
+    return 1;
+  }
+
+  prev = paxos_enter_session(data);
+  r = paxos_submitv(motmot_session_id(data), iov, count);
+  paxos_leave(prev);
+
+  return r;
+}
+
+/**
+ * motmot_setopt - Set a tunable protocol option.
+ */
+int
+motmot_setopt(motmot_ctx_t *ctx, motmot_option_t opt, unsigned value,
+    void *data)
+{
+  int r;
+  struct paxos_state *prev;
+
+  prev = (data != NULL) ? paxos_enter_session(data) :
+      motmot_enter(ctx);
+  r = paxos_setopt(data, opt, value);
+  paxos_leave(prev);
+
+  return r;
+}
+
+/**
+ * motmot_wal - Log acceptor state durably to a directory.
+ */
+int
+motmot_wal(motmot_ctx_t *ctx, const char *dir)
+{
+  int r;
+  struct paxos_state *prev;
+
+  prev = motmot_enter(ctx);
+  r = paxos_wal_open(dir);
+  paxos_leave(prev);
+
+  return r;
+}
+
+/**
+ * motmot_history - Keep histories of learned chats.
+ */
+int
+motmot_history(motmot_ctx_t *ctx, const char *dir)
+{
+  int r;
+  struct paxos_state *prev;
+
+  prev = motmot_enter(ctx);
+  r = paxos_history_init(dir);
+  paxos_leave(prev);
+
+  return r;
+}
+
+/**
+ * motmot_history_read - Read chats back from a session's history.
+ */
+size_t
+motmot_history_read(unsigned from, motmot_history_entry_t *entries, size_t n,
+    void *data)
+{
+  size_t r;
+  struct paxos_state *prev;
+
+  prev = paxos_enter_session(data);
+  r = paxos_history_read(data, from, entries, n);
+  paxos_leave(prev);
+
+  return r;
+}
+
+/**
+ * motmot_history_find - Find a chat in a session's history by time.
+ */
+unsigned
+motmot_history_find(unsigned long long time, void *data)
+{
+  unsigned r;
+  struct paxos_state *prev;
+
+  prev = paxos_enter_session(data);
+  r = paxos_history_find(data, time);
+  paxos_leave(prev);
+
+  return r;
 }
@@ -3,6 +3,7 @@
  */
 
 #include <assert.h>
+#include <string.h>
 #include <glib.h>
 
 #include "paxos.h"
@@ -15,50 +16,156 @@
 #include "paxos_util.h"
 #include "containers/list.h"
 
-// Global system state.
-struct paxos_state state;
+#define BLOB_MEM_MAX  (64 << 20)
+#define SYNC_COUNT    1024
+#define SYNC_BYTES    (4 << 20)
+#define SYNC_DELAY    1000
+
+// System state of the shard this thread is running for.
+__thread struct paxos_state *state;
 
 // Current session.
-struct paxos_session *pax;
+__thread struct paxos_session *pax;
 
 int proposer_force_kill(struct paxos_peer *);
 
 /**
- * paxos_init - Initialize local Paxos state.
+ * paxos_init - Initialize local Paxos state for a new context, whose main
+ * thread runs the given main context.
  *
  * Most of our state is worthless until we are welcomed to the system.
  */
-int
+struct motmot_ctx *
 paxos_init(connect_t connect, struct learn_table *learn, enter_t enter,
-    leave_t leave)
+    leave_t leave, GMainContext *context)
 {
-  state.connect = connect;
-  state.enter = enter;
-  state.leave = leave;
-  state.learn.chat = learn->chat;
-  state.learn.join = learn->join;
-  state.learn.part = learn->part;
+  static gsize seeded = 0;
+  struct motmot_ctx *ctx;
+  struct paxos_state *prev;
+
+  // All our connection tables hash with the same seed.
+  if (g_once_init_enter(&seeded)) {
+    connect_hashinit();
+    g_once_init_leave(&seeded, 1);
+  }
 
-  LIST_INIT(&state.sessions);
-  connect_hashinit();
-  state.connections = connect_container_new();
+  ctx = g_malloc0(sizeof(*ctx));
+  ctx->mc_main.ps_context = context;
+  ctx->mc_main.ps_state = &ctx->mc_state;
+  prev = paxos_enter(ctx);
+
+  state->ctx = ctx;
+  state->shard = &ctx->mc_main;
+  state->connect = connect;
+  state->enter = enter;
+  state->leave = leave;
+  state->learn.chat = learn->chat;
+  state->learn.join = learn->join;
+  state->learn.part = learn->part;
+  state->learn.chats = NULL;
+
+  // Set the default options.
+  state->options.po_snapshot_join = false;
+  state->options.po_thrifty = false;
+  state->options.po_max_voters = 0;
+  state->options.po_quorum[0] = 0;
+  state->options.po_quorum[1] = 0;
+  state->options.po_inline_max = 0;
+  state->options.po_blob_min = 0;
+  state->options.po_erasure = false;
+  state->options.po_fanout = 0;
+  state->options.po_star = 0;
+  state->options.po_sync_count = SYNC_COUNT;
+  state->options.po_sync_bytes = SYNC_BYTES;
+  state->options.po_sync_delay = SYNC_DELAY;
+  state->options.po_part_delay = 0;
+
+  paxos_state_init();
+
+  paxos_leave(prev);
+  return ctx;
+}
 
-  return 0;
+/**
+ * paxos_state_init - Set up the parts of our state which each shard keeps for
+ * itself.  Anything else has been set or copied in already.
+ */
+void
+paxos_state_init(void)
+{
+  LIST_INIT(&state->sessions);
+  LIST_INIT(&state->recovered);
+  state->connections = connect_container_new();
+  blob_store_init(&state->blobs, BLOB_MEM_MAX);
+  memset(&state->wal, 0, sizeof(state->wal));
+  state->wal_held = g_queue_new();
+  state->wal_pending = false;
+
+  state->learned = NULL;
+  if (state->learn.chats != NULL) {
+    state->learned = g_array_new(FALSE, FALSE, sizeof(motmot_chat_t));
+  }
+  state->deliver_head = NULL;
+
+  state->sources = g_hash_table_new(NULL, NULL);
+}
+
+/**
+ * paxos_enter - Run against the state of a context's main thread, until the
+ * matching paxos_leave().  Returns the state to restore then.
+ */
+struct paxos_state *
+paxos_enter(struct motmot_ctx *ctx)
+{
+  struct paxos_state *prev = state;
+
+  if (ctx != NULL) {
+    state = &ctx->mc_state;
+  }
+  return prev;
+}
+
+/**
+ * paxos_enter_session - Run against the state of the shard running a
+ * session, until the matching paxos_leave().
+ */
+struct paxos_state *
+paxos_enter_session(struct paxos_session *session)
+{
+  struct paxos_state *prev = state;
+
+  if (session != NULL) {
+    state = session->shard->ps_state;
+  }
+  return prev;
 }
 
 /**
- * paxos_start - Start up the Paxos protocol with ourselves as the proposer.
+ * paxos_leave - Go back to running against the state we had before entering.
+ */
+void
+paxos_leave(struct paxos_state *prev)
+{
+  state = prev;
+}
+
+/**
+ * paxos_start - Start up the Paxos protocol with ourselves as the proposer,
+ * in a new session with the given UUID.
  */
 void *
-paxos_start(const void *desc, size_t size, void *data)
+paxos_start(pax_uuid_t *uuid, const void *desc, size_t size, void *data)
 {
-  pax_uuid_t *uuid;
   struct paxos_request *req;
   struct paxos_instance *inst;
   struct paxos_acceptor *acc;
 
-  // Create a new session with a fresh UUID.
-  pax = session_new(data, 1);
+  // Create a new session, keeping the session list sorted.
+  pax = session_new(data, 0);
+  LIST_REMOVE(&state->sessions, pax, session_le);
+  *pax->session_id = *uuid;
+  session_insert(&state->sessions, pax);
+  paxos_history_open();
 
   // Give ourselves ID 1.
   pax->self_id = 1;
@@ -78,7 +185,7 @@ paxos_start(const void *desc, size_t size, void *data)
   req->pr_size = size;
   req->pr_data = g_memdup(desc, size);
 
-  LIST_INSERT_TAIL(&pax->rcache, req, pr_le);
+  rcache_insert(pax, req);
 
   // Artificially generate an initial commit, without learning.
   inst = g_malloc0(sizeof(*inst));
@@ -114,10 +221,11 @@ paxos_start(const void *desc, size_t size, void *data)
   // Set ourselves as the proposer.
   pax->proposer = acc;
 
-  // Add a sync for this session.
-  uuid = g_malloc0(sizeof(*uuid));
-  *uuid = *pax->session_id;
-  g_timeout_add_seconds(1, paxos_sync, uuid);
+  // Log our starting point.
+  paxos_wal_members();
+  paxos_wal_ballot();
+  paxos_wal_instance(inst);
+  paxos_wal_truncate();
 
   return pax;
 }
@@ -129,18 +237,107 @@ int
 paxos_end(void *session)
 {
   pax = (struct paxos_session *)session;
+  if (pax->ended) {
+    return 1;
+  }
 
-  // Destroy the session.
-  LIST_REMOVE(&state.sessions, pax, session_le);
-  session_destroy(pax);
+  // Retire the session, making sure we don't resume it after a restart.
+  pax->ended = true;
+  paxos_wal_end();
+  LIST_REMOVE(&state->sessions, pax, session_le);
 
-  // Tell the client that the session is ending.  The client must promise us
-  // that no more calls into Paxos will be made for the terminating session.
-  state.leave(pax->client_data);
+  // Tell the client that the session is ending, and destroy it once the
+  // client knows.  The client must promise us that no more calls into Paxos
+  // will be made for the terminating session.
+  paxos_deliver_leave(pax);
 
   return 1;
 }
 
+/**
+ * paxos_setopt - Set a protocol option for a session, or the default for
+ * new sessions if the session is NULL.
+ */
+int
+paxos_setopt(struct paxos_session *session, motmot_option_t opt,
+    unsigned value)
+{
+  struct paxos_options *options;
+
+  if (session != NULL && session->ended) {
+    return 1;
+  }
+  options = (session == NULL) ? &state->options : &session->options;
+
+  switch (opt) {
+    case MOTMOT_OPT_SNAPSHOT_JOIN:
+      options->po_snapshot_join = value;
+      break;
+    case MOTMOT_OPT_THRIFTY:
+      options->po_thrifty = value;
+      break;
+    case MOTMOT_OPT_MAX_VOTERS:
+      options->po_max_voters = value;
+      break;
+    case MOTMOT_OPT_PREPARE_QUORUM:
+    case MOTMOT_OPT_ACCEPT_QUORUM:
+      if (session != NULL) {
+        return 1;
+      }
+      options->po_quorum[opt - MOTMOT_OPT_PREPARE_QUORUM] = value;
+      break;
+    case MOTMOT_OPT_INLINE_MAX:
+      options->po_inline_max = value;
+      break;
+    case MOTMOT_OPT_BLOB_MIN:
+      options->po_blob_min = value;
+      break;
+    case MOTMOT_OPT_ERASURE:
+      options->po_erasure = value;
+      break;
+    case MOTMOT_OPT_RELAY_FANOUT:
+      options->po_fanout = value;
+      break;
+    case MOTMOT_OPT_STAR:
+      if (session != NULL) {
+        return 1;
+      }
+      options->po_star = value;
+      break;
+    case MOTMOT_OPT_SYNC_COUNT:
+      options->po_sync_count = value;
+      break;
+    case MOTMOT_OPT_SYNC_BYTES:
+      options->po_sync_bytes = value;
+      break;
+    case MOTMOT_OPT_SYNC_DELAY:
+      if (value == 0) {
+        return 1;
+      }
+      options->po_sync_delay = value;
+      break;
+    case MOTMOT_OPT_PART_DELAY:
+      options->po_part_delay = value;
+      break;
+    case MOTMOT_OPT_BLOB_SPILL:
+      if (session != NULL) {
+        return 1;
+      }
+      state->blobs.bs_spill = value;
+      break;
+    case MOTMOT_OPT_WAL_EACH:
+      if (session != NULL) {
+        return 1;
+      }
+      state->wal_each = value;
+      break;
+    default:
+      return 1;
+  }
+
+  return 0;
+}
+
 /**
  * paxos_register_connection - Register a channel with Paxos.
  *
@@ -164,10 +361,14 @@ paxos_drop_connection(struct paxos_peer *source)
 {
   int r = 0, found;
   struct paxos_acceptor *acc;
+  struct paxos_session *next;
 
-  // Process the drop for every session.
+  // Process the drop for every session.  Sessions may end as a result, so
+  // we grab the next one before processing each.
   // XXX: Have a single global list of connections.
-  LIST_FOREACH(pax, &state.sessions, session_le) {
+  for (pax = LIST_FIRST(&state->sessions);
+      pax != (void *)&state->sessions; pax = next) {
+    next = LIST_NEXT(pax, session_le);
     found = false;
 
     // If the acceptor is participating in this session, mark it as dead.
@@ -182,20 +383,43 @@ paxos_drop_connection(struct paxos_peer *source)
     }
 
     if (!found) {
+      // If the connection was only a deferred hello, just forget it; we may
+      // have been streaming our ilist to it.
+      LIST_FOREACH(acc, &pax->adefer, pa_le) {
+        if (acc->pa_peer == source) {
+          LIST_REMOVE(&pax->adefer, acc, pa_le);
+          acceptor_destroy(acc);
+          break;
+        }
+      }
       continue;
     }
 
     if (is_proposer()) {
       // If we are the proposer, decree a part for the acceptor.
-      ERR_ACCUM(r, proposer_decree_part(acc, 0));
-    } else if (acc->pa_paxid == pax->proposer->pa_paxid) {
+      ERR_ACCUM(r, proposer_part_dropped(acc));
+    } else if (pax->proposer != NULL &&
+        acc->pa_paxid == pax->proposer->pa_paxid) {
       // Otherwise, check if we lost the proposer.  If so, we "elect" the new
-      // proposer, and if it's ourselves, we send a prepare.
+      // proposer, and if it's ourselves, we send a prepare.  We can't lead
+      // without our full ilist, though, so if it is still streaming in, we
+      // give up on the session instead.
       reset_proposer();
       if (is_proposer()) {
+        if (pax->backfill != NULL) {
+          ERR_ACCUM(r, paxos_end(pax));
+          continue;
+        }
         ERR_ACCUM(r, proposer_prepare(acc));
       }
     }
+
+    // If we lost whoever was streaming our ilist to us, fetch it from the
+    // proposer instead, or from anyone else still connected if it was the
+    // proposer we lost.
+    if (pax->backfill != NULL && pax->backfill->pb_source == acc->pa_paxid) {
+      ERR_ACCUM(r, acceptor_refetch());
+    }
   }
 
   return r;
@@ -237,12 +461,21 @@ proposer_dispatch(struct paxos_peer *source, struct paxos_header *hdr,
     case OP_REQUEST:
       r = proposer_ack_request(hdr, o);
       break;
+    case OP_REQUESTS:
+      r = proposer_ack_requests(hdr, o);
+      break;
     case OP_RETRIEVE:
       r = paxos_ack_retrieve(hdr, o);
       break;
     case OP_RESEND:
       r = paxos_ack_resend(hdr, o);
       break;
+    case OP_BLOB_GET:
+      r = paxos_ack_blob_get(hdr, o);
+      break;
+    case OP_BLOB_PUT:
+      r = paxos_ack_blob_put(hdr, o);
+      break;
 
     case OP_WELCOME:
       // Invalid system state; kill the offender.
@@ -251,6 +484,16 @@ proposer_dispatch(struct paxos_peer *source, struct paxos_header *hdr,
     case OP_HELLO:
       r = paxos_ack_hello(source, hdr);
       break;
+    case OP_FETCH:
+      r = paxos_ack_fetch(hdr, o);
+      break;
+    case OP_BACKFILL:
+      // Invalid system state; kill the offender.
+      r = proposer_force_kill(source);
+      break;
+    case OP_RESUME:
+      r = paxos_ack_resume(source, hdr, o);
+      break;
 
     case OP_REDIRECT:
       r = proposer_ack_redirect(hdr, o);
@@ -266,7 +509,7 @@ proposer_dispatch(struct paxos_peer *source, struct paxos_header *hdr,
       break;
 
     case OP_RETRY:
-      r = proposer_ack_retry(hdr);
+      r = proposer_ack_retry(source, hdr);
       break;
     case OP_RECOMMIT:
       // Invalid system state; kill the offender.
@@ -281,9 +524,14 @@ proposer_dispatch(struct paxos_peer *source, struct paxos_header *hdr,
       r = proposer_ack_last(hdr, o);
       break;
     case OP_TRUNCATE:
+    case OP_SNAPSHOT:
       // Invalid system state; kill the offender.
       r = proposer_force_kill(source);
       break;
+
+    case OP_RELAY:
+      r = paxos_ack_relay(source, hdr, o);
+      break;
   }
 
   return r;
@@ -322,12 +570,21 @@ acceptor_dispatch(struct paxos_peer *source, struct paxos_header *hdr,
     case OP_REQUEST:
       r = acceptor_ack_request(source, hdr, o);
       break;
+    case OP_REQUESTS:
+      r = acceptor_ack_requests(source, hdr, o);
+      break;
     case OP_RETRIEVE:
       r = paxos_ack_retrieve(hdr, o);
       break;
     case OP_RESEND:
       r = paxos_ack_resend(hdr, o);
       break;
+    case OP_BLOB_GET:
+      r = paxos_ack_blob_get(hdr, o);
+      break;
+    case OP_BLOB_PUT:
+      r = paxos_ack_blob_put(hdr, o);
+      break;
 
     case OP_WELCOME:
       // Ignore welcomes; they should be handled in paxos_dispatch().
@@ -335,6 +592,15 @@ acceptor_dispatch(struct paxos_peer *source, struct paxos_header *hdr,
     case OP_HELLO:
       r = paxos_ack_hello(source, hdr);
       break;
+    case OP_FETCH:
+      r = paxos_ack_fetch(hdr, o);
+      break;
+    case OP_BACKFILL:
+      r = acceptor_ack_backfill(hdr, o);
+      break;
+    case OP_RESUME:
+      r = paxos_ack_resume(source, hdr, o);
+      break;
 
     case OP_REDIRECT:
       // Ignore redirects.
@@ -362,6 +628,13 @@ acceptor_dispatch(struct paxos_peer *source, struct paxos_header *hdr,
     case OP_TRUNCATE:
       r = acceptor_ack_truncate(hdr, o);
       break;
+    case OP_SNAPSHOT:
+      r = acceptor_ack_snapshot(hdr, o);
+      break;
+
+    case OP_RELAY:
+      r = paxos_ack_relay(source, hdr, o);
+      break;
   }
 
   return 0;
@@ -385,7 +658,7 @@ paxos_dispatch(struct paxos_peer *source, const msgpack_object *o)
   paxos_header_unpack(hdr, o->via.array.ptr);
 
   // Bind `pax` to the session identified in the message header.
-  pax = session_find(&state.sessions, &hdr->ph_session);
+  pax = session_find(&state->sessions, &hdr->ph_session);
   if (pax == NULL) {
     // If we have no session, wait for a welcome message.
     if (hdr->ph_opcode == OP_WELCOME) {
@@ -10,6 +10,9 @@
 #include "types/primitives.h"
 #include "types/core.h"
 #include "types/connect.h"
+#include "types/blob.h"
+#include "types/erasure.h"
+#include "types/wal.h"
 #include "types/continuation.h"
 #include "types/session_local.h"
 #include "types/session.h"
@@ -19,18 +22,52 @@ struct learn_table {
   learn_t chat;
   learn_t join;
   learn_t part;
+  learn_batch_t chats;
 };
 
 /* Paxos protocol interface. */
-int paxos_init(connect_t, struct learn_table *, enter_t, leave_t);
-void *paxos_start(const void *, size_t, void *);
+struct motmot_ctx *paxos_init(connect_t, struct learn_table *, enter_t,
+    leave_t, GMainContext *);
+void paxos_state_init(void);
+struct paxos_state *paxos_enter(struct motmot_ctx *);
+struct paxos_state *paxos_enter_session(struct paxos_session *);
+void paxos_leave(struct paxos_state *);
+struct paxos_shard *paxos_shard_main(void);
+int paxos_shard_init(unsigned);
+void *paxos_shard_start(const void *, size_t, void *);
+int paxos_shard_invoke(struct paxos_session *, GSourceFunc, void *);
+void *paxos_start(pax_uuid_t *, const void *, size_t, void *);
 int paxos_end(void *data);
+int paxos_setopt(struct paxos_session *, motmot_option_t, unsigned);
 
 int paxos_register_connection(GIOChannel *);
+int paxos_io_init(unsigned);
 int paxos_drop_connection(struct paxos_peer *);
 
-int paxos_request(struct paxos_session *, dkind_t, const void *, size_t len);
+int paxos_request(struct paxos_session *, dkind_t, paxid_t, const void *,
+    size_t len);
+int paxos_request_take(struct paxos_session *, void *, size_t,
+    motmot_release_t, void *);
+int paxos_submit_init(void);
+int paxos_submit(pax_uuid_t, dkind_t, paxid_t, const void *, size_t);
+int paxos_submit_take(pax_uuid_t, void *, size_t, motmot_release_t, void *);
+int paxos_submitv(pax_uuid_t, const struct iovec *, size_t);
+int paxos_requestv(struct paxos_session *, const struct iovec *, size_t);
 int paxos_sync(void *);
+void paxos_sync_schedule(void);
+int paxos_learn_batch(learn_batch_t);
+int paxos_deliver_init(GMainContext *);
+void paxos_deliver_learn(learn_t, const void *, size_t, void *, size_t,
+    void *);
+void paxos_deliver_batch(learn_batch_t, const motmot_chat_t *, size_t,
+    void *);
+void paxos_deliver_leave(struct paxos_session *);
+int paxos_wal_open(const char *);
+int paxos_history_init(const char *);
+void paxos_history_open(void);
+size_t paxos_history_read(struct paxos_session *, unsigned,
+    motmot_history_entry_t *, size_t);
+unsigned paxos_history_find(struct paxos_session *, unsigned long long);
 
 /**
  *    Wire Protocol:
@@ -42,19 +79,23 @@ int paxos_sync(void *);
  *
  * - OP_PREPARE: None.
  * - OP_PROMISE: A variable-length array of packed paxos_instance objects.
- * - OP_DECREE: The paxos_value of the decree.
+ * - OP_DECREE: The paxos_value of the decree, or the whole paxos_request if
+ *   the value is an inline chat.
  * - OP_ACCEPT: None.
- * - OP_COMMIT: The paxos_value of the commit.
+ * - OP_COMMIT: As for OP_DECREE.
  *
- * - OP_WELCOME: An array consisting of the starting instance number (which
- *   respects truncation), the alist, and the ilist of the proposer, used
- *   to initialize the newcomer.
+ * - OP_WELCOME: An array consisting of the session ID, the starting instance
+ *   number (which respects truncation), the proposer's first unlearned
+ *   instance number, the proposer's last instance number, whether the
+ *   newcomer should fetch the rest of the ilist from a peer, the session's
+ *   prepare and accept quorum settings, and its star successor count; the
+ *   alist; and the starting instance, used to initialize the newcomer.
  * - OP_HELLO: None.
  *
  * - OP_REQUEST: The paxos_request object.
  * - OP_RETRIEVE: A msgpack array containing the ID of the retriever and
- *   the paxos_value referencing the request.
- * - OP_RESEND: The paxos_request object being resent.
+ *   an array of the paxos_values referencing the requests.
+ * - OP_RESEND: An array of the paxos_request objects being resent.
  *
  * - OP_REDIRECT: The header of the message that resulted in our redirecting.
  * - OP_REFUSE: The header of the message that resulted in our refusal, along
@@ -62,12 +103,33 @@ int paxos_sync(void *);
  * - OP_REJECT: None.
  *
  * - OP_RETRY: None.
- * - OP_COMMIT: The paxos_value of the commit.
+ * - OP_RECOMMIT: As for OP_DECREE.
  *
  * - OP_SYNC: None.
  * - OP_LAST: The instance number of the acceptor's last contiguous learn.
  * - OP_TRUNCATE: The new starting point of the instance log.
  *
+ * - OP_BACKFILL: A variable-length array of packed paxos_instance objects
+ *   continuing the ilist sent in the welcome.
+ * - OP_FETCH: The ID of the fetcher.
+ *
+ * - OP_BLOB_GET: An array containing the ID of the fetcher, a blob reference,
+ *   and an array of the indices of the chunks it wants.
+ * - OP_BLOB_PUT: An array containing a blob reference, a chunk index, and
+ *   the chunk data.  For erasure-coded blobs, the "chunks" are fragments.
+ *
+ * - OP_RELAY: An array of the fanout of the relay tree, the root's alist as
+ *   an array of paxids starting with the root, and the message being
+ *   relayed.
+ *
+ * - OP_SNAPSHOT: An array of the alist and the instance of the proposer's
+ *   last learn, from which the recipient resumes learning.
+ *
+ * - OP_RESUME: The instance number of the resumer's last contiguous learn.
+ *
+ * - OP_REQUESTS: An array of paxos_request objects with consecutive request
+ *   IDs.
+ *
  * The message formats of the various Paxos structures can be found in
  * paxos_msgpack.c.
  */
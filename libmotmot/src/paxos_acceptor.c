@@ -25,6 +25,19 @@
 int
 acceptor_ack_prepare(struct paxos_peer *source, struct paxos_header *hdr)
 {
+  // Learners neither promise nor redirect, but we still track the ballot so
+  // that we can talk to the proposer.
+  if (pax->learner) {
+    if (ballot_compare(hdr->ph_ballot, pax->ballot) > 0 &&
+        pax->proposer != NULL && pax->proposer->pa_peer == source) {
+      pax->ballot.id = hdr->ph_ballot.id;
+      pax->ballot.gen = hdr->ph_ballot.gen;
+      pax->gen_high = pax->ballot.gen;
+      paxos_wal_ballot();
+    }
+    return 0;
+  }
+
   // If the ballot being prepared for is <= our most recent ballot, or if
   // the preparer is not the highest-ranking acceptor (i.e., the proposer),
   // send a redirect.
@@ -56,6 +69,7 @@ acceptor_promise(struct paxos_header *hdr)
   pax->ballot.id = hdr->ph_ballot.id;
   pax->ballot.gen = hdr->ph_ballot.gen;
   pax->gen_high = pax->ballot.gen;
+  paxos_wal_ballot();
 
   // Start off the payload with the header.
   hdr->ph_opcode = OP_PROMISE;
@@ -80,8 +94,8 @@ acceptor_promise(struct paxos_header *hdr)
     paxos_instance_pack(&py, it);
   }
 
-  // Send off our payload.
-  r = paxos_send_to_proposer(&py);
+  // Send off our payload once our ballot is durable.
+  r = paxos_wal_send(&py);
   paxos_payload_destroy(&py);
 
   return r;
@@ -101,6 +115,11 @@ acceptor_ack_decree(struct paxos_header *hdr, msgpack_object *o)
   struct paxos_acceptor *acc;
   struct paxos_instance *inst;
 
+  // Learners don't vote.
+  if (pax->learner) {
+    return 0;
+  }
+
   // Check the ballot on the message.  If it's not the most recent ballot
   // that we've prepared for, we do not agree with the decree and simply take
   // no action.
@@ -120,7 +139,7 @@ acceptor_ack_decree(struct paxos_header *hdr, msgpack_object *o)
 
   // Unpack the value and see if it decrees a part.  If so, but if the target
   // acceptor is still alive, reject the decree.
-  paxos_value_unpack(&val, o);
+  paxos_value_unpack_inline(&val, o);
   if (val.pv_dkind == DEC_PART) {
     acc = acceptor_find(&pax->alist, val.pv_extra);
     if (acc->pa_peer != NULL) {
@@ -174,13 +193,16 @@ acceptor_accept(struct paxos_header *hdr)
   int r;
   struct paxos_yak py;
 
+  // Log the instance we are accepting.
+  paxos_wal_instance(instance_find(&pax->ilist, hdr->ph_inum));
+
   // Pack a header.
   hdr->ph_opcode = OP_ACCEPT;
   paxos_payload_init(&py, 1);
   paxos_header_pack(&py, hdr);
 
-  // Send the payload.
-  r = paxos_send_to_proposer(&py);
+  // Send the payload once the accept is durable.
+  r = paxos_wal_send(&py);
   paxos_payload_destroy(&py);
 
   return r;
@@ -220,7 +242,7 @@ acceptor_ack_commit(struct paxos_header *hdr, msgpack_object *o)
   // It's possible that we accepted a decree for inst->pi_inum which was never
   // committed, and then we received a commit for a later ballot for which
   // we never received the original decree.  So, we always reset the value.
-  paxos_value_unpack(&inst->pi_val, o);
+  paxos_value_unpack_inline(&inst->pi_val, o);
 
   // Perform the commit.
   return paxos_commit(inst);
@@ -0,0 +1,396 @@
+/**
+ * paxos_blob.c - Lazy fetching of large chat payloads.
+ */
+
+#include <assert.h>
+#include <glib.h>
+
+#include "paxos.h"
+#include "paxos_continue.h"
+#include "paxos_io.h"
+#include "paxos_msgpack.h"
+#include "paxos_print.h"
+#include "paxos_protocol.h"
+#include "paxos_state.h"
+#include "paxos_util.h"
+#include "containers/list.h"
+
+#define BLOB_TIMEOUT      500
+#define BLOB_WINDOW       64
+
+/**
+ * paxos_blob_expect - Get the blob referenced by a large chat, making room
+ * to fetch it if we don't have it yet.  Returns NULL if the reference is
+ * malformed, in which case nobody will ever be able to fetch the blob.
+ */
+struct paxos_blob *
+paxos_blob_expect(struct paxos_request *req)
+{
+  if (req->pr_size != BLOB_REF_SIZE) {
+    return NULL;
+  }
+  return blob_store_expect(&state->blobs, req->pr_data);
+}
+
+/**
+ * paxos_blob_await - Make room for the fragments of a coded blob which a
+ * requester is about to push to us, so that we keep them when they arrive.
+ */
+void
+paxos_blob_await(struct paxos_request *req)
+{
+  if (req->pr_val.pv_dkind == DEC_CHAT &&
+      (req->pr_val.pv_extra & CHAT_BLOB) &&
+      req->pr_size == BLOB_REF_SIZE && blob_ref_coded(req->pr_data)) {
+    paxos_blob_expect(req);
+  }
+}
+
+/**
+ * paxos_blob_ready - Check whether we have everything we need to learn a
+ * request, i.e., the payload for a blob chat.  A chat with a malformed
+ * reference is as ready as it will ever be.
+ */
+bool
+paxos_blob_ready(struct paxos_request *req)
+{
+  struct paxos_blob *blob;
+
+  if (req->pr_val.pv_dkind != DEC_CHAT ||
+      !(req->pr_val.pv_extra & CHAT_BLOB)) {
+    return true;
+  }
+
+  blob = paxos_blob_expect(req);
+  return blob == NULL || blob->pb_chunks == NULL;
+}
+
+/**
+ * blob_target - Pick the peer to ask for the sent-th missing piece of a blob.
+ *
+ * For chunked blobs, we deal the chunks out among every live peer so that
+ * they are fetched in parallel.  For coded blobs, fragment i was pushed to
+ * the i-th member of the alist, so we start by asking them.  Either way, we
+ * rotate the deal each round so that pieces which a peer couldn't give us
+ * are asked of someone else next time.
+ */
+static unsigned
+blob_target(struct paxos_blob *blob, unsigned i, unsigned sent, unsigned n)
+{
+  if (blob->pb_k != 0) {
+    return (i + pax->blob_round) % n;
+  }
+  return (sent + pax->blob_round) % n;
+}
+
+/**
+ * blob_get - Ask our peers for the pieces of a blob that we're missing.
+ */
+static int
+blob_get(struct paxos_request *req)
+{
+  int r = 0;
+  unsigned i, j, n, count, sent, window;
+  struct paxos_header hdr;
+  struct paxos_blob *blob;
+  struct paxos_acceptor *acc, **peers;
+  struct paxos_yak py;
+
+  blob = paxos_blob_expect(req);
+  if (blob == NULL || blob->pb_chunks == NULL) {
+    return 0;
+  }
+
+  // Collect our peers: the whole alist for coded blobs, since fragments map
+  // to alist positions, or just the live ones otherwise.
+  peers = g_malloc0(LIST_COUNT(&pax->alist) * sizeof(*peers));
+  n = 0;
+  LIST_FOREACH(acc, &pax->alist, pa_le) {
+    if (acc->pa_peer != NULL || blob->pb_k != 0) {
+      peers[n++] = acc;
+    }
+  }
+  if (n == 0) {
+    g_free(peers);
+    return 1;
+  }
+
+  // We need only as many fragments as we're missing.
+  window = (blob->pb_k != 0) ? blob->pb_missing : BLOB_WINDOW;
+
+  header_init(&hdr, OP_BLOB_GET, 0);
+
+  // Send each live peer its share of a window of missing pieces.
+  for (j = 0; j < n; ++j) {
+    if (peers[j]->pa_peer == NULL) {
+      continue;
+    }
+
+    count = 0;
+    for (i = 0, sent = 0; i < blob_chunk_count(blob) && sent < window; ++i) {
+      if (!blob->pb_chunks[i]) {
+        if (blob_target(blob, i, sent++, n) == j) {
+          count++;
+        }
+      }
+    }
+    if (count == 0) {
+      continue;
+    }
+
+    paxos_payload_init(&py, 2);
+    paxos_header_pack(&py, &hdr);
+    paxos_payload_begin_array(&py, 3);
+    paxos_paxid_pack(&py, pax->self_id);
+    msgpack_pack_raw(py.pk, BLOB_REF_SIZE);
+    msgpack_pack_raw_body(py.pk, req->pr_data, BLOB_REF_SIZE);
+    msgpack_pack_array(py.pk, count);
+    for (i = 0, sent = 0; i < blob_chunk_count(blob) && sent < window; ++i) {
+      if (!blob->pb_chunks[i]) {
+        if (blob_target(blob, i, sent++, n) == j) {
+          msgpack_pack_unsigned_int(py.pk, i);
+        }
+      }
+    }
+
+    ERR_ACCUM(r, paxos_send(peers[j], &py));
+    paxos_payload_destroy(&py);
+  }
+
+  g_free(peers);
+  return r;
+}
+
+/**
+ * paxos_blob_push - Send each member of the alist its own fragment of an
+ * erasure-coded blob we are sending, so that our upload is about n/k times
+ * the size of the payload rather than n times.
+ */
+int
+paxos_blob_push(struct paxos_blob *blob, const char *ref)
+{
+  int r = 0;
+  unsigned i;
+  size_t len;
+  char *frag;
+  struct paxos_header hdr;
+  struct paxos_acceptor *acc;
+  struct paxos_yak py;
+
+  header_init(&hdr, OP_BLOB_PUT, 0);
+
+  i = 0;
+  LIST_FOREACH(acc, &pax->alist, pa_le) {
+    if (acc->pa_peer == NULL) {
+      i++;
+      continue;
+    }
+
+    frag = blob_chunk_copy(&state->blobs, blob, ref, i, &len);
+    if (frag == NULL) {
+      return 1;
+    }
+
+    paxos_payload_init(&py, 2);
+    paxos_header_pack(&py, &hdr);
+    paxos_payload_begin_array(&py, 3);
+    msgpack_pack_raw(py.pk, BLOB_REF_SIZE);
+    msgpack_pack_raw_body(py.pk, ref, BLOB_REF_SIZE);
+    msgpack_pack_unsigned_int(py.pk, i);
+    msgpack_pack_raw(py.pk, len);
+    msgpack_pack_raw_body(py.pk, frag, len);
+    ERR_ACCUM(r, paxos_send(acc, &py));
+    paxos_payload_destroy(&py);
+    g_free(frag);
+
+    i++;
+  }
+
+  return r;
+}
+
+/**
+ * paxos_blob_fetch - Fetch the payload of a committed blob chat, deferring
+ * the commit until we have it.
+ *
+ * We ask for the first window of chunks right away, and then schedule a
+ * periodic retry which keeps fetching until every blob we are waiting on
+ * has arrived.
+ */
+int
+paxos_blob_fetch(struct paxos_instance *inst)
+{
+  pax_uuid_t *uuid;
+  struct paxos_request *req;
+
+  req = rcache_find(pax, inst->pi_val.pv_reqid);
+  assert(req != NULL);
+
+  if (!pax->blob_pending) {
+    pax->blob_pending = true;
+
+    uuid = g_malloc0(sizeof(*uuid));
+    *uuid = *pax->session_id;
+    paxos_timeout_add(BLOB_TIMEOUT, paxos_blob_retry, uuid);
+  }
+
+  return blob_get(req);
+}
+
+/**
+ * paxos_blob_retry - GEvent-friendly routine which asks again for whatever
+ * blob chunks we are still missing.
+ */
+int
+paxos_blob_retry(void *data)
+{
+  bool waiting = false;
+  pax_uuid_t *uuid;
+  struct paxos_instance *it;
+  struct paxos_request *req;
+
+  // Set the session, which may have ended while we were waiting.
+  uuid = (pax_uuid_t *)data;
+  pax = session_find(&state->sessions, uuid);
+  if (pax == NULL) {
+    g_free(uuid);
+    return FALSE;
+  }
+
+  // Learn anything whose blob was completed for another session.
+  paxos_commit_ready();
+  if (session_find(&state->sessions, uuid) == NULL) {
+    g_free(uuid);
+    return FALSE;
+  }
+
+  pax->blob_round++;
+
+  for (it = pax->istart; it != (void *)&pax->ilist; it = LIST_NEXT(it, pi_le)) {
+    if (!it->pi_committed || it->pi_cached) {
+      continue;
+    }
+    req = rcache_find(pax, it->pi_val.pv_reqid);
+    if (req != NULL && !paxos_blob_ready(req)) {
+      blob_get(req);
+      waiting = true;
+    }
+  }
+
+  if (!waiting) {
+    pax->blob_pending = false;
+    g_free(uuid);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/**
+ * paxos_ack_blob_get - Send a fetcher whichever of the chunks they asked for
+ * that we have, one message apiece.
+ */
+int
+paxos_ack_blob_get(struct paxos_header *hdr, msgpack_object *o)
+{
+  int r = 0;
+  paxid_t paxid;
+  size_t len;
+  char *chunk;
+  msgpack_object *p, *q, *qend;
+  struct paxos_acceptor *acc;
+  struct paxos_blob *blob;
+  struct paxos_yak py;
+
+  // Ignore anything malformed.
+  if (o->type != MSGPACK_OBJECT_ARRAY || o->via.array.size != 3) {
+    return 0;
+  }
+  p = o->via.array.ptr;
+  if (p[0].type != MSGPACK_OBJECT_POSITIVE_INTEGER ||
+      p[1].type != MSGPACK_OBJECT_RAW || p[1].via.raw.size != BLOB_REF_SIZE ||
+      p[2].type != MSGPACK_OBJECT_ARRAY) {
+    return 0;
+  }
+
+  // Find the fetcher.
+  paxos_paxid_unpack(&paxid, p++);
+  acc = acceptor_find(&pax->alist, paxid);
+  if (acc == NULL || acc->pa_peer == NULL) {
+    return 0;
+  }
+
+  // Find the blob; if we've never heard of it, we can't help.
+  blob = blob_find(state->blobs.bs_table, (void *)p->via.raw.ptr);
+  if (blob == NULL) {
+    return 0;
+  }
+
+  hdr->ph_opcode = OP_BLOB_PUT;
+
+  // Send each chunk that we have.
+  q = p + 1;
+  qend = q->via.array.ptr + q->via.array.size;
+  for (q = q->via.array.ptr; q != qend; ++q) {
+    if (q->type != MSGPACK_OBJECT_POSITIVE_INTEGER ||
+        q->via.u64 > G_MAXUINT) {
+      continue;
+    }
+    chunk = blob_chunk_copy(&state->blobs, blob, p->via.raw.ptr, q->via.u64,
+        &len);
+    if (chunk == NULL) {
+      continue;
+    }
+
+    paxos_payload_init(&py, 2);
+    paxos_header_pack(&py, hdr);
+    paxos_payload_begin_array(&py, 3);
+    msgpack_pack_raw(py.pk, BLOB_REF_SIZE);
+    msgpack_pack_raw_body(py.pk, p->via.raw.ptr, BLOB_REF_SIZE);
+    msgpack_pack_unsigned_int(py.pk, q->via.u64);
+    msgpack_pack_raw(py.pk, len);
+    msgpack_pack_raw_body(py.pk, chunk, len);
+    ERR_ACCUM(r, paxos_send(acc, &py));
+    paxos_payload_destroy(&py);
+    g_free(chunk);
+  }
+
+  return r;
+}
+
+/**
+ * paxos_ack_blob_put - Store a chunk, and learn whatever we can once its
+ * blob is complete.
+ *
+ * We only take pieces of blobs we are expecting, i.e., those we are fetching
+ * or whose fragments the requester told us to await.  Anything else is
+ * either stale or unsolicited, and keeping it would let any peer fill our
+ * memory.
+ */
+int
+paxos_ack_blob_put(struct paxos_header *hdr, msgpack_object *o)
+{
+  msgpack_object *p;
+  struct paxos_blob *blob;
+
+  // Ignore anything malformed.
+  if (o->type != MSGPACK_OBJECT_ARRAY || o->via.array.size != 3) {
+    return 0;
+  }
+  p = o->via.array.ptr;
+  if (p[0].type != MSGPACK_OBJECT_RAW || p[0].via.raw.size != BLOB_REF_SIZE ||
+      p[1].type != MSGPACK_OBJECT_POSITIVE_INTEGER ||
+      p[1].via.u64 > G_MAXUINT || p[2].type != MSGPACK_OBJECT_RAW) {
+    return 0;
+  }
+
+  blob = blob_find(state->blobs.bs_table, (void *)p[0].via.raw.ptr);
+  if (blob == NULL) {
+    return 0;
+  }
+
+  if (blob_chunk_fill(&state->blobs, blob, p[0].via.raw.ptr, p[1].via.u64,
+        p[2].via.raw.ptr, p[2].via.raw.size)) {
+    return paxos_commit_ready();
+  }
+  return 0;
+}
@@ -10,10 +10,16 @@
     int r = 0;                                                  \
     struct paxos_continuation *k;                               \
     struct paxos_acceptor *acc;                                 \
+    struct paxos_state *prev;                                   \
                                                                 \
+    /* Run against the state which made the connect.  */        \
     k = data;                                                   \
-    pax = session_find(&state.sessions, k->pk_session_id);      \
+    prev = state;                                               \
+    state = k->pk_state;                                        \
+                                                                \
+    pax = session_find(&state->sessions, k->pk_session_id);     \
     if (pax == NULL) {                                          \
+      state = prev;                                             \
       return 0;                                                 \
     }                                                           \
                                                                 \
@@ -27,5 +33,6 @@
     LIST_REMOVE(&pax->clist, k, pk_le);                         \
     continuation_destroy(k);                                    \
                                                                 \
+    state = prev;                                               \
     return r;                                                   \
   }
@@ -0,0 +1,239 @@
+/**
+ * paxos_deliver.c - Delivery of learns to the client.
+ *
+ * By default, we invoke the client's learning callbacks as we learn, in the
+ * middle of handling whatever message let us learn.  A client whose
+ * callbacks are slow may instead ask for them to be run from a main context
+ * of its choosing.  We then copy each event onto a lock-free stack and
+ * schedule an idle source on that context to drain it, so that our own
+ * progress no longer waits on the client.  The drain takes the whole stack
+ * at once and puts it back in order, so events reach the client in the order
+ * we learned them, and a session's leave comes after all of its learns.
+ *
+ * The client may call in on a session until it hears that the session has
+ * ended, so we only destroy the session, back on its own thread, once its
+ * leave has been delivered.
+ */
+
+#include <string.h>
+#include <glib.h>
+
+#include "paxos.h"
+#include "paxos_state.h"
+
+/* Kinds of events we queue for the client. */
+enum deliver_kind {
+  DELIVER_LEARN = 0,    // a chat, join, or part for a learn_t callback
+  DELIVER_BATCH,        // a run of chats for the batch callback
+  DELIVER_LEAVE,        // the end of a session
+};
+
+/* A queued event.  The chats, along with copies of their messages and
+ * descriptors, trail the structure. */
+struct deliver_event {
+  struct deliver_event *de_next;  // next event on the stack
+  enum deliver_kind de_kind;      // kind of event
+  learn_t de_learn;               // callback for DELIVER_LEARN
+  learn_batch_t de_batch;         // callback for DELIVER_BATCH
+  void *de_data;                  // client's session data
+  struct paxos_session *de_session; // session to destroy for DELIVER_LEAVE
+  size_t de_count;                // number of chats
+  motmot_chat_t de_chats[];       // the chats
+};
+
+/**
+ * paxos_deliver_init - Deliver all further events on a main context.
+ */
+int
+paxos_deliver_init(GMainContext *context)
+{
+  if (state->deliver_context != NULL || context == NULL) {
+    return 1;
+  }
+
+  state->deliver_context = g_main_context_ref(context);
+  return 0;
+}
+
+/**
+ * deliver_reap - GEvent-friendly routine which destroys a session whose leave
+ * has been delivered, on the session's own thread.
+ */
+static int
+deliver_reap(void *data)
+{
+  struct paxos_state *prev;
+
+  prev = paxos_enter_session(data);
+  pax = data;
+  session_destroy(pax);
+  paxos_leave(prev);
+
+  return FALSE;
+}
+
+/**
+ * paxos_deliver_flush - GEvent-friendly routine which runs the client's
+ * callbacks on everything a shard has queued.  This is the only part of us
+ * which runs on the client's context, so it must use the state of the shard
+ * which scheduled it rather than its own thread's.
+ */
+static int
+paxos_deliver_flush(void *data)
+{
+  size_t i;
+  struct paxos_state *st = data;
+  struct deliver_event *head, *ev, *prev;
+  motmot_chat_t *chat;
+
+  // Take the whole stack.  Anything queued from here on finds it empty and
+  // schedules another flush.
+  do {
+    head = g_atomic_pointer_get(&st->deliver_head);
+  } while (!g_atomic_pointer_compare_and_exchange(&st->deliver_head, head,
+        NULL));
+
+  // The stack is newest first, so reverse it.
+  prev = NULL;
+  while (head != NULL) {
+    ev = head;
+    head = ev->de_next;
+    ev->de_next = prev;
+    prev = ev;
+  }
+
+  while ((ev = prev) != NULL) {
+    prev = ev->de_next;
+    switch (ev->de_kind) {
+      case DELIVER_LEARN:
+        for (i = 0; i < ev->de_count; ++i) {
+          chat = &ev->de_chats[i];
+          ev->de_learn(chat->message, chat->len, chat->desc, chat->size,
+              ev->de_data);
+        }
+        break;
+
+      case DELIVER_BATCH:
+        ev->de_batch(ev->de_chats, ev->de_count, ev->de_data);
+        break;
+
+      case DELIVER_LEAVE:
+        st->leave(ev->de_data);
+        paxos_shard_invoke(ev->de_session, deliver_reap, ev->de_session);
+        break;
+    }
+    g_free(ev);
+  }
+
+  return FALSE;
+}
+
+/**
+ * deliver_queue - Copy an event onto the stack, and schedule a flush on the
+ * client's context if there isn't one pending.
+ */
+static void
+deliver_queue(enum deliver_kind kind, learn_t learn, learn_batch_t batch,
+    const motmot_chat_t *chats, size_t count, void *data,
+    struct paxos_session *session)
+{
+  size_t i, bytes;
+  char *buf;
+  struct deliver_event *ev, *head;
+  GSource *source;
+
+  bytes = sizeof(*ev) + count * sizeof(*chats);
+  for (i = 0; i < count; ++i) {
+    bytes += chats[i].len + chats[i].size;
+  }
+
+  ev = g_malloc(bytes);
+  ev->de_kind = kind;
+  ev->de_learn = learn;
+  ev->de_batch = batch;
+  ev->de_data = data;
+  ev->de_session = session;
+  ev->de_count = count;
+
+  buf = (char *)&ev->de_chats[count];
+  for (i = 0; i < count; ++i) {
+    ev->de_chats[i].message = memcpy(buf, chats[i].message, chats[i].len);
+    ev->de_chats[i].len = chats[i].len;
+    buf += chats[i].len;
+    ev->de_chats[i].desc = memcpy(buf, chats[i].desc, chats[i].size);
+    ev->de_chats[i].size = chats[i].size;
+    buf += chats[i].size;
+  }
+
+  do {
+    head = g_atomic_pointer_get(&state->deliver_head);
+    ev->de_next = head;
+  } while (!g_atomic_pointer_compare_and_exchange(&state->deliver_head, head,
+        ev));
+
+  // Only the event which finds the stack empty needs to schedule a flush;
+  // the rest will be taken along with it.
+  if (head == NULL) {
+    source = g_idle_source_new();
+    g_source_set_callback(source, paxos_deliver_flush, state, NULL);
+    g_source_attach(source, state->deliver_context);
+    g_source_unref(source);
+  }
+}
+
+/**
+ * paxos_deliver_learn - Deliver a chat, join, or part to a learning callback.
+ */
+void
+paxos_deliver_learn(learn_t learn, const void *message, size_t len,
+    void *desc, size_t size, void *data)
+{
+  motmot_chat_t chat;
+
+  if (state->deliver_context == NULL) {
+    learn(message, len, desc, size, data);
+    return;
+  }
+
+  chat.message = message;
+  chat.len = len;
+  chat.desc = desc;
+  chat.size = size;
+  deliver_queue(DELIVER_LEARN, learn, NULL, &chat, 1, data, NULL);
+}
+
+/**
+ * paxos_deliver_batch - Deliver a run of chats to the batch callback.
+ */
+void
+paxos_deliver_batch(learn_batch_t batch, const motmot_chat_t *chats,
+    size_t count, void *data)
+{
+  if (state->deliver_context == NULL) {
+    batch(chats, count, data);
+    return;
+  }
+
+  deliver_queue(DELIVER_BATCH, NULL, batch, chats, count, data, NULL);
+}
+
+/**
+ * paxos_deliver_leave - Tell the client that a session has ended, and then
+ * destroy the session.
+ */
+void
+paxos_deliver_leave(struct paxos_session *session)
+{
+  void *data;
+
+  if (state->deliver_context == NULL) {
+    data = session->client_data;
+    pax = session;
+    session_destroy(session);
+    state->leave(data);
+    return;
+  }
+
+  deliver_queue(DELIVER_LEAVE, NULL, NULL, NULL, 0, session->client_data,
+      session);
+}
@@ -15,22 +15,50 @@
 #include "paxos_util.h"
 #include "containers/list.h"
 
+#define BACKFILL_INTERVAL     10      // ms between backfill chunks
+#define BACKFILL_CHUNK_MAX    256     // max instances per backfill chunk
+#define BACKFILL_WATERMARK    65536   // max buffered bytes before we backfill
+#define RESUME_TIMEOUT        10000   // ms we wait to be taken back on resume
+
+/* A part we are holding off on in case its target resumes. */
+struct part_delay {
+  pax_uuid_t pd_session;  // session of the dropped acceptor
+  paxid_t pd_paxid;       // ID of the dropped acceptor
+};
+
+static int backfill_start(struct paxos_acceptor *);
+
 /**
  * proposer_welcome - Welcome a new protocol participant by passing along
  *
  * struct {
  *   paxos_header hdr;
  *   struct {
- *     paxid_t ibase;
+ *     struct {
+ *       pax_uuid_t session_id;
+ *       paxid_t ibase;
+ *       paxid_t ihole;
+ *       paxid_t ilast;
+ *       bool snapshot;
+ *       unsigned quorum[2];
+ *     } bounds;
  *     paxos_acceptor alist[];
- *     paxos_instance ilist[];
+ *     paxos_instance first;
  *   } init_info;
  * }
  *
  * The header contains the ballot information and the new acceptor's paxid
  * in ph_inum (since its inum is just the instance number of its JOIN).
- * We also send over our list of acceptors and instances to start the new
- * acceptor off.
+ * We also send over our list of acceptors and a single committed instance of
+ * our ilist to start the new acceptor off.
+ *
+ * Normally, this is the first instance of our ilist, and the rest of the
+ * ilist, up to ilast, is streamed afterwards in bounded OP_BACKFILL chunks so
+ * that neither we nor the new acceptor need to handle the whole log at once.
+ * If the session uses snapshot joins, we instead send our last learned
+ * instance and set the snapshot flag; the new acceptor then fetches whatever
+ * follows from a nearby acceptor, sparing us both the history it would only
+ * no-op learn and the work of streaming the rest.
  *
  * We avoid sending over our request cache to reduce strain on the network;
  * the new acceptor can issue retrieves to obtain any necessary requests.
@@ -47,7 +75,7 @@ proposer_welcome(struct paxos_acceptor *acc)
   // Initiate a connection with the new acceptor and send the new acceptor
   // its initial state once the connection is established.
   k = continuation_new(continue_welcome, acc->pa_paxid);
-  ERR_RET(r, state.connect(acc->pa_desc, acc->pa_size, &k->pk_cb));
+  ERR_RET(r, state->connect(acc->pa_desc, acc->pa_size, &k->pk_cb));
 
   return 0;
 }
@@ -61,9 +89,10 @@ do_continue_welcome(GIOChannel *chan, struct paxos_acceptor *acc,
     struct paxos_continuation *k)
 {
   int r;
+  bool snapshot;
   struct paxos_header hdr;
   struct paxos_acceptor *acc_it;
-  struct paxos_instance *inst_it;
+  struct paxos_instance *first;
   struct paxos_yak py;
 
   acc->pa_peer = paxos_peer_init(chan);
@@ -73,6 +102,16 @@ do_continue_welcome(GIOChannel *chan, struct paxos_acceptor *acc,
     return proposer_decree_part(acc, 0);
   }
 
+  // Pick the instance to start the new acceptor off with.  Our last learn
+  // is never truncated, since truncation respects our own learns.
+  snapshot = pax->options.po_snapshot_join;
+  if (snapshot) {
+    first = instance_find(&pax->ilist, pax->ihole - 1);
+  } else {
+    first = LIST_FIRST(&pax->ilist);
+  }
+  assert(first != NULL && first->pi_committed);
+
   // Initialize a header.  The new acceptor's ID is also the instance number
   // of its JOIN.
   header_init(&hdr, OP_WELCOME, acc->pa_paxid);
@@ -82,10 +121,20 @@ do_continue_welcome(GIOChannel *chan, struct paxos_acceptor *acc,
   paxos_header_pack(&py, &hdr);
   paxos_payload_begin_array(&py, 3);
 
-  // Start off the info payload with the session ID and ibase.
-  paxos_payload_begin_array(&py, 2);
+  // Start off the info payload with the session ID and the bounds of our
+  // ilist.  Our ibase may trail our first instance if we were ourselves
+  // welcomed with a snapshot, so we send the latter.
+  paxos_payload_begin_array(&py, 8);
   paxos_uuid_pack(&py, pax->session_id);
-  paxos_paxid_pack(&py, pax->ibase);
+  paxos_paxid_pack(&py, first->pi_hdr.ph_inum);
+  paxos_paxid_pack(&py, pax->ihole);
+  paxos_paxid_pack(&py, LIST_LAST(&pax->ilist)->pi_hdr.ph_inum);
+  snapshot ? msgpack_pack_true(py.pk) : msgpack_pack_false(py.pk);
+
+  // Our quorum sizes and topology must agree, so pass them along too.
+  paxos_paxid_pack(&py, pax->options.po_quorum[0]);
+  paxos_paxid_pack(&py, pax->options.po_quorum[1]);
+  paxos_paxid_pack(&py, pax->options.po_star);
 
   // Pack the entire alist.  Hopefully we don't have too many un-parted
   // dropped acceptors (we shouldn't).
@@ -94,33 +143,179 @@ do_continue_welcome(GIOChannel *chan, struct paxos_acceptor *acc,
     paxos_acceptor_pack(&py, acc_it);
   }
 
-  // Pack the entire ilist.
-  paxos_payload_begin_array(&py, LIST_COUNT(&pax->ilist));
-  LIST_FOREACH(inst_it, &pax->ilist, pi_le) {
-    paxos_instance_pack(&py, inst_it);
-  }
+  // Pack the starting instance.
+  paxos_instance_pack(&py, first);
 
   // Send the welcome.
   r = paxos_send(acc, &py);
   paxos_payload_destroy(&py);
+  if (r || snapshot) {
+    return r;
+  }
 
-  return r;
+  // Start streaming the rest of the ilist if there is any.
+  if (first != LIST_LAST(&pax->ilist)) {
+    acc->pa_backfill = LIST_NEXT(first, pi_le);
+    acc->pa_backfill_end = LIST_LAST(&pax->ilist)->pi_hdr.ph_inum;
+    return backfill_start(acc);
+  }
+
+  return 0;
 }
 CONNECTINUATE(welcome);
 
+/**
+ * backfill_start - Begin streaming to a new acceptor from its backfill
+ * cursor.
+ *
+ * We send the first chunk right away; the rest are paced by paxos_backfill.
+ */
+static int
+backfill_start(struct paxos_acceptor *acc)
+{
+  int r;
+  pax_uuid_t *uuid;
+
+  ERR_RET(r, paxos_backfill_chunk(acc));
+
+  if (acc->pa_backfill != NULL && !pax->backfill_pending) {
+    pax->backfill_pending = true;
+
+    uuid = g_malloc0(sizeof(*uuid));
+    *uuid = *pax->session_id;
+    paxos_timeout_add(BACKFILL_INTERVAL, paxos_backfill, uuid);
+  }
+
+  return 0;
+}
+
+/**
+ * backfill_tick - Send the next chunk of each stream in an acceptor list,
+ * returning true if any stream is unfinished.
+ */
+static bool
+backfill_tick(acceptor_container *alist)
+{
+  bool pending = false;
+  struct paxos_acceptor *acc;
+
+  LIST_FOREACH(acc, alist, pa_le) {
+    if (acc->pa_backfill == NULL) {
+      continue;
+    }
+
+    // If we lost the new acceptor, stop streaming.
+    if (acc->pa_peer == NULL) {
+      acc->pa_backfill = NULL;
+      continue;
+    }
+
+    if (paxos_peer_pending(acc->pa_peer) < BACKFILL_WATERMARK) {
+      paxos_backfill_chunk(acc);
+    }
+    pending = pending || acc->pa_backfill != NULL;
+  }
+
+  return pending;
+}
+
+/**
+ * paxos_backfill - GEvent-friendly wrapper around paxos_backfill_chunk.
+ *
+ * We send at most one chunk to each new acceptor per tick, and only if its
+ * write buffer has drained, so that the stream is interleaved with (and
+ * never crowds out) live protocol traffic.  Acceptors fetching from us may
+ * still be on our defer list if we have yet to learn their joins.
+ */
+int
+paxos_backfill(void *data)
+{
+  bool pending;
+  pax_uuid_t *uuid;
+
+  // Set the session, which may have ended while we were waiting.
+  uuid = (pax_uuid_t *)data;
+  pax = session_find(&state->sessions, uuid);
+  if (pax == NULL) {
+    g_free(uuid);
+    return FALSE;
+  }
+
+  pending = backfill_tick(&pax->alist);
+  pending = backfill_tick(&pax->adefer) || pending;
+
+  // Stop ticking once every stream has finished.
+  if (!pending) {
+    pax->backfill_pending = false;
+    g_free(uuid);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/**
+ * paxos_backfill_chunk - Send a new acceptor the next chunk of our ilist.
+ */
+int
+paxos_backfill_chunk(struct paxos_acceptor *acc)
+{
+  int r;
+  bool done;
+  unsigned count;
+  struct paxos_header hdr;
+  struct paxos_instance *it;
+  struct paxos_yak py;
+
+  // Find the extent of the chunk.  Truncation never passes the next instance
+  // to be streamed, so our cursor is always valid.
+  count = 0;
+  for (it = acc->pa_backfill;
+      it != NULL && it != (void *)&pax->ilist && count < BACKFILL_CHUNK_MAX &&
+      it->pi_hdr.ph_inum <= acc->pa_backfill_end;
+      it = LIST_NEXT(it, pi_le)) {
+    count++;
+  }
+
+  // Initialize a header.  We set ph_inum to the end of the stream if this is
+  // the final chunk, and to 0 otherwise.
+  done = (it == NULL || it == (void *)&pax->ilist ||
+      it->pi_hdr.ph_inum > acc->pa_backfill_end);
+  header_init(&hdr, OP_BACKFILL, done ? acc->pa_backfill_end : 0);
+
+  // Pack the chunk.
+  paxos_payload_init(&py, 2);
+  paxos_header_pack(&py, &hdr);
+  paxos_payload_begin_array(&py, count);
+  for (it = acc->pa_backfill; count > 0; it = LIST_NEXT(it, pi_le), --count) {
+    paxos_instance_pack(&py, it);
+  }
+
+  r = paxos_send(acc, &py);
+  paxos_payload_destroy(&py);
+
+  // Advance the stream.
+  acc->pa_backfill = done ? NULL : it;
+
+  return r;
+}
+
 /**
  * acceptor_ack_welcome - Be welcomed to the Paxos system.
  *
- * This allows us to populate our ballot, alist, and ilist, as well as to
- * learn our assigned paxid.  We populate our request cache on-demand with
- * out-of-band retrieve messages.
+ * This allows us to populate our ballot and alist, as well as to learn our
+ * assigned paxid.  Our ilist is populated incrementally by the backfills
+ * which follow, either from the proposer or, for snapshot joins, from the
+ * first acceptor we manage to connect to, and we populate our request cache
+ * on-demand with out-of-band retrieve messages.
  */
 int
 acceptor_ack_welcome(struct paxos_peer *source, struct paxos_header *hdr,
     msgpack_object *o)
 {
   int r;
-  pax_uuid_t *uuid;
+  bool snapshot;
+  paxid_t ihole, ilast;
   msgpack_object *arr, *p, *pend;
   struct paxos_acceptor *acc;
   struct paxos_instance *inst;
@@ -128,7 +323,7 @@ acceptor_ack_welcome(struct paxos_peer *source, struct paxos_header *hdr,
 
   // Create a new session.
   pax = session_new(NULL, 0);
-  pax->client_data = state.enter(pax);
+  pax->client_data = state->enter(pax);
 
   // Set our local state.
   pax->ballot.id = hdr->ph_ballot.id;
@@ -141,87 +336,356 @@ acceptor_ack_welcome(struct paxos_peer *source, struct paxos_header *hdr,
   assert(o->via.array.size == 3);
   arr = o->via.array.ptr;
 
-  // Unpack the session ID and ibase.
-  assert(arr->type == MSGPACK_OBJECT_ARRAY);
-  p = (arr++)->via.array.ptr;
+  // Unpack the session ID and the bounds of the proposer's ilist.
+  assert(arr[0].type == MSGPACK_OBJECT_ARRAY);
+  assert(arr[0].via.array.size == 8);
+  p = arr[0].via.array.ptr;
 
   paxos_uuid_unpack(pax->session_id, p++);
-  assert(p->type == MSGPACK_OBJECT_POSITIVE_INTEGER);
-  pax->ibase = (p++)->via.u64;
+  paxos_history_open();
+  paxos_paxid_unpack(&pax->ibase, p++);
+  paxos_paxid_unpack(&ihole, p++);
+  paxos_paxid_unpack(&ilast, p++);
+  assert(p->type == MSGPACK_OBJECT_BOOLEAN);
+  snapshot = (p++)->via.boolean;
+  paxos_paxid_unpack(&pax->options.po_quorum[0], p++);
+  paxos_paxid_unpack(&pax->options.po_quorum[1], p++);
+  paxos_paxid_unpack(&pax->options.po_star, p++);
 
-  // Add a sync for this session.
-  uuid = g_malloc0(sizeof(*uuid));
-  *uuid = *pax->session_id;
-  g_timeout_add_seconds(1, paxos_sync, uuid);
+  // Unpack the first instance.  It is committed and learned by everyone, so
+  // we no-op its learn.  We do this before connecting to anybody, since our
+  // connections may need to know where our log starts.
+  inst = g_malloc0(sizeof(*inst));
+  paxos_instance_unpack(inst, &arr[2]);
+  assert(inst->pi_hdr.ph_inum == pax->ibase);
+  assert(inst->pi_committed);
+
+  inst->pi_cached = true;
+  inst->pi_learned = true;
+  LIST_INSERT_TAIL(&pax->ilist, inst, pi_le);
+
+  // Set up the learn protocol parameters to start at the next instance.
+  pax->ihole = pax->ibase + 1;
+  pax->istart = inst;
+
+  // Log our starting point.
+  paxos_wal_ballot();
+  paxos_wal_instance(inst);
+  paxos_wal_truncate();
+
+  // Wait for the rest of the ilist to stream in, if there is any.  We can
+  // vote on new decrees in the meantime.  If this is a snapshot join, we
+  // pick our source once we have connected to somebody.
+  if (ilast > pax->ibase) {
+    pax->backfill = g_malloc0(sizeof(*pax->backfill));
+    pax->backfill->pb_learned = ihole;
+    pax->backfill->pb_source = snapshot ? 0 : hdr->ph_ballot.id;
+  }
 
   // Make sure the alist is well-formed.
-  assert(arr->type == MSGPACK_OBJECT_ARRAY);
-  pend = arr->via.array.ptr + arr->via.array.size;
-  p = (arr++)->via.array.ptr;
+  assert(arr[1].type == MSGPACK_OBJECT_ARRAY);
+  p = arr[1].via.array.ptr;
+  pend = arr[1].via.array.ptr + arr[1].via.array.size;
 
   // We are live!
   pax->live_count = 1;
 
   // Unpack the alist.  For each acceptor, in addition to adding an acceptor
-  // object to our list, we make a connection and send a hello message.
+  // object to our list, we make a connection and send a hello message.  In
+  // a star, we only connect to the proposer's successors.
   for (; p != pend; ++p) {
     acc = g_malloc0(sizeof(*acc));
     paxos_acceptor_unpack(acc, p);
     LIST_INSERT_TAIL(&pax->alist, acc, pa_le);
 
+    if (acc->pa_learner) {
+      pax->learner_count++;
+      if (acc->pa_paxid == pax->self_id) {
+        pax->learner = true;
+      }
+    }
+
     if (acc->pa_paxid == hdr->ph_ballot.id) {
       // Don't send a hello to the proposer.
       pax->proposer = acc;
       pax->proposer->pa_peer = source;
       pax->live_count++;
-    } else if (acc->pa_paxid != pax->self_id) {
+    } else if (acc->pa_paxid != pax->self_id && star_neighbor(acc)) {
       // Connect to everyone but ourselves.  When we continue, we will say
       // hello to these acceptors.
+      if (pax->backfill != NULL) {
+        pax->backfill->pb_connects++;
+      }
       k = continuation_new(continue_ack_welcome, acc->pa_paxid);
-      ERR_RET(r, state.connect(acc->pa_desc, acc->pa_size, &k->pk_cb));
+      ERR_RET(r, state->connect(acc->pa_desc, acc->pa_size, &k->pk_cb));
     }
   }
 
-  // Make sure the ilist is well-formed.
-  assert(arr->type == MSGPACK_OBJECT_ARRAY);
-  pend = arr->via.array.ptr + arr->via.array.size;
-  p = (arr++)->via.array.ptr;
+  quorum_validate();
+  paxos_wal_members();
 
-  // Unpack the ilist.
-  for (; p != pend; ++p) {
-    inst = g_malloc0(sizeof(*inst));
-    paxos_instance_unpack(inst, p);
-    LIST_INSERT_TAIL(&pax->ilist, inst, pi_le);
-  }
-
-  // Determine our ihole.  The first instance in the ilist should always have
-  // the instance number pax->ibase, so we start searching there.
-  inst = LIST_FIRST(&pax->ilist);
-  pax->ihole = pax->ibase;
-  for (;; inst = LIST_NEXT(inst, pi_le), ++pax->ihole) {
-    // If we reached the end of the list, set pax->istart to the last existing
-    // instance.
-    if (inst == (void *)&pax->ilist) {
-      pax->istart = LIST_LAST(&pax->ilist);
-      break;
+  // If there is nobody else to fetch from, fetch from the proposer.
+  if (pax->backfill != NULL && pax->backfill->pb_source == 0 &&
+      pax->backfill->pb_connects == 0) {
+    return acceptor_fetch(pax->proposer);
+  }
+
+  return 0;
+}
+
+/**
+ * acceptor_connect_neighbors - Connect to any acceptors we should be
+ * connected to but aren't.
+ *
+ * In a star, a part may move a new acceptor up into the line of succession,
+ * at which point we need a connection to it in case it takes over.  After
+ * catching up from a snapshot, we may have missed joins altogether.
+ */
+int
+acceptor_connect_neighbors(void)
+{
+  int r;
+  struct paxos_acceptor *acc;
+  struct paxos_continuation *k;
+
+  LIST_FOREACH(acc, &pax->alist, pa_le) {
+    if (acc->pa_peer != NULL || acc->pa_paxid == pax->self_id ||
+        !star_neighbor(acc)) {
+      continue;
+    }
+
+    if (pax->backfill != NULL) {
+      pax->backfill->pb_connects++;
     }
+    k = continuation_new(continue_ack_welcome, acc->pa_paxid);
+    ERR_RET(r, state->connect(acc->pa_desc, acc->pa_size, &k->pk_cb));
+  }
+
+  return 0;
+}
 
-    // If we skipped over an instance number because we were missing an
-    // instance, set pax->istart to the last instance before the hole.
-    if (inst->pi_hdr.ph_inum != pax->ihole) {
-      pax->istart = LIST_PREV(inst, pi_le);
+/**
+ * acceptor_fetch - Ask an acceptor to stream us everything in its ilist past
+ * our last learn.
+ */
+int
+acceptor_fetch(struct paxos_acceptor *acc)
+{
+  int r;
+  struct paxos_header hdr;
+  struct paxos_yak py;
+
+  pax->backfill->pb_source = acc->pa_paxid;
+
+  // Initialize a header.  We pass our last learn in ph_inum.
+  header_init(&hdr, OP_FETCH, pax->ihole - 1);
+
+  // Pack and send the fetch.
+  paxos_payload_init(&py, 2);
+  paxos_header_pack(&py, &hdr);
+  paxos_paxid_pack(&py, pax->self_id);
+  r = paxos_send(acc, &py);
+  paxos_payload_destroy(&py);
+
+  return r;
+}
+
+/**
+ * acceptor_refetch - Fetch the rest of our ilist from the proposer, or from
+ * some other live acceptor if we have lost our connection to the proposer.
+ *
+ * We skip whoever was last streaming to us, since it either dropped or was
+ * behind.  If nobody is left, we wait for a hello and fetch from its sender.
+ */
+int
+acceptor_refetch(void)
+{
+  struct paxos_acceptor *acc;
+  paxid_t source;
+
+  source = pax->backfill->pb_source;
+  pax->backfill->pb_source = 0;
+
+  if (pax->proposer != NULL && pax->proposer->pa_peer != NULL &&
+      pax->proposer->pa_paxid != pax->self_id) {
+    return acceptor_fetch(pax->proposer);
+  }
+
+  LIST_FOREACH(acc, &pax->alist, pa_le) {
+    if (acc->pa_peer != NULL && acc->pa_paxid != pax->self_id &&
+        acc->pa_paxid != source) {
+      return acceptor_fetch(acc);
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * paxos_ack_fetch - Stream our ilist to a new acceptor.
+ *
+ * Any acceptor may serve a fetch, and we may not even have learned the
+ * fetcher's join yet.  We send everything we have past the fetcher's last
+ * learn; if we are behind, the fetcher will notice and go to the proposer
+ * for the rest.
+ */
+int
+paxos_ack_fetch(struct paxos_header *hdr, msgpack_object *o)
+{
+  paxid_t paxid;
+  struct paxos_acceptor *acc;
+  struct paxos_instance *it;
+
+  // Find the fetcher.
+  paxos_paxid_unpack(&paxid, o);
+  acc = acceptor_find(&pax->alist, paxid);
+  if (acc == NULL) {
+    acc = acceptor_find(&pax->adefer, paxid);
+  }
+  if (acc == NULL || acc->pa_peer == NULL) {
+    return 0;
+  }
+
+  // Start the stream just past the fetcher's last learn.  The fetcher is
+  // recent, so we search from the back.
+  acc->pa_backfill = NULL;
+  LIST_FOREACH_REV(it, &pax->ilist, pi_le) {
+    if (it->pi_hdr.ph_inum <= hdr->ph_inum) {
       break;
     }
+    acc->pa_backfill = it;
+  }
+  acc->pa_backfill_end = LIST_LAST(&pax->ilist)->pi_hdr.ph_inum;
+
+  return backfill_start(acc);
+}
+
+/**
+ * acceptor_end_backfill - Start learning once our welcome has finished
+ * streaming in.
+ */
+static int
+acceptor_end_backfill(void)
+{
+  struct paxos_instance *inst;
+
+  // If our source was behind the proposer, we may still be missing some of
+  // what the proposer had learned when it welcomed us; go to the proposer
+  // for the rest.
+  if (pax->ihole < pax->backfill->pb_learned && (pax->proposer == NULL ||
+        pax->backfill->pb_source != pax->proposer->pa_paxid)) {
+    return acceptor_refetch();
+  }
+
+  g_free(pax->backfill);
+  pax->backfill = NULL;
+
+  // Anything committed past our hole needs its request before we can learn
+  // it, and we have almost no request cache.  Queue up retrieves for all of
+  // them now so that they go out together.
+  for (inst = pax->istart; inst != (void *)&pax->ilist;
+      inst = LIST_NEXT(inst, pi_le)) {
+    if (!inst->pi_committed || inst->pi_learned || inst->pi_cached) {
+      continue;
+    }
+
+    if (request_needs_cached(inst->pi_val.pv_dkind) &&
+        rcache_find(pax, inst->pi_val.pv_reqid) == NULL) {
+      paxos_retrieve(inst);
+    } else {
+      inst->pi_cached = true;
+    }
+  }
+
+  // Commit the first ready instance again, which learns as far as we can
+  // and retries our hole if necessary.
+  LIST_FOREACH(inst, &pax->ilist, pi_le) {
+    if (inst->pi_hdr.ph_inum >= pax->ihole && inst->pi_committed &&
+        inst->pi_cached) {
+      return paxos_commit(inst);
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * acceptor_ack_backfill - Apply a chunk of our welcome.
+ *
+ * We may already have seen some of these instances, since we take part in
+ * the protocol while the backfill streams in; we merge as we would a decree.
+ * Everything the proposer had learned at welcome time we no-op learn, just
+ * as for the first instance.
+ */
+int
+acceptor_ack_backfill(struct paxos_header *hdr, msgpack_object *o)
+{
+  msgpack_object *p, *pend;
+  struct paxos_instance *inst, *it;
+
+  // Ignore backfills if we aren't expecting any.
+  if (pax->backfill == NULL) {
+    return 0;
+  }
+
+  // If we are resuming, this is the proposer taking us back.
+  if (pax->backfill->pb_resume && pax->backfill->pb_source == 0) {
+    acceptor_resume_ballot(hdr);
+  }
+
+  // Make sure the payload is well-formed.
+  assert(o->type == MSGPACK_OBJECT_ARRAY);
+  p = o->via.array.ptr;
+  pend = o->via.array.ptr + o->via.array.size;
+
+  inst = NULL;
+  for (; p != pend; ++p) {
+    // Allocate an instance if necessary and unpack into it.
+    if (inst == NULL) {
+      inst = g_malloc0(sizeof(*inst));
+    }
+    paxos_instance_unpack(inst, p);
+
+    it = instance_find(&pax->ilist, inst->pi_hdr.ph_inum);
+    if (it == NULL) {
+      // We haven't seen this instance, so just insert it.
+      instance_insert_and_upstart(inst);
+      paxos_wal_instance(inst);
+      inst = NULL;
+    } else if (!it->pi_committed && (inst->pi_committed ||
+          ballot_compare(inst->pi_hdr.ph_ballot, it->pi_hdr.ph_ballot) > 0)) {
+      // Otherwise, take the backfilled value if it's newer.
+      memcpy(&it->pi_hdr, &inst->pi_hdr, sizeof(inst->pi_hdr));
+      memcpy(&it->pi_val, &inst->pi_val, sizeof(inst->pi_val));
+      it->pi_committed = inst->pi_committed;
+      paxos_wal_instance(it);
+    }
+  }
+  g_free(inst);
 
-    // If we found an uncommitted instance, set pax->istart to it.
-    if (!inst->pi_committed) {
-      pax->istart = inst;
+  // No-op learn as many old commits as we now can.  If our source is behind,
+  // some of them may not have come through, or may not be committed yet.
+  it = pax->istart;
+  if (it->pi_learned) {
+    it = LIST_NEXT(it, pi_le);
+  }
+  for (; it != (void *)&pax->ilist; it = LIST_NEXT(it, pi_le)) {
+    if (it->pi_hdr.ph_inum != pax->ihole || !it->pi_committed ||
+        it->pi_hdr.ph_inum >= pax->backfill->pb_learned) {
       break;
     }
 
-    // For now, we no-op learns of old commits when we join the system.
-    inst->pi_cached = 1;
-    inst->pi_learned = 1;
+    it->pi_cached = true;
+    it->pi_learned = true;
+    it->pi_retrieve = false;
+
+    pax->istart = it;
+    pax->ihole++;
+  }
+
+  // Start learning if that was the last chunk.
+  if (hdr->ph_inum != 0) {
+    return acceptor_end_backfill();
   }
 
   return 0;
@@ -230,6 +694,10 @@ acceptor_ack_welcome(struct paxos_peer *source, struct paxos_header *hdr,
 /**
  * continue_ack_welcome - Register our initial connections with the other
  * acceptors.
+ *
+ * For a snapshot join, we fetch our log from the first acceptor we connect
+ * to, which is likely to be nearby, or from the proposer if we connect to
+ * nobody.
  */
 int
 do_continue_ack_welcome(GIOChannel *chan, struct paxos_acceptor *acc,
@@ -243,6 +711,16 @@ do_continue_ack_welcome(GIOChannel *chan, struct paxos_acceptor *acc,
     ERR_RET(r, paxos_hello(acc));
   }
 
+  if (pax->backfill != NULL && pax->backfill->pb_source == 0 &&
+      !pax->backfill->pb_resume) {
+    pax->backfill->pb_connects--;
+    if (acc->pa_peer != NULL) {
+      return acceptor_fetch(acc);
+    } else if (pax->backfill->pb_connects == 0) {
+      return acceptor_refetch();
+    }
+  }
+
   return 0;
 }
 CONNECTINUATE(ack_welcome);
@@ -281,17 +759,19 @@ paxos_hello(struct paxos_acceptor *acc)
 int
 paxos_ack_hello(struct paxos_peer *source, struct paxos_header *hdr)
 {
+  int r;
   struct paxos_acceptor *acc;
 
+  // Grab our acceptor from the list.
+  acc = acceptor_find(&pax->alist, hdr->ph_inum);
+
   // If we are the proposer and have finished preparing, ignore any hellos
-  // from higher-ranked proposers.
-  if (is_proposer() && pax->prep == NULL && hdr->ph_inum < pax->self_id) {
+  // from higher-ranked proposers.  Learners are never ranked.
+  if (is_proposer() && pax->prep == NULL && hdr->ph_inum < pax->self_id &&
+      (acc == NULL || !acc->pa_learner)) {
     return 0;
   }
 
-  // Grab our acceptor from the list.
-  acc = acceptor_find(&pax->alist, hdr->ph_inum);
-
   // If we have not yet created an acceptor object, then the acceptor is new
   // to the system but we have not yet committed and learned its join.  In
   // this case, we defer registering the hello by creating a new object and
@@ -311,14 +791,21 @@ paxos_ack_hello(struct paxos_peer *source, struct paxos_header *hdr)
     pax->live_count++;
 
     // Update the proposer if necessary.  If we thought we were the proposer,
-    // end our prepare.
-    if (acc->pa_paxid < pax->proposer->pa_paxid) {
+    // end our prepare.  A learner may have had no proposer at all.
+    if (!acc->pa_learner && (pax->proposer == NULL ||
+          acc->pa_paxid < pax->proposer->pa_paxid)) {
       if (is_proposer()) {
         g_free(pax->prep);
         pax->prep = NULL;
       }
       pax->proposer = acc;
     }
+
+    // If we are still preparing, perhaps for want of live voters, ask for
+    // this one's promise too.
+    if (is_proposer() && pax->prep != NULL && !acc->pa_learner) {
+      ERR_RET(r, proposer_prepare_late(acc));
+    }
   } else if (hdr->ph_inum < pax->self_id) {
     // If our acceptor already has a peer attached, both we and the acceptor
     // attempted to reconnect concurrently and succeeded.  In this case, we
@@ -356,10 +843,339 @@ paxos_ack_hello(struct paxos_peer *source, struct paxos_header *hdr)
   // update our ballot.
   //
   // So update our ballot already.
-  if (hdr->ph_inum == pax->proposer->pa_paxid) {
+  if (pax->proposer != NULL && hdr->ph_inum == pax->proposer->pa_paxid) {
+    pax->ballot.id = hdr->ph_ballot.id;
+    pax->ballot.gen = hdr->ph_ballot.gen;
+    paxos_wal_ballot();
+  }
+
+  // If we lost everyone we could fetch our ilist from, fetch it from here.
+  if (pax->backfill != NULL && pax->backfill->pb_source == 0 &&
+      pax->backfill->pb_connects == 0 && !pax->backfill->pb_resume) {
+    return acceptor_fetch(acc);
+  }
+
+  return 0;
+}
+
+/**
+ * acceptor_resume - Rejoin a session we recovered from our log after a
+ * restart, under our old identity.
+ *
+ * The rest of the session has most likely noticed our absence and is about
+ * to part us.  We reconnect to everyone and tell them where our learns left
+ * off; as long as our part has not yet committed, the proposer takes us back
+ * and streams us only the instances we missed.  Until then, we treat our
+ * ilist as if it were still streaming in, voting on decrees but learning
+ * nothing.
+ */
+int
+acceptor_resume(struct paxos_session *session)
+{
+  int r = 0;
+  pax_uuid_t *uuid;
+  struct paxos_acceptor *acc, *self;
+  struct paxos_continuation *k;
+
+  pax = session;
+  LIST_REMOVE(&state->recovered, pax, session_le);
+  session_insert(&state->sessions, pax);
+
+  // Redo our membership accounting.  Everyone is dropped until we reconnect.
+  self = acceptor_find(&pax->alist, pax->self_id);
+  pax->learner = self->pa_learner;
+  pax->learner_count = 0;
+  pax->live_count = 1;
+  LIST_FOREACH(acc, &pax->alist, pa_le) {
+    if (acc->pa_learner) {
+      pax->learner_count++;
+    }
+  }
+  quorum_validate();
+
+  // Our best guess at the proposer is the one whose ballot we last took,
+  // failing which it is the highest-ranked voter besides ourselves.
+  pax->proposer = acceptor_find(&pax->alist, pax->ballot.id);
+  if (pax->proposer == NULL || pax->proposer == self) {
+    pax->proposer = NULL;
+    LIST_FOREACH(acc, &pax->alist, pa_le) {
+      if (!acc->pa_learner && acc != self) {
+        pax->proposer = acc;
+        break;
+      }
+    }
+  }
+
+  // Whoever took over from us has finished preparing, and proposers in that
+  // state never yield to a returning superior.  If we outrank every other
+  // voter, we were the proposer, so give up on the session.
+  if (pax->proposer == NULL ||
+      (!pax->learner && pax->self_id < pax->proposer->pa_paxid)) {
+    g_warning("acceptor_resume: Cannot resume a session we led.");
+    paxos_wal_end();
+    LIST_REMOVE(&state->sessions, pax, session_le);
+    session_destroy(pax);
+    return 0;
+  }
+
+  pax->client_data = state->enter(pax);
+  paxos_history_open();
+
+  // Hold off learning until the proposer takes us back.
+  pax->backfill = g_malloc0(sizeof(*pax->backfill));
+  pax->backfill->pb_learned = pax->ihole;
+  pax->backfill->pb_resume = true;
+
+  // Reconnect to everyone we should be connected to.
+  LIST_FOREACH(acc, &pax->alist, pa_le) {
+    if (acc == self || !star_neighbor(acc)) {
+      continue;
+    }
+    k = continuation_new(continue_resume, acc->pa_paxid);
+    ERR_ACCUM(r, state->connect(acc->pa_desc, acc->pa_size, &k->pk_cb));
+  }
+
+  // Give up if nobody takes us back in time.
+  uuid = g_malloc0(sizeof(*uuid));
+  *uuid = *pax->session_id;
+  paxos_timeout_add(RESUME_TIMEOUT, paxos_resume_expire, uuid);
+
+  return r;
+}
+
+/**
+ * continue_resume - Tell a reconnected acceptor who we are and where our
+ * learns left off.
+ */
+int
+do_continue_resume(GIOChannel *chan, struct paxos_acceptor *acc,
+    struct paxos_continuation *k)
+{
+  int r;
+  struct paxos_header hdr;
+  struct paxos_yak py;
+
+  acc->pa_peer = paxos_peer_init(chan);
+  if (acc->pa_peer == NULL) {
+    return 0;
+  }
+  pax->live_count++;
+
+  // Initialize the header.  We pass our own acceptor ID in ph_inum.
+  header_init(&hdr, OP_RESUME, pax->self_id);
+
+  // Pack and send the resume.
+  paxos_payload_init(&py, 2);
+  paxos_header_pack(&py, &hdr);
+  paxos_paxid_pack(&py, pax->ihole - 1);
+  r = paxos_send(acc, &py);
+  paxos_payload_destroy(&py);
+
+  return r;
+}
+CONNECTINUATE(resume);
+
+/**
+ * paxos_resume_expire - GEvent-friendly routine which ends a resume that the
+ * proposer never answered.
+ */
+int
+paxos_resume_expire(void *data)
+{
+  pax_uuid_t *uuid;
+
+  // Set the session, which may have ended while we were waiting.
+  uuid = (pax_uuid_t *)data;
+  pax = session_find(&state->sessions, uuid);
+  g_free(uuid);
+  if (pax == NULL) {
+    return FALSE;
+  }
+
+  if (pax->backfill != NULL && pax->backfill->pb_resume &&
+      pax->backfill->pb_source == 0) {
+    g_warning("paxos_resume_expire: Nobody took us back.");
+    paxos_end(pax);
+  }
+
+  return FALSE;
+}
+
+/**
+ * acceptor_resume_ballot - Take on the ballot of the proposer who answered
+ * our resume.
+ */
+void
+acceptor_resume_ballot(struct paxos_header *hdr)
+{
+  struct paxos_acceptor *acc;
+
+  pax->backfill->pb_source = hdr->ph_ballot.id;
+
+  // We may have promised a higher ballot before we went down, in which case
+  // we keep it; that preparer lost, and the proposer will prepare past it.
+  if (ballot_compare(hdr->ph_ballot, pax->ballot) >= 0) {
     pax->ballot.id = hdr->ph_ballot.id;
     pax->ballot.gen = hdr->ph_ballot.gen;
+    pax->gen_high = MAX(pax->gen_high, pax->ballot.gen);
+    paxos_wal_ballot();
   }
 
+  acc = acceptor_find(&pax->alist, hdr->ph_ballot.id);
+  if (acc != NULL && acc->pa_peer != NULL) {
+    pax->proposer = acc;
+  }
+}
+
+/**
+ * proposer_withdraw_parts - Withdraw the parts we have yet to commit for an
+ * acceptor who has come back.
+ *
+ * Parts deferred by a prepare were never decreed and are simply dropped.  A
+ * part in flight may only be redecreed as null once a majority has rejected
+ * it, just as in proposer_ack_reject(); otherwise it may already have been
+ * accepted by a majority.  We let such a part commit, at which point the
+ * resumer learns it, leaves the session, and must be invited back.
+ */
+static int
+proposer_withdraw_parts(struct paxos_acceptor *acc)
+{
+  int r = 0;
+  struct paxos_instance *it, *next;
+
+  for (it = LIST_FIRST(&pax->idefer); it != (void *)&pax->idefer;
+      it = next) {
+    next = LIST_NEXT(it, pi_le);
+    if (it->pi_val.pv_dkind == DEC_PART &&
+        it->pi_val.pv_extra == acc->pa_paxid) {
+      LIST_REMOVE(&pax->idefer, it, pi_le);
+      instance_destroy(it);
+    }
+  }
+
+  for (it = pax->istart; it != (void *)&pax->ilist; it = LIST_NEXT(it, pi_le)) {
+    if (it->pi_committed || it->pi_val.pv_dkind != DEC_PART ||
+        it->pi_val.pv_extra != acc->pa_paxid ||
+        DEATH_ADJUSTED(it->pi_rejects) < majority()) {
+      continue;
+    }
+
+    it->pi_hdr.ph_opcode = OP_DECREE;
+    it->pi_val.pv_dkind = DEC_NULL;
+    it->pi_val.pv_extra = 0;
+    instance_init_metadata(it);
+    paxos_wal_instance(it);
+    ERR_ACCUM(r, paxos_broadcast_instance(it));
+  }
+
+  return r;
+}
+
+/**
+ * paxos_ack_resume - Take back an acceptor who has restarted.
+ *
+ * Anyone may reattach the resumer, unless it outranks our proposer, in which
+ * case taking it back would unseat a proposer who has finished preparing.
+ * The proposer also withdraws what it safely can of any pending part of the
+ * resumer, and then streams it everything past its last learn, or sends it a
+ * snapshot if we have truncated that far.
+ */
+int
+paxos_ack_resume(struct paxos_peer *source, struct paxos_header *hdr,
+    msgpack_object *o)
+{
+  int r;
+  paxid_t last;
+  struct paxos_acceptor *acc;
+  struct paxos_instance *it;
+
+  paxos_paxid_unpack(&last, o);
+
+  // If the resumer's part has already committed, it's too late.
+  acc = acceptor_find(&pax->alist, hdr->ph_inum);
+  if (acc == NULL || acc->pa_paxid == pax->self_id) {
+    return 0;
+  }
+  if (!acc->pa_learner && (pax->proposer == NULL ||
+        acc->pa_paxid < pax->proposer->pa_paxid)) {
+    return 0;
+  }
+
+  // Attach the new connection, displacing any we have yet to notice died.
+  if (acc->pa_peer == NULL) {
+    pax->live_count++;
+  } else if (acc->pa_peer != source) {
+    paxos_peer_destroy(acc->pa_peer);
+  }
+  acc->pa_peer = source;
+
+  if (!is_proposer()) {
+    return 0;
+  }
+
+  ERR_RET(r, proposer_withdraw_parts(acc));
+
+  // Send a snapshot if the resumer's next instance has been truncated.
+  if (last + 1 < LIST_FIRST(&pax->ilist)->pi_hdr.ph_inum) {
+    return proposer_snapshot(source);
+  }
+
+  // Otherwise, stream it everything past its last learn.  The final chunk
+  // goes out even if there is nothing to stream, so that it knows we took it
+  // back.  The resumer is recent, so we search from the back.
+  acc->pa_backfill = NULL;
+  LIST_FOREACH_REV(it, &pax->ilist, pi_le) {
+    if (it->pi_hdr.ph_inum <= last) {
+      break;
+    }
+    acc->pa_backfill = it;
+  }
+  acc->pa_backfill_end = LIST_LAST(&pax->ilist)->pi_hdr.ph_inum;
+
+  return backfill_start(acc);
+}
+
+/**
+ * proposer_part_dropped - Decree a part for an acceptor we lost, waiting a
+ * little first if we've been asked to give it a chance to resume.
+ */
+int
+proposer_part_dropped(struct paxos_acceptor *acc)
+{
+  struct part_delay *pd;
+
+  if (pax->options.po_part_delay == 0) {
+    return proposer_decree_part(acc, 0);
+  }
+
+  pd = g_malloc0(sizeof(*pd));
+  pd->pd_session = *pax->session_id;
+  pd->pd_paxid = acc->pa_paxid;
+  paxos_timeout_add(pax->options.po_part_delay, paxos_part_dropped, pd);
+
   return 0;
 }
+
+/**
+ * paxos_part_dropped - GEvent-friendly routine which parts a dropped acceptor
+ * if it has not come back.
+ */
+int
+paxos_part_dropped(void *data)
+{
+  struct part_delay *pd;
+  struct paxos_acceptor *acc;
+
+  // Set the session, which may have ended while we were waiting.
+  pd = (struct part_delay *)data;
+  pax = session_find(&state->sessions, &pd->pd_session);
+  if (pax != NULL && is_proposer()) {
+    acc = acceptor_find(&pax->alist, pd->pd_paxid);
+    if (acc != NULL && acc->pa_peer == NULL) {
+      proposer_decree_part(acc, 0);
+    }
+  }
+
+  g_free(pd);
+  return FALSE;
+}
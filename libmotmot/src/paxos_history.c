@@ -0,0 +1,95 @@
+/**
+ * paxos_history.c - Built-in store of the chats we learn.
+ *
+ * If the client asks for it, we keep every chat we learn in a history for
+ * its session, in a directory named for the session ID.  Clients can then
+ * page through the history without copying it, since we hand out pointers
+ * straight into the history's mappings.
+ */
+
+#include <glib.h>
+
+#include "paxos.h"
+#include "paxos_state.h"
+#include "types/history.h"
+
+/**
+ * paxos_history_init - Keep histories of all sessions in a directory.
+ */
+int
+paxos_history_init(const char *dir)
+{
+  if (state->history_dir != NULL || g_mkdir_with_parents(dir, 0700) != 0) {
+    return 1;
+  }
+
+  state->history_dir = g_strdup(dir);
+  return 0;
+}
+
+/**
+ * paxos_history_open - Open the history of the current session, if we are
+ * keeping histories.
+ */
+void
+paxos_history_open(void)
+{
+  char *path;
+
+  if (state->history_dir == NULL || pax->history != NULL) {
+    return;
+  }
+
+  path = g_strdup_printf("%s/%016llx", state->history_dir,
+      (unsigned long long)*pax->session_id);
+  pax->history = history_open(path);
+  if (pax->history == NULL) {
+    g_warning("paxos_history_open: Could not open %s.", path);
+  }
+  g_free(path);
+}
+
+/**
+ * paxos_history_read - Read up to n chats from a session's history, starting
+ * from a given instance number.
+ */
+size_t
+paxos_history_read(struct paxos_session *session, unsigned from,
+    motmot_history_entry_t *entries, size_t n)
+{
+  size_t i, count;
+  const struct history_record **recs;
+
+  if (session->history == NULL || n == 0) {
+    return 0;
+  }
+
+  recs = g_malloc(n * sizeof(*recs));
+  count = history_read(session->history, from, recs, n);
+
+  for (i = 0; i < count; ++i) {
+    entries[i].inum = recs[i]->hr_inum;
+    entries[i].time = recs[i]->hr_time;
+    entries[i].desc = history_record_desc(recs[i]);
+    entries[i].desc_size = recs[i]->hr_desc_size;
+    entries[i].message = history_record_data(recs[i]);
+    entries[i].len = recs[i]->hr_size;
+  }
+
+  g_free(recs);
+  return count;
+}
+
+/**
+ * paxos_history_find - Find the first chat in a session's history learned
+ * at or after a time.
+ */
+unsigned
+paxos_history_find(struct paxos_session *session, unsigned long long time)
+{
+  if (session->history == NULL) {
+    return 0;
+  }
+
+  return history_find_time(session->history, time);
+}
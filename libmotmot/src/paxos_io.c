@@ -1,26 +1,730 @@
 /**
  * paxos_io.c - Paxos reliable IO utilities
+ *
+ * By default, each peer's socket is read, unpacked, and written on the
+ * thread running the peer's sessions.  If the client asks for it, we instead
+ * hand every new peer to one of a pool of I/O threads, which does all of
+ * that for it.  Each pair of an I/O thread and a protocol thread is joined
+ * by two single-producer, single-consumer rings: one carrying decoded
+ * messages to the protocol thread, and one carrying encoded output, along
+ * with the opening and closing of peers, to the I/O thread.  Each side
+ * pokes an eventfd to wake the other.  Since every ring keeps its order,
+ * a peer is only freed once its protocol thread has seen everything the I/O
+ * thread read from it.
  */
 
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
 #include <glib.h>
 
 #include "paxos.h"
 #include "paxos_io.h"
 #include "paxos_protocol.h"
 #include "paxos_state.h"
+#include "paxos_util.h"
+#include "containers/ring.h"
 
 #define PIO_BUFSIZE 4096
+#define PIO_RING_SIZE 1024
 
 struct paxos_peer {
   GIOChannel *pp_channel;         // Channel to the peer.
   msgpack_unpacker pp_unpacker;   // Unpacker (and its associated read buffer).
   GString *pp_write_buffer;       // Write buffer.
+  struct pio_thread *pp_io;       // I/O thread serving us, if any.
+  struct paxos_shard *pp_shard;   // Shard reading us; NULL until routed.
+  bool pp_writing;                // Is the I/O thread watching for writes?
+  bool pp_closing;                // Have we been destroyed?
+  bool pp_paused;                 // Have we stopped reading for the shard?
+  int pp_pending;                 // Bytes passed to the I/O thread unwritten.
+};
+
+/* Kinds of items passed between protocol threads and I/O threads. */
+enum pio_kind {
+  PIO_OPEN = 0,     // start serving a peer
+  PIO_DATA,         // encoded output for a peer
+  PIO_CLOSE,        // stop serving a peer and shut it down
+  PIO_MSG,          // a message decoded from a peer
+  PIO_EOF,          // a peer hung up
+  PIO_CLOSED,       // a peer is shut down and may be freed
+};
+
+/* An item on a ring.  Output trails the structure. */
+struct pio_item {
+  enum pio_kind pi_kind;          // kind of item
+  struct paxos_peer *pi_peer;     // peer it concerns
+  msgpack_object pi_msg;          // message, for PIO_MSG
+  msgpack_zone *pi_zone;          // zone holding the message
+  size_t pi_len;                  // size of the output, for PIO_DATA
+  char pi_data[];                 // the output
+};
+
+/* The rings between a protocol thread and an I/O thread.  Items which find
+ * a ring full are held by the producer until the consumer makes room.  To
+ * keep what is held small, a peer whose message is held isn't read again
+ * until pl_in has room, and a shard whose output is held handles no more
+ * messages until pl_out has room. */
+struct pio_link {
+  struct ring pl_in;              // messages for the protocol thread
+  struct ring pl_out;             // output for the I/O thread
+  GQueue *pl_in_held;             // messages waiting on pl_in
+  GQueue *pl_out_held;            // output waiting on pl_out
+  GQueue *pl_paused;              // peers not read until pl_in has room
+  int pl_in_full;                 // are messages waiting?
+  int pl_out_full;                // is output waiting?
+};
+
+/* An I/O thread. */
+struct pio_thread {
+  struct motmot_ctx *pt_ctx;      // context whose peers we serve
+  GThread *pt_thread;             // the thread
+  GMainContext *pt_context;       // its context
+  GMainLoop *pt_loop;             // loop running the context
+  int pt_fd;                      // eventfd signaling new output
+  int pt_wake;                    // has pt_fd been signaled?
+  struct pio_link *pt_links;      // links to each shard, by index
+};
+
+/* A context's pool of I/O threads. */
+struct pio_pool {
+  struct pio_thread *po_threads;  // the threads
+  unsigned po_count;              // number of threads
+  unsigned po_links;              // number of links per thread
+  int po_next;                    // thread to give the next peer
+};
+
+/* A connection being handed to another shard, along with its first
+ * message. */
+struct paxos_handoff {
+  struct paxos_peer *ph_peer;     // the peer
+  struct paxos_shard *ph_shard;   // shard taking it over
+  msgpack_zone *ph_zone;          // zone holding the message
+  msgpack_object ph_msg;          // the message
 };
 
 // Private stuff.
 int paxos_peer_read(GIOChannel *, GIOCondition, void *);
 int paxos_peer_write(GIOChannel *, GIOCondition, void *);
 
+///////////////////////////////////////////////////////////////////////////
+//
+//  I/O threads.
+//
+
+/**
+ * pio_wake - Signal an eventfd, unless it has been signaled already.
+ */
+static void
+pio_wake(int fd, int *wake)
+{
+  uint64_t one = 1;
+
+  if (g_atomic_int_compare_and_exchange(wake, 0, 1) &&
+      write(fd, &one, sizeof(one)) != sizeof(one)) {
+    g_warning("pio_wake: Could not wake thread.");
+  }
+}
+
+/**
+ * pio_woken - Reset an eventfd.  This must be done before handling whatever
+ * it signaled, so that anything which arrives meanwhile signals it again.
+ */
+static void
+pio_woken(int fd, int *wake)
+{
+  uint64_t count;
+
+  // A failed read just means we were woken twice for the same thing.
+  if (read(fd, &count, sizeof(count)) != sizeof(count)) {
+    count = 0;
+  }
+  g_atomic_int_set(wake, 0);
+}
+
+/**
+ * pio_flush - Move held items onto a ring, as far as they fit.  Returns the
+ * number moved.  Producer only.
+ */
+static unsigned
+pio_flush(struct ring *ring, GQueue *held, int *full)
+{
+  unsigned n;
+
+  for (n = 0; !g_queue_is_empty(held); ++n) {
+    if (!ring_push(ring, g_queue_peek_head(held))) {
+      // Ask the consumer to wake us once it makes room.  It may have emptied
+      // the ring before seeing our flag, so try once more.
+      g_atomic_int_set(full, 1);
+      if (!ring_push(ring, g_queue_peek_head(held))) {
+        break;
+      }
+    }
+    g_queue_pop_head(held);
+  }
+
+  return n;
+}
+
+/**
+ * pio_push - Push an item onto a ring, or hold it if the ring is full.
+ * Producer only.
+ */
+static void
+pio_push(struct ring *ring, GQueue *held, int *full, struct pio_item *item)
+{
+  if (!g_queue_is_empty(held) || !ring_push(ring, item)) {
+    g_queue_push_tail(held, item);
+    pio_flush(ring, held, full);
+  }
+}
+
+/**
+ * pio_item_new - Make an item, with room for len bytes of output.
+ */
+static struct pio_item *
+pio_item_new(enum pio_kind kind, struct paxos_peer *peer, size_t len)
+{
+  struct pio_item *item;
+
+  item = g_malloc(sizeof(*item) + len);
+  item->pi_kind = kind;
+  item->pi_peer = peer;
+  item->pi_zone = NULL;
+  item->pi_len = len;
+
+  return item;
+}
+
+/**
+ * pio_to_io - Pass an item from the current shard to its peer's I/O thread.
+ */
+static void
+pio_to_io(struct pio_item *item)
+{
+  struct pio_thread *pt = item->pi_peer->pp_io;
+  struct pio_link *pl = &pt->pt_links[state->shard->ps_index];
+
+  pio_push(&pl->pl_out, pl->pl_out_held, &pl->pl_out_full, item);
+  pio_wake(pt->pt_fd, &pt->pt_wake);
+}
+
+/**
+ * pio_to_shard - Pass an item from an I/O thread to the shard reading its
+ * peer.
+ */
+static void
+pio_to_shard(struct pio_thread *pt, struct pio_item *item)
+{
+  struct paxos_shard *shard = item->pi_peer->pp_shard;
+  struct pio_link *pl = &pt->pt_links[shard->ps_index];
+
+  pio_push(&pl->pl_in, pl->pl_in_held, &pl->pl_in_full, item);
+  pio_wake(shard->ps_io_fd, &shard->ps_io_wake);
+}
+
+/**
+ * pio_watch - Watch a channel on a given context.
+ */
+static void
+pio_watch(GMainContext *context, GIOChannel *channel, GIOCondition condition,
+    GIOFunc func, void *data)
+{
+  GSource *source;
+
+  source = g_io_create_watch(channel, condition);
+  g_source_set_callback(source, (GSourceFunc)func, data, NULL);
+  g_source_attach(source, context);
+  g_source_unref(source);
+}
+
+/**
+ * pio_close - Stop serving a peer and shut its channel down.  This runs on
+ * the peer's I/O thread.
+ */
+static void
+pio_close(struct pio_thread *pt, struct paxos_peer *peer)
+{
+  GSource *source;
+  GIOStatus status;
+  GError *error = NULL;
+
+  while ((source = g_main_context_find_source_by_user_data(pt->pt_context,
+          peer)) != NULL) {
+    g_source_destroy(source);
+  }
+
+  if (peer->pp_paused) {
+    g_queue_remove(pt->pt_links[peer->pp_shard->ps_index].pl_paused, peer);
+  }
+
+  status = g_io_channel_shutdown(peer->pp_channel, TRUE, &error);
+  if (status != G_IO_STATUS_NORMAL) {
+    g_warning("pio_close: Trouble destroying peer.");
+  }
+
+  msgpack_unpacker_destroy(&peer->pp_unpacker);
+  g_string_free(peer->pp_write_buffer, TRUE);
+}
+
+/**
+ * pio_route - Find the shard which should read a connection, given its first
+ * message.  Returns NULL if the message is malformed.
+ */
+static struct paxos_shard *
+pio_route(struct motmot_ctx *ctx, msgpack_object *o)
+{
+  msgpack_object *p;
+  pax_uuid_t uuid;
+
+  // We only need the session ID from the header, but we look no further
+  // than we have checked.
+  if (o->type != MSGPACK_OBJECT_ARRAY || o->via.array.size == 0) {
+    return NULL;
+  }
+  p = o->via.array.ptr;
+  if (p->type != MSGPACK_OBJECT_ARRAY || p->via.array.size != 5 ||
+      p->via.array.ptr->type != MSGPACK_OBJECT_POSITIVE_INTEGER) {
+    return NULL;
+  }
+
+  paxos_uuid_unpack(&uuid, p->via.array.ptr);
+  return paxos_shard_route(ctx, &uuid);
+}
+
+/**
+ * pio_drop - Shut down a connection no shard has claimed, and have it
+ * freed.  This runs on the peer's I/O thread.
+ */
+static void
+pio_drop(struct pio_thread *pt, struct paxos_peer *peer)
+{
+  pio_close(pt, peer);
+  peer->pp_shard = paxos_shard_get(pt->pt_ctx, 0);
+  pio_to_shard(pt, pio_item_new(PIO_CLOSED, peer, 0));
+}
+
+/**
+ * pio_pause - If the shard reading a peer has fallen behind, stop reading
+ * the peer until it catches up.  Returns true if we did.
+ */
+static bool
+pio_pause(struct paxos_peer *peer)
+{
+  struct pio_link *pl;
+
+  if (peer->pp_shard == NULL) {
+    return false;
+  }
+
+  pl = &peer->pp_io->pt_links[peer->pp_shard->ps_index];
+  if (g_queue_is_empty(pl->pl_in_held)) {
+    return false;
+  }
+
+  peer->pp_paused = true;
+  g_queue_push_tail(pl->pl_paused, peer);
+  return true;
+}
+
+/**
+ * pio_read - Read from a peer's socket and pass along what we decode.  This
+ * runs on the peer's I/O thread.
+ */
+static int
+pio_read(GIOChannel *channel, GIOCondition condition, void *data)
+{
+  struct paxos_peer *peer = data;
+  struct pio_item *item;
+  msgpack_unpacked result;
+  size_t bytes_read;
+  int r = TRUE;
+
+  GIOStatus status;
+  GError *error = NULL;
+
+  if (pio_pause(peer)) {
+    return FALSE;
+  }
+
+  msgpack_unpacked_init(&result);
+
+  do {
+    msgpack_unpacker_reserve_buffer(&peer->pp_unpacker, PIO_BUFSIZE);
+
+    status = g_io_channel_read_chars(channel,
+        msgpack_unpacker_buffer(&peer->pp_unpacker), PIO_BUFSIZE, &bytes_read,
+        &error);
+
+    if (status == G_IO_STATUS_ERROR) {
+      g_warning("pio_read: Read from socket failed.");
+    }
+
+    msgpack_unpacker_buffer_consumed(&peer->pp_unpacker, bytes_read);
+
+    while (msgpack_unpacker_next(&peer->pp_unpacker, &result)) {
+      // A connection no shard has claimed goes to the shard of the session
+      // its first message is for.  If we can't tell which that is, we have
+      // no business talking to it.
+      if (peer->pp_shard == NULL) {
+        peer->pp_shard = pio_route(peer->pp_io->pt_ctx, &result.data);
+        if (peer->pp_shard == NULL) {
+          g_warning("pio_read: Malformed first message.");
+          msgpack_unpacked_destroy(&result);
+          pio_drop(peer->pp_io, peer);
+          return FALSE;
+        }
+      }
+
+      item = pio_item_new(PIO_MSG, peer, 0);
+      item->pi_msg = result.data;
+      item->pi_zone = msgpack_unpacked_release_zone(&result);
+      pio_to_shard(peer->pp_io, item);
+
+      // Leave the rest buffered if the shard can't keep up.
+      if (pio_pause(peer)) {
+        r = FALSE;
+        break;
+      }
+    }
+
+    if (!r) {
+      break;
+    }
+
+    if (status == G_IO_STATUS_EOF) {
+      if (peer->pp_shard == NULL) {
+        peer->pp_shard = paxos_shard_get(peer->pp_io->pt_ctx, 0);
+      }
+      pio_to_shard(peer->pp_io, pio_item_new(PIO_EOF, peer, 0));
+      r = FALSE;
+      break;
+    }
+
+  } while (g_io_channel_get_buffer_condition(channel) & G_IO_IN);
+
+  msgpack_unpacked_destroy(&result);
+  return r;
+}
+
+/**
+ * pio_write - Write out a peer's buffered output.  This runs on the peer's
+ * I/O thread.
+ */
+static int
+pio_write(GIOChannel *channel, GIOCondition condition, void *data)
+{
+  struct paxos_peer *peer = data;
+  size_t bytes_written;
+
+  GIOStatus status;
+  GError *error = NULL;
+
+  status = g_io_channel_write_chars(channel, peer->pp_write_buffer->str,
+      peer->pp_write_buffer->len, &bytes_written, &error);
+
+  if (status == G_IO_STATUS_ERROR) {
+    g_warning("pio_write: Write to socket failed.");
+  }
+
+  g_string_erase(peer->pp_write_buffer, 0, bytes_written);
+  g_atomic_int_add(&peer->pp_pending, -(int)bytes_written);
+
+  error = NULL;
+  if (g_io_channel_flush(channel, &error) == G_IO_STATUS_ERROR) {
+    g_critical("pio_write: Could not flush channel.");
+  }
+
+  // If the peer hung up, pio_read will see it; we just stop writing.
+  if (status == G_IO_STATUS_EOF) {
+    return FALSE;
+  }
+
+  if (peer->pp_write_buffer->len == 0) {
+    peer->pp_writing = false;
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/**
+ * pio_serve - Handle an item from a protocol thread.  This runs on the
+ * peer's I/O thread.
+ */
+static void
+pio_serve(struct pio_thread *pt, struct pio_item *item)
+{
+  struct paxos_peer *peer = item->pi_peer;
+
+  switch (item->pi_kind) {
+    case PIO_OPEN:
+      pio_watch(pt->pt_context, peer->pp_channel, G_IO_IN, pio_read, peer);
+      break;
+
+    case PIO_DATA:
+      g_string_append_len(peer->pp_write_buffer, item->pi_data, item->pi_len);
+      if (!peer->pp_writing) {
+        peer->pp_writing = true;
+        pio_watch(pt->pt_context, peer->pp_channel, G_IO_OUT, pio_write,
+            peer);
+      }
+      break;
+
+    case PIO_CLOSE:
+      pio_close(pt, peer);
+
+      // Send the item back, so that the peer is freed after everything we
+      // have passed along for it.
+      if (peer->pp_shard == NULL) {
+        peer->pp_shard = paxos_shard_get(pt->pt_ctx, 0);
+      }
+      item->pi_kind = PIO_CLOSED;
+      pio_to_shard(pt, item);
+      return;
+
+    default:
+      assert(0);
+  }
+
+  g_free(item);
+}
+
+/**
+ * pio_thread_drain - Handle everything the protocol threads have passed us.
+ */
+static int
+pio_thread_drain(GIOChannel *channel, GIOCondition condition, void *data)
+{
+  unsigned i;
+  struct pio_thread *pt = data;
+  struct pio_link *pl;
+  struct pio_item *item;
+  struct paxos_peer *peer;
+  struct paxos_shard *shard;
+
+  pio_woken(pt->pt_fd, &pt->pt_wake);
+
+  for (i = 0; i < pt->pt_ctx->mc_io->po_links; ++i) {
+    pl = &pt->pt_links[i];
+    shard = paxos_shard_get(pt->pt_ctx, i);
+
+    if (pio_flush(&pl->pl_in, pl->pl_in_held, &pl->pl_in_full) > 0) {
+      pio_wake(shard->ps_io_fd, &shard->ps_io_wake);
+    }
+
+    // Start reading the peers we paused again, until the shard falls behind
+    // once more.  Each may have whole messages buffered already.
+    while (g_queue_is_empty(pl->pl_in_held) &&
+        (peer = g_queue_pop_head(pl->pl_paused)) != NULL) {
+      peer->pp_paused = false;
+      if (pio_read(peer->pp_channel, G_IO_IN, peer)) {
+        pio_watch(pt->pt_context, peer->pp_channel, G_IO_IN, pio_read, peer);
+      }
+    }
+
+    while ((item = ring_pop(&pl->pl_out)) != NULL) {
+      pio_serve(pt, item);
+    }
+
+    if (g_atomic_int_compare_and_exchange(&pl->pl_out_full, 1, 0)) {
+      pio_wake(shard->ps_io_fd, &shard->ps_io_wake);
+    }
+  }
+
+  return TRUE;
+}
+
+/**
+ * pio_deliver - Handle an item from an I/O thread.  This runs on the peer's
+ * shard.
+ */
+static void
+pio_deliver(struct pio_item *item)
+{
+  struct paxos_peer *peer = item->pi_peer;
+
+  switch (item->pi_kind) {
+    case PIO_MSG:
+      if (!peer->pp_closing && paxos_dispatch(peer, &item->pi_msg) != 0 &&
+          pax->self_id != 0) {
+        g_warning("pio_deliver: Dispatch failed.");
+      }
+      msgpack_zone_free(item->pi_zone);
+      break;
+
+    case PIO_EOF:
+      if (!peer->pp_closing) {
+        paxos_drop_connection(peer);
+      }
+      break;
+
+    case PIO_CLOSED:
+      g_free(peer);
+      break;
+
+    default:
+      assert(0);
+  }
+
+  g_free(item);
+}
+
+/**
+ * pio_shard_drain - Handle everything the I/O threads have passed a shard.
+ */
+static int
+pio_shard_drain(GIOChannel *channel, GIOCondition condition, void *data)
+{
+  unsigned i;
+  struct paxos_shard *shard = data;
+  struct paxos_state *prev;
+  struct pio_pool *pool;
+  struct pio_thread *pt;
+  struct pio_link *pl;
+  struct pio_item *item;
+  bool stalled = false;
+
+  prev = state;
+  state = shard->ps_state;
+  pool = state->ctx->mc_io;
+
+  pio_woken(shard->ps_io_fd, &shard->ps_io_wake);
+
+  for (i = 0; i < pool->po_count; ++i) {
+    pt = &pool->po_threads[i];
+    pl = &pt->pt_links[shard->ps_index];
+
+    if (pio_flush(&pl->pl_out, pl->pl_out_held, &pl->pl_out_full) > 0) {
+      pio_wake(pt->pt_fd, &pt->pt_wake);
+    }
+    if (!g_queue_is_empty(pl->pl_out_held)) {
+      stalled = true;
+    }
+  }
+
+  // If an I/O thread can't take our output as fast as we make it, handle
+  // nothing more until it catches up and wakes us.  The messages we leave
+  // fill our rings, and the I/O threads then stop reading our peers.
+  for (i = 0; i < pool->po_count && !stalled; ++i) {
+    pt = &pool->po_threads[i];
+    pl = &pt->pt_links[shard->ps_index];
+
+    while ((item = ring_pop(&pl->pl_in)) != NULL) {
+      pio_deliver(item);
+    }
+
+    if (g_atomic_int_compare_and_exchange(&pl->pl_in_full, 1, 0)) {
+      pio_wake(pt->pt_fd, &pt->pt_wake);
+    }
+  }
+
+  state = prev;
+  return TRUE;
+}
+
+/**
+ * pio_thread_main - Body of an I/O thread.
+ */
+static void *
+pio_thread_main(void *data)
+{
+  struct pio_thread *pt = data;
+
+  g_main_context_push_thread_default(pt->pt_context);
+  g_main_loop_run(pt->pt_loop);
+  return NULL;
+}
+
+/**
+ * pio_eventfd - Make an eventfd, and watch it on a given context.
+ */
+static int
+pio_eventfd(GMainContext *context, GIOFunc func, void *data)
+{
+  int fd;
+  GIOChannel *channel;
+
+  fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (fd < 0) {
+    return fd;
+  }
+
+  channel = g_io_channel_unix_new(fd);
+  pio_watch(context, channel, G_IO_IN, func, data);
+  g_io_channel_unref(channel);
+
+  return fd;
+}
+
+/**
+ * paxos_io_init - Start up n I/O threads, and have them serve every peer of
+ * the current context set up from here on.  This must be called from the
+ * main thread, after we are sharded if we are going to be, and before any
+ * peers are set up.
+ */
+int
+paxos_io_init(unsigned n)
+{
+  unsigned i, j;
+  struct motmot_ctx *ctx = state->ctx;
+  struct pio_pool *pool;
+  struct pio_thread *pt;
+  struct pio_link *pl;
+  struct paxos_shard *shard;
+
+  if (ctx->mc_io != NULL || n == 0) {
+    return 1;
+  }
+
+  pool = g_malloc0(sizeof(*pool));
+  pool->po_count = n;
+  pool->po_links = paxos_shard_count() + 1;
+  for (j = 0; j < pool->po_links; ++j) {
+    shard = paxos_shard_get(ctx, j);
+    shard->ps_io_fd = pio_eventfd(shard->ps_context, pio_shard_drain, shard);
+    if (shard->ps_io_fd < 0) {
+      return 1;
+    }
+  }
+
+  pool->po_threads = g_malloc0(n * sizeof(*pool->po_threads));
+  for (i = 0; i < n; ++i) {
+    pt = &pool->po_threads[i];
+    pt->pt_ctx = ctx;
+    pt->pt_context = g_main_context_new();
+    pt->pt_loop = g_main_loop_new(pt->pt_context, FALSE);
+    pt->pt_fd = pio_eventfd(pt->pt_context, pio_thread_drain, pt);
+    if (pt->pt_fd < 0) {
+      return 1;
+    }
+
+    pt->pt_links = g_malloc0(pool->po_links * sizeof(*pt->pt_links));
+    for (j = 0; j < pool->po_links; ++j) {
+      pl = &pt->pt_links[j];
+      ring_init(&pl->pl_in, PIO_RING_SIZE);
+      ring_init(&pl->pl_out, PIO_RING_SIZE);
+      pl->pl_in_held = g_queue_new();
+      pl->pl_out_held = g_queue_new();
+      pl->pl_paused = g_queue_new();
+    }
+  }
+
+  ctx->mc_io = pool;
+  for (i = 0; i < n; ++i) {
+    pt = &pool->po_threads[i];
+    pt->pt_thread = g_thread_new("motmot-io", pio_thread_main, pt);
+  }
+
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////
+//
+//  Peers.
+//
+
 /**
  * paxos_peer_init - Set up peer read/write buffering.
  */
@@ -28,6 +732,7 @@ struct paxos_peer *
 paxos_peer_init(GIOChannel *channel)
 {
   struct paxos_peer *peer;
+  struct pio_pool *pool = state->ctx->mc_io;
 
   if (channel == NULL) {
     return NULL;
@@ -43,13 +748,27 @@ paxos_peer_init(GIOChannel *channel)
   // Set the channel encoding to binary.
   g_io_channel_set_encoding(channel, NULL, NULL);
 
-  // Set up the read listener.
+  // Set up the read and write buffers.
   msgpack_unpacker_init(&peer->pp_unpacker, PIO_BUFSIZE);
-  g_io_add_watch(channel, G_IO_IN, paxos_peer_read, peer);
-
-  // Set up the write buffer.
   peer->pp_write_buffer = g_string_sized_new(PIO_BUFSIZE);
 
+  // If we have I/O threads, give the peer to one of them.  A connection
+  // handed to the main thread while we are sharded isn't read by it, but by
+  // whichever shard its first message picks.
+  if (pool != NULL) {
+    peer->pp_io = &pool->po_threads[
+        (unsigned)g_atomic_int_add(&pool->po_next, 1) % pool->po_count];
+    peer->pp_shard = state->shard;
+    if (paxos_shard_count() != 0 && state->shard == paxos_shard_main()) {
+      peer->pp_shard = NULL;
+    }
+    pio_to_io(pio_item_new(PIO_OPEN, peer, 0));
+    return peer;
+  }
+
+  // Otherwise, set up the read listener.
+  paxos_io_add_watch(channel, G_IO_IN, paxos_peer_read, peer);
+
   return peer;
 }
 
@@ -66,11 +785,19 @@ paxos_peer_destroy(struct paxos_peer *peer)
     return;
   }
 
+  // Let the I/O thread shut the peer down.  It hands it back for us to free
+  // once we've been through everything it read.
+  if (peer->pp_io != NULL) {
+    peer->pp_closing = true;
+    pio_to_io(pio_item_new(PIO_CLOSE, peer, 0));
+    return;
+  }
+
   // Clean up the msgpack read buffer / unpacker.
   msgpack_unpacker_destroy(&peer->pp_unpacker);
 
   // Get rid of our event listeners.
-  while (g_source_remove_by_user_data(peer));
+  while (paxos_source_remove_by_user_data(peer));
 
   // Flush and destroy the GIOChannel.
   status = g_io_channel_shutdown(peer->pp_channel, TRUE, &error);
@@ -82,6 +809,68 @@ paxos_peer_destroy(struct paxos_peer *peer)
   g_free(peer);
 }
 
+/**
+ * paxos_peer_adopt - Take over a connection from the main thread, handling
+ * its first message and anything else it has buffered.
+ */
+static int
+paxos_peer_adopt(void *data)
+{
+  struct paxos_handoff *ph = data;
+  struct paxos_peer *peer = ph->ph_peer;
+  struct paxos_state *prev;
+
+  prev = state;
+  state = ph->ph_shard->ps_state;
+
+  paxos_dispatch(peer, &ph->ph_msg);
+  msgpack_zone_free(ph->ph_zone);
+  g_free(ph);
+
+  if (paxos_peer_read(peer->pp_channel, G_IO_IN, peer)) {
+    paxos_io_add_watch(peer->pp_channel, G_IO_IN, paxos_peer_read, peer);
+  }
+
+  state = prev;
+  return FALSE;
+}
+
+/**
+ * paxos_peer_handoff - If the message just read from a connection is for a
+ * session on another shard, hand the connection to that shard, and if it is
+ * malformed, drop the connection.  Returns true if we did either, in which
+ * case we must stop reading.
+ */
+static bool
+paxos_peer_handoff(struct paxos_peer *peer, msgpack_unpacked *result)
+{
+  struct paxos_shard *shard;
+  struct paxos_handoff *ph;
+
+  shard = pio_route(state->ctx, &result->data);
+  if (shard == NULL) {
+    g_warning("paxos_peer_handoff: Malformed first message.");
+    paxos_peer_destroy(peer);
+    return true;
+  }
+  if (shard == state->shard) {
+    return false;
+  }
+
+  // Nothing else may have been scheduled for the connection here yet, since
+  // no session has seen it.
+  paxos_source_remove_by_user_data(peer);
+
+  ph = g_malloc0(sizeof(*ph));
+  ph->ph_peer = peer;
+  ph->ph_shard = shard;
+  ph->ph_msg = result->data;
+  ph->ph_zone = msgpack_unpacked_release_zone(result);
+  g_main_context_invoke(shard->ps_context, paxos_peer_adopt, ph);
+
+  return true;
+}
+
 /**
  * paxos_peer_read - Buffer data from a socket read and deserialize.
  */
@@ -119,6 +908,14 @@ paxos_peer_read(GIOChannel *channel, GIOCondition condition, void *data)
 
     // Pop as many msgpack objects as we can get our hands on.
     while (msgpack_unpacker_next(&peer->pp_unpacker, &result)) {
+      // Pass the connection on if it belongs on another shard.  Only the
+      // main thread reads connections which no shard has claimed yet.
+      if (paxos_shard_count() != 0 && state->shard == paxos_shard_main() &&
+          paxos_peer_handoff(peer, &result)) {
+        msgpack_unpacked_destroy(&result);
+        return FALSE;
+      }
+
       if (paxos_dispatch(peer, &result.data) != 0 && pax->self_id != 0) {
         g_warning("paxos_read_peer: Dispatch failed.");
         r = FALSE;
@@ -168,8 +965,8 @@ paxos_peer_write(GIOChannel *channel, GIOCondition condition, void *data)
 
   if (peer->pp_write_buffer->len == 0) {
     // XXX: this is kind of hax
-    while (g_source_remove_by_user_data(peer));
-    g_io_add_watch(peer->pp_channel, G_IO_IN, paxos_peer_read, peer);
+    while (paxos_source_remove_by_user_data(peer));
+    paxos_io_add_watch(peer->pp_channel, G_IO_IN, paxos_peer_read, peer);
   }
 
   // Flush the channel.
@@ -196,14 +993,40 @@ paxos_peer_write(GIOChannel *channel, GIOCondition condition, void *data)
 int
 paxos_peer_send(struct paxos_peer *peer, const char *buffer, size_t length)
 {
+  struct pio_item *item;
+
+  // Pass the output to the I/O thread if there is one.
+  if (peer->pp_io != NULL) {
+    if (length > 0) {
+      item = pio_item_new(PIO_DATA, peer, length);
+      memcpy(item->pi_data, buffer, length);
+      g_atomic_int_add(&peer->pp_pending, (int)length);
+      pio_to_io(item);
+    }
+    return 0;
+  }
+
   // If there was no data in the buffer to begin with, it means we weren't
   // subscribed to write events. Since we're populating the buffer now, let's
   // start listening.
   if (peer->pp_write_buffer->len == 0 && length > 0) {
-    g_io_add_watch(peer->pp_channel, G_IO_OUT, paxos_peer_write, peer);
+    paxos_io_add_watch(peer->pp_channel, G_IO_OUT, paxos_peer_write, peer);
   }
 
   g_string_append_len(peer->pp_write_buffer, buffer, length);
 
   return 0;
 }
+
+/**
+ * paxos_peer_pending - Get the number of bytes still waiting to be written
+ * to a peer.
+ */
+size_t
+paxos_peer_pending(struct paxos_peer *peer)
+{
+  if (peer->pp_io != NULL) {
+    return g_atomic_int_get(&peer->pp_pending);
+  }
+  return peer->pp_write_buffer->len;
+}
@@ -12,5 +12,6 @@ struct paxos_peer;
 struct paxos_peer *paxos_peer_init(GIOChannel *);
 void paxos_peer_destroy(struct paxos_peer *);
 int paxos_peer_send(struct paxos_peer *, const char *, size_t);
+size_t paxos_peer_pending(struct paxos_peer *);
 
 #endif /* __PAXOS_IO_H__ */
@@ -15,6 +15,48 @@
 #include "paxos_util.h"
 #include "containers/list.h"
 
+/**
+ * learn_flush - Deliver the chats we have gathered for the client's batch
+ * callback.  If the client has since gone back to the chat callback, we
+ * deliver them one at a time.
+ */
+static void
+learn_flush(void)
+{
+  unsigned i;
+  motmot_chat_t *chat;
+
+  if (state->learned == NULL || state->learned->len == 0) {
+    return;
+  }
+
+  if (state->learn.chats != NULL) {
+    paxos_deliver_batch(state->learn.chats,
+        (motmot_chat_t *)state->learned->data, state->learned->len,
+        pax->client_data);
+  } else {
+    for (i = 0; i < state->learned->len; ++i) {
+      chat = &g_array_index(state->learned, motmot_chat_t, i);
+      paxos_deliver_learn(state->learn.chat, chat->message, chat->len,
+          chat->desc, chat->size, pax->client_data);
+    }
+  }
+  g_array_set_size(state->learned, 0);
+}
+
+/**
+ * paxos_learn_batch - Set the client's batch learning callback.
+ */
+int
+paxos_learn_batch(learn_batch_t chats)
+{
+  state->learn.chats = chats;
+  if (chats != NULL && state->learned == NULL) {
+    state->learned = g_array_new(FALSE, FALSE, sizeof(motmot_chat_t));
+  }
+  return 0;
+}
+
 /**
  * paxos_commit - Commit a value for an instance of the Paxos protocol.
  *
@@ -43,18 +85,29 @@ paxos_commit(struct paxos_instance *inst)
 
   // Pull the request from the request cache if applicable.
   if (request_needs_cached(inst->pi_val.pv_dkind)) {
-    req = request_find(&pax->rcache, inst->pi_val.pv_reqid);
+    req = rcache_find(pax, inst->pi_val.pv_reqid);
 
-    // If we can't find a request and need one, send out a retrieve to the
-    // request originator and defer the commit.
+    // If we can't find a request and need one, queue up a retrieve and
+    // defer the commit.
     if (req == NULL) {
       return paxos_retrieve(inst);
     }
+
+    // Likewise, if it's a large chat whose payload we don't have, fetch it.
+    if (!paxos_blob_ready(req)) {
+      return paxos_blob_fetch(inst);
+    }
   }
 
   // Mark the cache.
   inst->pi_cached = true;
 
+  // If our welcome is still streaming in, we cannot learn in order yet.  We
+  // will pick up from here once the backfill completes.
+  if (pax->backfill != NULL) {
+    return 0;
+  }
+
   // We should already have committed and learned everything before the hole.
   assert(inst->pi_hdr.ph_inum >= pax->ihole);
 
@@ -122,17 +175,82 @@ paxos_commit(struct paxos_instance *inst)
     // have checked that pi_cached holds.
     req = NULL;
     if (request_needs_cached(it->pi_val.pv_dkind)) {
-      req = request_find(&pax->rcache, it->pi_val.pv_reqid);
+      req = rcache_find(pax, it->pi_val.pv_reqid);
       assert(req != NULL);
+
+      // The blob store may have dropped a payload while we were waiting on
+      // an earlier instance; if so, fetch it again.
+      if (!paxos_blob_ready(req)) {
+        it->pi_cached = false;
+        pax->istart = it;
+        learn_flush();
+        return paxos_blob_fetch(it);
+      }
+    }
+
+    // Learn the value.  Every decree which can fail or end the session
+    // delivers the chats gathered before it first, so anything still here on
+    // failure points into a session which may be gone; drop it.
+    r = paxos_learn(it, req);
+    if (r != 0) {
+      if (state->learned != NULL) {
+        g_array_set_size(state->learned, 0);
+      }
+      return r;
     }
 
-    // Learn the value.
-    ERR_RET(r, paxos_learn(it, req));
+    // If it turned out that we had lost its payload, we are fetching it again
+    // and will learn from here once we have it.
+    if (!it->pi_learned) {
+      return 0;
+    }
   }
 
+  // Deliver any chats still waiting on the batch callback.
+  learn_flush();
+
+  // Now that we've learned more, see whether it's time to sync.
+  paxos_sync_schedule();
+
   return 0;
 }
 
+/**
+ * paxos_commit_ready - Find all the committed instances we were waiting on
+ * whose requests we now have, mark them cached, and learn as far as we now
+ * can.
+ */
+int
+paxos_commit_ready(void)
+{
+  struct paxos_instance *inst, *it;
+  struct paxos_request *req;
+
+  inst = NULL;
+  for (it = pax->istart; it != (void *)&pax->ilist; it = LIST_NEXT(it, pi_le)) {
+    if (!it->pi_committed || it->pi_cached) {
+      continue;
+    }
+    if (request_needs_cached(it->pi_val.pv_dkind)) {
+      req = rcache_find(pax, it->pi_val.pv_reqid);
+      if (req == NULL || !paxos_blob_ready(req)) {
+        continue;
+      }
+    }
+
+    it->pi_cached = true;
+    if (inst == NULL) {
+      inst = it;
+    }
+  }
+
+  // Commit the lowest of them again, which learns as far as we now can.
+  if (inst == NULL) {
+    return 0;
+  }
+  return paxos_commit(inst);
+}
+
 /**
  * paxos_learn - Do something useful with the value of a commit.
  *
@@ -143,10 +261,44 @@ int
 paxos_learn(struct paxos_instance *inst, struct paxos_request *req)
 {
   int r = 0;
+  size_t size;
+  const char *data;
   struct paxos_acceptor *acc;
+  struct paxos_blob *blob;
+  motmot_chat_t chat;
+
+  // Read in the payload of a large chat before we change anything, since
+  // the read can fail if the payload was spilled to disk.  Reading the blob
+  // may evict those of chats we have gathered, so deliver them first.
+  data = NULL;
+  size = 0;
+  blob = NULL;
+  if (inst->pi_val.pv_dkind == DEC_CHAT &&
+      (req->pr_val.pv_extra & CHAT_BLOB)) {
+    learn_flush();
+    blob = paxos_blob_expect(req);
+    if (blob != NULL) {
+      data = blob_store_data(&state->blobs, blob);
+      size = blob->pb_size;
+    }
 
-  // Mark the learn.
+    // If we lost the payload, fetch it again and learn from here once we
+    // have it.
+    if (blob != NULL && data == NULL) {
+      inst->pi_cached = false;
+      pax->istart = inst;
+      return paxos_blob_fetch(inst);
+    }
+  }
+
+  // Mark the learn, and account for its request until we truncate it.
   inst->pi_learned = true;
+  if (req != NULL) {
+    pax->rcache_bytes += req->pr_size;
+  }
+
+  // Log the learn, so that we know where to resume after a restart.
+  paxos_wal_instance(inst);
 
   // Act on the decree (e.g., display chat, record acceptor list changes).
   switch (inst->pi_val.pv_dkind) {
@@ -158,12 +310,45 @@ paxos_learn(struct paxos_instance *inst, struct paxos_request *req)
       acc = acceptor_find(&pax->alist, req->pr_val.pv_reqid.id);
       assert(acc != NULL);
 
-      // Invoke client learning callback.
-      state.learn.chat(req->pr_data, req->pr_size, acc->pa_desc, acc->pa_size,
-          pax->client_data);
+      // Unless we read in a blob above, the payload is the request itself.
+      // Nobody can fetch the blob of a malformed reference, so nobody
+      // delivers the chat.
+      if (!(req->pr_val.pv_extra & CHAT_BLOB)) {
+        data = req->pr_data;
+        size = req->pr_size;
+      } else if (blob == NULL) {
+        break;
+      }
+
+      // Record the chat in our history before the client can end the
+      // session.
+      if (pax->history != NULL) {
+        history_append(pax->history, inst->pi_hdr.ph_inum, acc->pa_desc,
+            acc->pa_size, data, size);
+      }
+
+      // Invoke the client learning callback, or gather the chat for the
+      // batch callback.  Chats whose payloads are blobs go out right away,
+      // since the next blob we read may evict them.
+      if (state->learn.chats == NULL) {
+        paxos_deliver_learn(state->learn.chat, data, size, acc->pa_desc,
+            acc->pa_size, pax->client_data);
+      } else {
+        chat.message = data;
+        chat.len = size;
+        chat.desc = acc->pa_desc;
+        chat.size = acc->pa_size;
+        g_array_append_val(state->learned, chat);
+        if (req->pr_val.pv_extra & CHAT_BLOB) {
+          learn_flush();
+        }
+      }
       break;
 
     case DEC_JOIN:
+      // Deliver the chats before this join, so the client sees them in order.
+      learn_flush();
+
       // Check the adefer list to see if we received a hello already for the
       // newly joined acceptor.
       acc = acceptor_find(&pax->adefer, inst->pi_hdr.ph_inum);
@@ -180,9 +365,17 @@ paxos_learn(struct paxos_instance *inst, struct paxos_request *req)
       }
       acceptor_insert(&pax->alist, acc);
 
+      // Note whether the joiner votes.
+      acc->pa_learner = (inst->pi_val.pv_extra != 0);
+      if (acc->pa_learner) {
+        pax->learner_count++;
+      }
+      quorum_validate();
+
       // Copy over the identity information.
       acc->pa_size = req->pr_size;
       acc->pa_desc = g_memdup(req->pr_data, req->pr_size);
+      paxos_wal_members();
 
       // If we are the proposer, we are responsible for connecting to the new
       // acceptor, as well as for sending the new acceptor its paxid and other
@@ -192,12 +385,15 @@ paxos_learn(struct paxos_instance *inst, struct paxos_request *req)
       }
 
       // Invoke client learning callback.
-      state.learn.join(req->pr_data, req->pr_size, acc->pa_desc, acc->pa_size,
-          pax->client_data);
+      paxos_deliver_learn(state->learn.join, req->pr_data, req->pr_size,
+          acc->pa_desc, acc->pa_size, pax->client_data);
       break;
 
     case DEC_PART:
     case DEC_KILL:
+      // Deliver the chats before this part, so the client sees them in order.
+      learn_flush();
+
       // Grab the acceptor from the alist.
       acc = acceptor_find(&pax->alist, inst->pi_val.pv_extra);
       if (acc == NULL) {
@@ -209,8 +405,8 @@ paxos_learn(struct paxos_instance *inst, struct paxos_request *req)
       }
 
       // Invoke client learning callback.
-      state.learn.part(acc->pa_desc, acc->pa_size, acc->pa_desc, acc->pa_size,
-          pax->client_data);
+      paxos_deliver_learn(state->learn.part, acc->pa_desc, acc->pa_size,
+          acc->pa_desc, acc->pa_size, pax->client_data);
 
       // If we are being parted, leave the protocol.
       if (acc->pa_paxid == pax->self_id) {
@@ -223,10 +419,15 @@ paxos_learn(struct paxos_instance *inst, struct paxos_request *req)
       if (acc->pa_peer != NULL) {
         pax->live_count--;
       }
+      if (acc->pa_learner) {
+        pax->learner_count--;
+      }
+      quorum_validate();
+      paxos_wal_members();
 
       // If we just parted our proposer, "elect" a new one.  If it's us, send
       // a prepare.
-      if (acc->pa_paxid == pax->proposer->pa_paxid) {
+      if (pax->proposer == NULL || acc == pax->proposer) {
         reset_proposer();
         if (is_proposer()) {
           r = proposer_prepare(acc);
@@ -236,6 +437,11 @@ paxos_learn(struct paxos_instance *inst, struct paxos_request *req)
       // Free the parted acceptor.
       acceptor_destroy(acc);
 
+      // If we're in a star, someone new may now be in line to propose.
+      if (pax->options.po_star != 0) {
+        ERR_ACCUM(r, acceptor_connect_neighbors());
+      }
+
       break;
   }
 
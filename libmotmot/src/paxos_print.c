@@ -83,6 +83,30 @@ paxop_print(paxop_t op, const char *lead, const char *trail)
     case OP_TRUNCATE:
       printf("OP_TRUNCATE");
       break;
+    case OP_BACKFILL:
+      printf("OP_BACKFILL");
+      break;
+    case OP_FETCH:
+      printf("OP_FETCH   ");
+      break;
+    case OP_BLOB_GET:
+      printf("OP_BLOB_GET");
+      break;
+    case OP_BLOB_PUT:
+      printf("OP_BLOB_PUT");
+      break;
+    case OP_RELAY:
+      printf("OP_RELAY   ");
+      break;
+    case OP_SNAPSHOT:
+      printf("OP_SNAPSHOT");
+      break;
+    case OP_RESUME:
+      printf("OP_RESUME  ");
+      break;
+    case OP_REQUESTS:
+      printf("OP_REQUESTS");
+      break;
   }
   printf("%s", trail);
 }
@@ -15,6 +15,8 @@
 #include "paxos_util.h"
 #include "containers/list.h"
 
+#define THRIFTY_TIMEOUT   100   // ms before we widen a thrifty decree
+
 static inline void
 swap(void **p1, void **p2)
 {
@@ -23,6 +25,23 @@ swap(void **p1, void **p2)
   *p2 = tmp;
 }
 
+/**
+ * prepare_header_pack - Pack the header of our current prepare.
+ */
+static void
+prepare_header_pack(struct paxos_yak *py)
+{
+  struct paxos_header hdr;
+
+  hdr.ph_session = *pax->session_id;
+  hdr.ph_ballot.id = pax->prep->pp_ballot.id;
+  hdr.ph_ballot.gen = pax->prep->pp_ballot.gen;
+  hdr.ph_opcode = OP_PREPARE;
+  hdr.ph_inum = pax->ihole;
+
+  paxos_header_pack(py, &hdr);
+}
+
 /**
  * proposer_prepare - Broadcast a prepare message to all acceptors.
  *
@@ -61,7 +80,6 @@ int
 proposer_prepare(struct paxos_acceptor *old_proposer)
 {
   int r = 0;
-  struct paxos_header hdr;
   struct paxos_yak py;
   struct paxos_acceptor *acc;
 
@@ -69,18 +87,16 @@ proposer_prepare(struct paxos_acceptor *old_proposer)
   // prepare again.
   assert(pax->prep == NULL);
 
-  // If a majority of acceptors are disconnected, we should just give up and
-  // quit the session.
-  if (pax->live_count < majority()) {
-    return paxos_end(pax);  // Always returns 1.
-  }
-
+  // If too many acceptors are disconnected for a prepare quorum, we can't
+  // succeed yet, but we prepare anyway and keep the session.  Voters who
+  // reconnect while we wait are sent the prepare when they say hello.
   // Start a new prepare.
   pax->prep = g_malloc0(sizeof(*pax->prep));
 
   // Set up a new ballot.
   pax->prep->pp_ballot.id = pax->self_id;
   pax->prep->pp_ballot.gen = ++pax->gen_high;
+  paxos_wal_ballot();
 
   // Initialize our counters.  Our only initial acceptor is ourselves, and no
   // one initially redirects.
@@ -111,27 +127,40 @@ proposer_prepare(struct paxos_acceptor *old_proposer)
         continue;
       }
 
-      // Kill higher-ranked acceptors; part lower-ranked ones.
-      ERR_ACCUM(r, proposer_decree_part(acc, acc->pa_paxid < pax->self_id));
+      // Kill higher-ranked acceptors; part lower-ranked ones.  Learners are
+      // never ranked.
+      ERR_ACCUM(r, proposer_decree_part(acc,
+            !acc->pa_learner && acc->pa_paxid < pax->self_id));
     }
   }
 
-  // Initialize a Paxos header.
-  hdr.ph_session = *pax->session_id;
-  hdr.ph_ballot.id = pax->prep->pp_ballot.id;
-  hdr.ph_ballot.gen = pax->prep->pp_ballot.gen;
-  hdr.ph_opcode = OP_PREPARE;
-  hdr.ph_inum = pax->ihole;
-
   // Pack and broadcast the prepare.
   paxos_payload_init(&py, 1);
-  paxos_header_pack(&py, &hdr);
+  prepare_header_pack(&py);
   ERR_ACCUM(r, paxos_broadcast(&py));
   paxos_payload_destroy(&py);
 
   return r;
 }
 
+/**
+ * proposer_prepare_late - Send our ongoing prepare to a voter who has only
+ * just reconnected to us.
+ */
+int
+proposer_prepare_late(struct paxos_acceptor *acc)
+{
+  int r;
+  struct paxos_yak py;
+
+  paxos_payload_init(&py, 1);
+  prepare_header_pack(&py);
+  r = paxos_send(acc, &py);
+  paxos_payload_destroy(&py);
+
+  return r;
+}
+
 /**
  * Helper routine to obtain the instance on ilist with the closest instance
  * number <= inum.  We are passed in an iterator to simulate a continuation.
@@ -245,14 +274,15 @@ proposer_ack_promise(struct paxos_header *hdr, msgpack_object *o)
   // Acknowledge the promise.
   pax->prep->pp_acks++;
 
-  // Return if we don't have a majority of acks; otherwise, end the prepare.
-  if (pax->prep->pp_acks < majority()) {
+  // Return if we don't have a quorum of acks; otherwise, end the prepare.
+  if (pax->prep->pp_acks < prepare_quorum()) {
     return 0;
   }
 
   // Set our ballot to the prepare ballot.
   pax->ballot.id = pax->prep->pp_ballot.id;
   pax->ballot.gen = pax->prep->pp_ballot.gen;
+  paxos_wal_ballot();
 
   // For each Paxos instance for which we don't have a commit, send a decree.
   for (it = pax->prep->pp_istart, inum = pax->ihole; ; ++inum) {
@@ -297,6 +327,7 @@ proposer_ack_promise(struct paxos_header *hdr, msgpack_object *o)
       // Do initialization common to both above paths.
       header_init(&inst->pi_hdr, OP_DECREE, inst->pi_hdr.ph_inum);
       instance_init_metadata(inst);
+      paxos_wal_instance(inst);
 
       // Pack and broadcast the decree.
       ERR_RET(r, paxos_broadcast_instance(inst));
@@ -317,6 +348,174 @@ proposer_ack_promise(struct paxos_header *hdr, msgpack_object *o)
   return 0;
 }
 
+/**
+ * subset_contains - Check whether a thrifty decree was sent to an acceptor.
+ *
+ * The targets of a thrifty decree are a contiguous (possibly wrapping) run
+ * of the alist.  Acceptors who joined after the decree never got it.
+ */
+static inline bool
+subset_contains(struct paxos_instance *inst, paxid_t paxid)
+{
+  if (paxid > inst->pi_hdr.ph_inum) {
+    return false;
+  }
+
+  if (inst->pi_subset_lo <= inst->pi_subset_hi) {
+    return inst->pi_subset_lo <= paxid && paxid <= inst->pi_subset_hi;
+  } else {
+    return inst->pi_subset_lo <= paxid || paxid <= inst->pi_subset_hi;
+  }
+}
+
+/**
+ * proposer_decree_thrifty - Send a decree to only as many live acceptors as
+ * we need for a quorum with ourselves.
+ *
+ * We rotate through the alist from one decree to the next so as to spread
+ * the load evenly.  Everyone else learns the value from the commit.  If the
+ * decree fails to commit in good time, paxos_widen sends it to everyone
+ * else as well.
+ */
+static int
+proposer_decree_thrifty(struct paxos_instance *inst)
+{
+  int r = 0;
+  unsigned count;
+  pax_uuid_t *uuid;
+  struct paxos_acceptor *acc, *start;
+  struct paxos_yak py;
+
+  // Pick up where our last thrifty decree left off.
+  start = LIST_FIRST(&pax->alist);
+  LIST_FOREACH(acc, &pax->alist, pa_le) {
+    if (acc->pa_paxid >= pax->thrifty_next) {
+      start = acc;
+      break;
+    }
+  }
+
+  paxos_payload_init(&py, 2);
+  paxos_header_pack(&py, &(inst->pi_hdr));
+  paxos_value_pack_inline(&py, &(inst->pi_val));
+
+  // Send to the next accept_quorum() - 1 live voters.  We have no peer, so
+  // we skip ourselves.
+  for (acc = start, count = 0; count < accept_quorum() - 1; ) {
+    if (acc->pa_peer != NULL && !acc->pa_learner) {
+      if (count == 0) {
+        inst->pi_subset_lo = acc->pa_paxid;
+      }
+      inst->pi_subset_hi = acc->pa_paxid;
+      ERR_ACCUM(r, paxos_send(acc, &py));
+      count++;
+    }
+
+    acc = LIST_NEXT(acc, pa_le);
+    if (acc == (void *)&pax->alist) {
+      acc = LIST_FIRST(&pax->alist);
+    }
+    if (acc == start) {
+      break;
+    }
+  }
+
+  paxos_payload_destroy(&py);
+  pax->thrifty_next = acc->pa_paxid;
+
+  // Make sure we'll check back on the decree.
+  if (!pax->thrifty_pending) {
+    pax->thrifty_pending = true;
+    pax->thrifty_mark = next_instance();
+
+    uuid = g_malloc0(sizeof(*uuid));
+    *uuid = *pax->session_id;
+    paxos_timeout_add(THRIFTY_TIMEOUT, paxos_widen, uuid);
+  }
+
+  return r;
+}
+
+/**
+ * proposer_widen - Send a thrifty decree to every live voter who didn't get
+ * it the first time.
+ */
+static int
+proposer_widen(struct paxos_instance *inst)
+{
+  int r = 0;
+  struct paxos_acceptor *acc;
+  struct paxos_yak py;
+
+  paxos_payload_init(&py, 2);
+  paxos_header_pack(&py, &(inst->pi_hdr));
+  paxos_value_pack_inline(&py, &(inst->pi_val));
+
+  LIST_FOREACH(acc, &pax->alist, pa_le) {
+    if (acc->pa_peer == NULL || acc->pa_learner ||
+        subset_contains(inst, acc->pa_paxid)) {
+      continue;
+    }
+    ERR_ACCUM(r, paxos_send(acc, &py));
+  }
+
+  paxos_payload_destroy(&py);
+
+  // The decree has now gone to everyone.
+  inst->pi_subset_lo = 0;
+  inst->pi_subset_hi = 0;
+
+  return r;
+}
+
+/**
+ * paxos_widen - Widen any thrifty decrees which have been waiting on their
+ * subsets for at least a full timeout.
+ *
+ * Every tick, we widen the uncommitted thrifty decrees made before the last
+ * tick, and we keep ticking for as long as any thrifty decrees are pending.
+ */
+int
+paxos_widen(void *data)
+{
+  bool pending = false;
+  pax_uuid_t *uuid;
+  struct paxos_instance *inst;
+
+  // Set the session, which may have ended while we were waiting.
+  uuid = (pax_uuid_t *)data;
+  pax = session_find(&state->sessions, uuid);
+  if (pax == NULL) {
+    g_free(uuid);
+    return FALSE;
+  }
+
+  // Everything before istart is committed.
+  if (is_proposer()) {
+    for (inst = pax->istart; inst != (void *)&pax->ilist;
+        inst = LIST_NEXT(inst, pi_le)) {
+      if (inst->pi_committed || inst->pi_subset_lo == 0) {
+        continue;
+      }
+
+      if (inst->pi_hdr.ph_inum < pax->thrifty_mark) {
+        proposer_widen(inst);
+      } else {
+        pending = true;
+      }
+    }
+  }
+
+  if (!pending) {
+    pax->thrifty_pending = false;
+    g_free(uuid);
+    return FALSE;
+  }
+
+  pax->thrifty_mark = next_instance();
+  return TRUE;
+}
+
 /**
  * proposer_decree - Broadcast a decree.
  *
@@ -334,14 +533,20 @@ proposer_decree(struct paxos_instance *inst)
   // Zero out the metadata and mark one vote.
   instance_init_metadata(inst);
 
-  // Insert into the ilist, updating istart.
+  // Insert into the ilist, updating istart, and log our own accept.
   instance_insert_and_upstart(inst);
+  paxos_wal_instance(inst);
+
+  // Pack and send the decree.  Parts may be rejected, and we need to hear
+  // from everyone to resolve a split vote, so they always go to everyone.
+  if (pax->options.po_thrifty && inst->pi_val.pv_dkind != DEC_PART) {
+    ERR_RET(r, proposer_decree_thrifty(inst));
+  } else {
+    ERR_RET(r, paxos_broadcast_instance(inst));
+  }
 
-  // Pack and broadcast the decree.
-  ERR_RET(r, paxos_broadcast_instance(inst));
-
-  // Do we constitute a majority ourselves?  If so, commit!
-  if (inst->pi_votes >= majority()) {
+  // Do we constitute a quorum ourselves?  If so, commit!
+  if (inst->pi_votes >= accept_quorum()) {
     return proposer_commit(inst);
   }
 
@@ -352,7 +557,7 @@ proposer_decree(struct paxos_instance *inst)
  * proposer_ack_accept - Acknowledge an acceptor's accept.
  *
  * Just increment the vote count of the appropriate Paxos instance and commit
- * if we have a majority.
+ * if we have an accept quorum.
  */
 int
 proposer_ack_accept(struct paxos_header *hdr)
@@ -373,8 +578,8 @@ proposer_ack_accept(struct paxos_header *hdr)
     return 0;
   }
 
-  // If we have a majority, send a commit message.
-  if (inst->pi_votes >= majority()) {
+  // If we have a quorum, send a commit message.
+  if (inst->pi_votes >= accept_quorum()) {
     return proposer_commit(inst);
   }
 
@@ -389,10 +594,28 @@ proposer_ack_accept(struct paxos_header *hdr)
  */
 int
 proposer_commit(struct paxos_instance *inst)
+{
+  // Our own accept counts towards the quorum, so it must be durable before
+  // anyone hears of the commit.  If it isn't yet, the commit waits for the
+  // next log sync along with everything else logged since the last.
+  if (paxos_wal_hold_commit(inst)) {
+    return 0;
+  }
+
+  return proposer_commit_durable(inst);
+}
+
+/**
+ * proposer_commit_durable - Broadcast a commit message for an instance whose
+ * accepts are all durable.
+ */
+int
+proposer_commit_durable(struct paxos_instance *inst)
 {
   int r;
 
   // Modify the instance header.
+  inst->pi_committing = false;
   inst->pi_hdr.ph_opcode = OP_COMMIT;
 
   // Pack and broadcast the commit.
@@ -14,14 +14,18 @@ int paxos_dispatch(struct paxos_peer *, const msgpack_object *);
 
 /* Learner operations. */
 int paxos_commit(struct paxos_instance *);
+int paxos_commit_ready(void);
 int paxos_learn(struct paxos_instance *, struct paxos_request *);
 
 /* Proposer operations. */
 int proposer_prepare(struct paxos_acceptor *);
+int proposer_prepare_late(struct paxos_acceptor *);
 int proposer_ack_promise(struct paxos_header *, msgpack_object *);
 int proposer_decree(struct paxos_instance *);
+int paxos_widen(void *);
 int proposer_ack_accept(struct paxos_header *);
 int proposer_commit(struct paxos_instance *);
+int proposer_commit_durable(struct paxos_instance *);
 
 /* Acceptor operations. */
 int acceptor_ack_prepare(struct paxos_peer *, struct paxos_header *);
@@ -36,17 +40,46 @@ int acceptor_ack_welcome(struct paxos_peer *, struct paxos_header *,
     msgpack_object *);
 int paxos_hello(struct paxos_acceptor *);
 int paxos_ack_hello(struct paxos_peer *, struct paxos_header *);
+int acceptor_connect_neighbors(void);
+int acceptor_fetch(struct paxos_acceptor *);
+int acceptor_refetch(void);
+int paxos_ack_fetch(struct paxos_header *, msgpack_object *);
+int paxos_backfill(void *);
+int paxos_backfill_chunk(struct paxos_acceptor *);
+int acceptor_ack_backfill(struct paxos_header *, msgpack_object *);
+int acceptor_resume(struct paxos_session *);
+int paxos_resume_expire(void *);
+int paxos_ack_resume(struct paxos_peer *, struct paxos_header *,
+    msgpack_object *);
+void acceptor_resume_ballot(struct paxos_header *);
+int proposer_part_dropped(struct paxos_acceptor *);
+int paxos_part_dropped(void *);
 
 /* Out-of-band request protocol. */
 int proposer_ack_request(struct paxos_header *, msgpack_object *);
+int proposer_ack_requests(struct paxos_header *, msgpack_object *);
 int acceptor_ack_request(struct paxos_peer *, struct paxos_header *,
     msgpack_object *);
+int acceptor_ack_requests(struct paxos_peer *, struct paxos_header *,
+    msgpack_object *);
 int paxos_retrieve(struct paxos_instance *);
+int paxos_retrieve_flush(void *);
+int paxos_retrieve_retry(void *);
 int paxos_ack_retrieve(struct paxos_header *, msgpack_object *);
 int paxos_resend(struct paxos_acceptor *, struct paxos_header *,
-    struct paxos_request *);
+    struct paxos_request **, unsigned);
 int paxos_ack_resend(struct paxos_header *, msgpack_object *);
 
+/* Large payload protocol. */
+struct paxos_blob *paxos_blob_expect(struct paxos_request *);
+void paxos_blob_await(struct paxos_request *);
+bool paxos_blob_ready(struct paxos_request *);
+int paxos_blob_push(struct paxos_blob *, const char *);
+int paxos_blob_fetch(struct paxos_instance *);
+int paxos_blob_retry(void *);
+int paxos_ack_blob_get(struct paxos_header *, msgpack_object *);
+int paxos_ack_blob_put(struct paxos_header *, msgpack_object *);
+
 /* Reconnect protocol. */
 int acceptor_redirect(struct paxos_peer *, struct paxos_header *);
 int proposer_ack_redirect(struct paxos_header *, msgpack_object *);
@@ -58,7 +91,7 @@ int proposer_ack_reject(struct paxos_header *);
 
 /* Retry protocol. */
 int acceptor_retry(paxid_t);
-int proposer_ack_retry(struct paxos_header *);
+int proposer_ack_retry(struct paxos_peer *, struct paxos_header *);
 int proposer_recommit(struct paxos_header *, struct paxos_instance *);
 int acceptor_ack_recommit(struct paxos_header *, msgpack_object *);
 
@@ -69,10 +102,29 @@ int acceptor_last(struct paxos_header *);
 int proposer_ack_last(struct paxos_header *, msgpack_object *);
 int proposer_truncate(struct paxos_header *);
 int acceptor_ack_truncate(struct paxos_header *, msgpack_object *);
+int paxos_truncate(void *);
+int proposer_snapshot(struct paxos_peer *);
+int acceptor_ack_snapshot(struct paxos_header *, msgpack_object *);
+
+/* Write-ahead logging. */
+void paxos_wal_ballot(void);
+void paxos_wal_instance(struct paxos_instance *);
+void paxos_wal_truncate(void);
+void paxos_wal_members(void);
+void paxos_wal_end(void);
+int paxos_wal_send(struct paxos_yak *);
+int paxos_wal_hold_commit(struct paxos_instance *);
+int paxos_wal_flush(void *);
+
+/* Tree fan-out. */
+int paxos_relay_instance(struct paxos_instance *);
+int paxos_ack_relay(struct paxos_peer *, struct paxos_header *,
+    msgpack_object *);
 
 /* Connection establishment continuations. */
 int continue_welcome(GIOChannel *, void *);
 int continue_ack_welcome(GIOChannel *, void *);
+int continue_resume(GIOChannel *, void *);
 int continue_ack_redirect(GIOChannel *, void *);
 int continue_ack_refuse(GIOChannel *, void *);
 int continue_ack_reject(GIOChannel *, void *);
@@ -16,8 +16,6 @@
 #include "paxos_util.h"
 #include "containers/list.h"
 
-#define DEATH_ADJUSTED(n) ((n) + (LIST_COUNT(&pax->alist) - pax->live_count))
-
 /**
  * acceptor_redirect - Tell a preparer that they are not the proposer and
  * thus do not have the right to prepare.
@@ -117,15 +115,17 @@ proposer_ack_redirect(struct paxos_header *hdr, msgpack_object *o)
     // Defer computation until the client performs connection.  If it succeeds,
     // give up the prepare; otherwise, reprepare.
     k = continuation_new(continue_ack_redirect, acc->pa_paxid);
-    ERR_RET(r, state.connect(acc->pa_desc, acc->pa_size, &k->pk_cb));
+    ERR_RET(r, state->connect(acc->pa_desc, acc->pa_size, &k->pk_cb));
     return 0;
   }
 
   // If we have heard back from everyone but the acks and redirects are tied,
-  // just prepare again.
-  if (pax->prep->pp_acks < majority() &&
+  // just prepare again.  If we are simply short of live voters, though, we
+  // keep waiting for reconnects instead.
+  if (pax->prep->pp_acks < prepare_quorum() &&
       DEATH_ADJUSTED(pax->prep->pp_redirects) < majority() &&
-      pax->prep->pp_acks + pax->prep->pp_redirects == pax->live_count) {
+      pax->prep->pp_acks + pax->prep->pp_redirects == live_voters() &&
+      live_voters() >= prepare_quorum()) {
     g_free(pax->prep);
     pax->prep = NULL;
     return proposer_prepare(NULL);
@@ -168,7 +168,7 @@ do_continue_ack_redirect(GIOChannel *chan, struct paxos_acceptor *acc,
 
     // We update the proposer only if we have not reconnected to an even
     // higher-ranked acceptor.
-    if (acc->pa_paxid < pax->proposer->pa_paxid) {
+    if (pax->proposer == NULL || acc->pa_paxid < pax->proposer->pa_paxid) {
       pax->proposer = acc;
     }
 
@@ -244,7 +244,7 @@ acceptor_ack_refuse(struct paxos_header *hdr, msgpack_object *o)
   // Check whether, since we sent our request, we have already found a more
   // suitable proposer, possibly due to another redirect, in which case we
   // can ignore this one.
-  if (pax->proposer->pa_paxid <= hdr->ph_inum) {
+  if (pax->proposer != NULL && pax->proposer->pa_paxid <= hdr->ph_inum) {
     return 0;
   }
 
@@ -262,7 +262,7 @@ acceptor_ack_refuse(struct paxos_header *hdr, msgpack_object *o)
   p = o->via.array.ptr + 1;
   paxos_value_unpack(&k->pk_data.req.pr_val, p++);
 
-  ERR_RET(r, state.connect(acc->pa_desc, acc->pa_size, &k->pk_cb));
+  ERR_RET(r, state->connect(acc->pa_desc, acc->pa_size, &k->pk_cb));
   return 0;
 }
 
@@ -307,7 +307,7 @@ do_continue_ack_refuse(GIOChannel *chan, struct paxos_acceptor *acc,
     // Say hello.
     ERR_ACCUM(r, paxos_hello(acc));
 
-    if (acc->pa_paxid < pax->proposer->pa_paxid) {
+    if (pax->proposer == NULL || acc->pa_paxid < pax->proposer->pa_paxid) {
       // Update the proposer only if we have not reconnected to an even
       // higher-ranked acceptor.
       pax->proposer = acc;
@@ -318,7 +318,7 @@ do_continue_ack_refuse(GIOChannel *chan, struct paxos_acceptor *acc,
       // the proposer and C, the real proposer, gets neither of their requests?
       header_init(&hdr, OP_REQUEST, pax->proposer->pa_paxid);
 
-      req = request_find(&pax->rcache, k->pk_data.req.pr_val.pv_reqid);
+      req = rcache_find(pax, k->pk_data.req.pr_val.pv_reqid);
       if (req == NULL) {
         req = &k->pk_data.req;
       }
@@ -397,22 +397,31 @@ proposer_ack_reject(struct paxos_header *hdr)
   if (DEATH_ADJUSTED(inst->pi_rejects) >= majority()) {
     // See if we can reconnect to the acceptor we tried to part.
     acc = acceptor_find(&pax->alist, inst->pi_val.pv_extra);
-    assert(acc->pa_peer == NULL);
+
+    // If the acceptor has resumed in the meantime, just withdraw the part.
+    if (acc->pa_peer != NULL) {
+      inst->pi_hdr.ph_opcode = OP_DECREE;
+      inst->pi_val.pv_dkind = DEC_NULL;
+      inst->pi_val.pv_extra = 0;
+      instance_init_metadata(inst);
+      paxos_wal_instance(inst);
+      return paxos_broadcast_instance(inst);
+    }
 
     // Defer computation until the client performs connection.  If it succeeds,
     // replace the part decree with a null decree; otherwise, just redecree
     // the part.  We bind the instance number of the decree as callback data.
     k = continuation_new(continue_ack_reject, acc->pa_paxid);
     k->pk_data.inum = inst->pi_hdr.ph_inum;
-    ERR_RET(r, state.connect(acc->pa_desc, acc->pa_size, &k->pk_cb));
+    ERR_RET(r, state->connect(acc->pa_desc, acc->pa_size, &k->pk_cb));
     return 0;
   }
 
   // If we have heard back from everyone but the accepts and rejects are tied,
   // just decree the part again.
-  if (inst->pi_votes < majority() &&
+  if (inst->pi_votes < accept_quorum() &&
       DEATH_ADJUSTED(inst->pi_rejects) < majority() &&
-      inst->pi_votes + inst->pi_rejects == pax->live_count) {
+      inst->pi_votes + inst->pi_rejects == live_voters()) {
     return paxos_broadcast_instance(inst);
   }
 
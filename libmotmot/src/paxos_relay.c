@@ -0,0 +1,189 @@
+/**
+ * paxos_relay.c - Tree fan-out for decrees and commits.
+ *
+ * Rather than writing every decree and commit to every acceptor directly,
+ * the proposer may send them to just a few acceptors, who forward them on.
+ * We arrange the alist, rotated so that the sender comes first, into a
+ * k-ary tree in which the children of position p are positions pk + 1
+ * through pk + k.
+ *
+ * Acceptors learn joins and parts at different times, so rather than trust
+ * everyone to build the same tree from their own alist, the root sends its
+ * member order along with each relay and everyone forwards by that.  If we
+ * have lost our connection to one of our children, or have yet to learn of
+ * it, we adopt its children instead, so that the tree repairs itself around
+ * missing acceptors.  Anything that still goes missing is recovered by the
+ * retry protocol.
+ */
+
+#include <assert.h>
+#include <glib.h>
+
+#include "paxos.h"
+#include "paxos_continue.h"
+#include "paxos_io.h"
+#include "paxos_msgpack.h"
+#include "paxos_print.h"
+#include "paxos_protocol.h"
+#include "paxos_state.h"
+#include "paxos_util.h"
+#include "containers/list.h"
+
+/**
+ * relay_children - Send a relay to the children of position p in the tree,
+ * adopting the children of any child we can't reach.
+ */
+static int
+relay_children(paxid_t *members, unsigned n, unsigned k, unsigned p,
+    struct paxos_yak *py)
+{
+  int r = 0;
+  unsigned c;
+  struct paxos_acceptor *acc;
+
+  for (c = p * k + 1; c <= p * k + k && c < n; ++c) {
+    if (members[c] == pax->self_id) {
+      continue;
+    }
+
+    acc = acceptor_find(&pax->alist, members[c]);
+    if (acc != NULL && acc->pa_peer != NULL) {
+      ERR_ACCUM(r, paxos_send(acc, py));
+    } else {
+      ERR_ACCUM(r, relay_children(members, n, k, c, py));
+    }
+  }
+
+  return r;
+}
+
+/**
+ * relay_forward - Pass a relay down our subtree of the root's member order.
+ */
+static int
+relay_forward(paxid_t *members, unsigned n, unsigned k, struct paxos_yak *py)
+{
+  unsigned self;
+
+  for (self = 0; self < n && members[self] != pax->self_id; ++self);
+  if (self == n) {
+    return 0;
+  }
+
+  return relay_children(members, n, k, self, py);
+}
+
+/**
+ * paxos_relay_instance - Send a decree or commit down the tree rooted at us.
+ */
+int
+paxos_relay_instance(struct paxos_instance *inst)
+{
+  int r;
+  unsigned i, n, self;
+  paxid_t *members;
+  struct paxos_header hdr;
+  struct paxos_acceptor *acc;
+  struct paxos_yak py;
+
+  // Lay out the alist with ourselves first.
+  n = LIST_COUNT(&pax->alist);
+  members = g_malloc0(n * sizeof(*members));
+
+  i = self = 0;
+  LIST_FOREACH(acc, &pax->alist, pa_le) {
+    if (acc->pa_paxid == pax->self_id) {
+      self = i;
+    }
+    i++;
+  }
+  i = 0;
+  LIST_FOREACH(acc, &pax->alist, pa_le) {
+    members[(i + n - self) % n] = acc->pa_paxid;
+    i++;
+  }
+
+  header_init(&hdr, OP_RELAY, pax->self_id);
+
+  paxos_payload_init(&py, 2);
+  paxos_header_pack(&py, &hdr);
+  paxos_payload_begin_array(&py, 3);
+  paxos_paxid_pack(&py, pax->options.po_fanout);
+  paxos_payload_begin_array(&py, n);
+  for (i = 0; i < n; ++i) {
+    paxos_paxid_pack(&py, members[i]);
+  }
+  paxos_payload_begin_array(&py, 2);
+  paxos_header_pack(&py, &(inst->pi_hdr));
+  paxos_value_pack_inline(&py, &(inst->pi_val));
+
+  r = relay_forward(members, n, pax->options.po_fanout, &py);
+  paxos_payload_destroy(&py);
+  g_free(members);
+
+  return r;
+}
+
+/**
+ * paxos_ack_relay - Forward a relay to our children, then handle the message
+ * it carries as if its root had sent it to us directly.
+ *
+ * Only the proposer relays, and only decrees and commits of its own ballot,
+ * so we drop anything else.  We dispatch with the root's connection rather
+ * than the relayer's, so that anything we do about the sender, such as
+ * killing a rival proposer, is done to the root and not to the messenger.
+ */
+int
+paxos_ack_relay(struct paxos_peer *source, struct paxos_header *hdr,
+    msgpack_object *o)
+{
+  int r;
+  paxid_t k;
+  unsigned i, n;
+  paxid_t *members;
+  msgpack_object *p;
+  struct paxos_header inner;
+  struct paxos_acceptor *root;
+  struct paxos_yak py;
+
+  // Make sure the payload is well-formed.
+  assert(o->type == MSGPACK_OBJECT_ARRAY);
+  assert(o->via.array.size == 3);
+  p = o->via.array.ptr;
+  paxos_paxid_unpack(&k, p);
+  assert(k > 0);
+  assert(p[1].type == MSGPACK_OBJECT_ARRAY);
+  assert(p[2].type == MSGPACK_OBJECT_ARRAY);
+  assert(p[2].via.array.size > 0);
+
+  // Check that the relayed message is one the root could have sent.
+  paxos_header_unpack(&inner, p[2].via.array.ptr);
+  if ((inner.ph_opcode != OP_DECREE && inner.ph_opcode != OP_COMMIT) ||
+      inner.ph_ballot.id != hdr->ph_inum) {
+    return 0;
+  }
+
+  // Forward first, since handling the message may end our session.
+  n = p[1].via.array.size;
+  members = g_malloc0(n * sizeof(*members));
+  for (i = 0; i < n; ++i) {
+    paxos_paxid_unpack(&members[i], p[1].via.array.ptr + i);
+  }
+
+  paxos_payload_init(&py, 2);
+  paxos_header_pack(&py, hdr);
+  msgpack_pack_object(py.pk, *o);
+  r = relay_forward(members, n, k, &py);
+  paxos_payload_destroy(&py);
+  g_free(members);
+
+  // A proposer who has lost the root has no one to hold to account for a
+  // rival decree, so it just drops it.
+  root = acceptor_find(&pax->alist, hdr->ph_inum);
+  source = root != NULL ? root->pa_peer : NULL;
+  if (source == NULL && is_proposer()) {
+    return r;
+  }
+
+  return r | paxos_dispatch(source, p + 2);
+}
@@ -3,6 +3,7 @@
  */
 
 #include <assert.h>
+#include <sys/uio.h>
 #include <glib.h>
 
 #include "paxos.h"
@@ -15,6 +16,36 @@
 #include "paxos_util.h"
 #include "containers/list.h"
 
+#define RETRIEVE_BATCH_MAX  64
+#define RETRIEVE_TIMEOUT    1000
+
+/**
+ * pending_voters - Count the voters we will have once every join we have
+ * decreed goes through.
+ */
+static unsigned
+pending_voters(void)
+{
+  unsigned count;
+  struct paxos_instance *it;
+
+  count = LIST_COUNT(&pax->alist) - pax->learner_count;
+
+  for (it = pax->istart; it != (void *)&pax->ilist; it = LIST_NEXT(it, pi_le)) {
+    if (!it->pi_learned && it->pi_val.pv_dkind == DEC_JOIN &&
+        it->pi_val.pv_extra == 0) {
+      count++;
+    }
+  }
+  LIST_FOREACH(it, &pax->idefer, pi_le) {
+    if (it->pi_val.pv_dkind == DEC_JOIN && it->pi_val.pv_extra == 0) {
+      count++;
+    }
+  }
+
+  return count;
+}
+
 /**
  * proposer_decree_request - Helper function for proposers to decree requests.
  */
@@ -27,6 +58,12 @@ proposer_decree_request(struct paxos_request *req)
   inst = g_malloc0(sizeof(*inst));
   memcpy(&inst->pi_val, &req->pr_val, sizeof(req->pr_val));
 
+  // Make the joiner a learner if we have as many voters as we want.
+  if (inst->pi_val.pv_dkind == DEC_JOIN && pax->options.po_max_voters != 0 &&
+      pending_voters() >= pax->options.po_max_voters) {
+    inst->pi_val.pv_extra = 1;
+  }
+
   // Send a decree if we're not preparing; if we are, defer it.
   if (pax->prep != NULL) {
     LIST_INSERT_TAIL(&pax->idefer, inst, pi_le);
@@ -36,66 +73,167 @@ proposer_decree_request(struct paxos_request *req)
   }
 }
 
+/* Where a request must be sent before it can be decreed. */
+enum request_route {
+  ROUTE_NONE = 0,     // nowhere; we are the proposer and will decree it
+  ROUTE_PROPOSER,     // just to the proposer
+  ROUTE_ALL,          // to everyone, who cache it ahead of the decree
+};
+
 /**
- * paxos_request - Request that the proposer make a decree for us.
- *
- * If the request has data attached to it, we broadcast an out-of-band message
- * to all acceptors, asking that they cache our message until the proposer
- * commits it.
+ * request_data_free - Release a client buffer allocated with g_malloc.
+ */
+static void
+request_data_free(void *msg, void *arg)
+{
+  g_free(msg);
+}
+
+/**
+ * request_new - Make a request with our next request ID, putting large chats
+ * in the blob store, and cache it if needed.
  *
- * We send the request as a header along with a two-object array consisting
- * of a paxos_value (itself an array) and a msgpack raw (i.e., a data
- * string).
+ * If release is non-NULL, the client is handing msg over to us, and we use
+ * it in place rather than copying it.  We call release on it once we have
+ * no more use for it.
  */
-int
-paxos_request(struct paxos_session *session, dkind_t dkind, const void *msg,
-    size_t len)
+static struct paxos_request *
+request_new(dkind_t dkind, paxid_t extra, const void *msg, size_t len,
+    motmot_release_t release, void *arg)
 {
-  int r, needs_cached;
-  struct paxos_header hdr;
+  unsigned k, n;
+  char ref[BLOB_REF_SIZE];
+  struct paxos_blob *blob;
   struct paxos_request *req;
-  struct paxos_yak py;
 
-  // Set the session.  The client should pass us a pointer to the correct
-  // session object which we returned when the session was created.
-  pax = session;
+  // Put large chats in the blob store and send along just a reference.  If
+  // we're erasure coding, any majority of the members' fragments rebuild it.
+  if (dkind == DEC_CHAT && pax->options.po_blob_min != 0 &&
+      len >= pax->options.po_blob_min) {
+    k = n = 0;
+    if (pax->options.po_erasure && LIST_COUNT(&pax->alist) > 1 &&
+        LIST_COUNT(&pax->alist) <= ERASURE_MAX_FRAGS) {
+      n = LIST_COUNT(&pax->alist);
+      k = n / 2 + 1;
+    }
+    blob = blob_store_put(&state->blobs, msg, len, k, n);
+    blob_ref_encode(blob, ref);
 
-  // We can't make requests if we're not part of a protocol.
-  if (pax == NULL) {
-    return 1;
+    // The blob store keeps its own copy, so we're done with the client's.
+    if (release != NULL) {
+      release((void *)msg, arg);
+      release = NULL;
+    }
+    msg = ref;
+    len = BLOB_REF_SIZE;
+    extra |= CHAT_BLOB;
   }
 
-  // Do we need to cache this request?
-  needs_cached = request_needs_cached(dkind);
-
-  // Initialize a header.  We overload ph_inum to the ID of the acceptor who
-  // we believe to be the proposer.
-  header_init(&hdr, OP_REQUEST, pax->proposer->pa_paxid);
+  // Should we inline it?  A limit of 0 turns inlining off, even for empty
+  // messages.
+  if (dkind == DEC_CHAT && pax->options.po_inline_max != 0 &&
+      len <= pax->options.po_inline_max) {
+    extra |= CHAT_INLINE;
+  }
 
   // Allocate a request and initialize it.
   req = g_malloc0(sizeof(*req));
   req->pr_val.pv_dkind = dkind;
   req->pr_val.pv_reqid.id = pax->self_id;
   req->pr_val.pv_reqid.gen = (++pax->req_id);  // Increment our req_id.
-  req->pr_val.pv_extra = 0; // Always 0 for requests.
+  req->pr_val.pv_extra = extra;
 
   req->pr_size = len;
-  req->pr_data = g_memdup(msg, len);
+  if (release != NULL) {
+    req->pr_data = (void *)msg;
+    req->pr_release = release;
+    req->pr_release_arg = arg;
+  } else {
+    req->pr_data = g_memdup(msg, len);
+  }
 
   // Add it to the request cache if needed.
-  if (needs_cached) {
-    request_insert(&pax->rcache, req);
+  if (request_needs_cached(dkind)) {
+    rcache_insert(pax, req);
+  }
+
+  return req;
+}
+
+/**
+ * request_route - Decide where we must send a request.
+ */
+static enum request_route
+request_route(struct paxos_request *req)
+{
+  int needs_cached, is_inline;
+
+  needs_cached = request_needs_cached(req->pr_val.pv_dkind);
+  is_inline = (req->pr_val.pv_dkind == DEC_CHAT &&
+      (req->pr_val.pv_extra & CHAT_INLINE));
+
+  // We need to send iff either we are not the proposer or the request has
+  // nontrivial data which the proposer won't be inlining.
+  if (is_proposer() && (!needs_cached || is_inline)) {
+    return ROUTE_NONE;
+  }
+
+  // Broadcast only if it needs caching ahead of the decree.  In a star, the
+  // proposer passes it on for us.
+  if (!needs_cached || is_inline || pax->options.po_star != 0) {
+    return ROUTE_PROPOSER;
   }
+  return ROUTE_ALL;
+}
+
+/**
+ * request_push - Hand out the fragments of a request's blob, if it is coded.
+ */
+static int
+request_push(struct paxos_request *req)
+{
+  struct paxos_blob *blob;
+
+  if (req->pr_val.pv_dkind != DEC_CHAT ||
+      !(req->pr_val.pv_extra & CHAT_BLOB)) {
+    return 0;
+  }
+
+  blob = paxos_blob_expect(req);
+  if (blob->pb_k == 0) {
+    return 0;
+  }
+  return paxos_blob_push(blob, req->pr_data);
+}
+
+/**
+ * request_submit - Send a new request wherever it must go, and decree it if
+ * we're the proposer.
+ */
+static int
+request_submit(struct paxos_request *req)
+{
+  int r;
+  enum request_route route;
+  struct paxos_header hdr;
+  struct paxos_yak py;
+
+  route = request_route(req);
+  if (route != ROUTE_NONE) {
+    // A learner cut off from every voter has nowhere to send.
+    if (pax->proposer == NULL) {
+      return 1;
+    }
+
+    // Initialize a header.  We overload ph_inum to the ID of the acceptor
+    // who we believe to be the proposer.
+    header_init(&hdr, OP_REQUEST, pax->proposer->pa_paxid);
 
-  if (!is_proposer() || needs_cached) {
-    // We need to send iff either we are not the proposer or the request
-    // has nontrivial data.
     paxos_payload_init(&py, 2);
     paxos_header_pack(&py, &hdr);
     paxos_request_pack(&py, req);
 
-    // Broadcast only if it needs caching.
-    if (!needs_cached) {
+    if (route == ROUTE_PROPOSER) {
       r = paxos_send_to_proposer(&py);
     } else {
       r = paxos_broadcast(&py);
@@ -107,6 +245,8 @@ paxos_request(struct paxos_session *session, dkind_t dkind, const void *msg,
     }
   }
 
+  ERR_RET(r, request_push(req));
+
   // Decree the request if we're the proposer; otherwise just return.
   if (is_proposer()) {
     return proposer_decree_request(req);
@@ -115,12 +255,211 @@ paxos_request(struct paxos_session *session, dkind_t dkind, const void *msg,
   }
 }
 
+/**
+ * paxos_request - Request that the proposer make a decree for us.
+ *
+ * If the request has data attached to it, we broadcast an out-of-band message
+ * to all acceptors, asking that they cache our message until the proposer
+ * commits it.  Chats small enough to be inlined are sent only to the
+ * proposer, who then packs them into its decrees and commits.  Chats large
+ * enough to be blobs are replaced by a reference into the blob store, and
+ * learners fetch them from us when they need them.
+ *
+ * We send the request as a header along with a two-object array consisting
+ * of a paxos_value (itself an array) and a msgpack raw (i.e., a data
+ * string).
+ */
+int
+paxos_request(struct paxos_session *session, dkind_t dkind, paxid_t extra,
+    const void *msg, size_t len)
+{
+  // Set the session.  The client should pass us a pointer to the correct
+  // session object which we returned when the session was created.
+  pax = session;
+
+  // We can't make requests if we're not part of a protocol, or if we have
+  // left it and the client has yet to hear.
+  if (pax == NULL || pax->ended) {
+    return 1;
+  }
+
+  return request_submit(request_new(dkind, extra, msg, len, NULL, NULL));
+}
+
+/**
+ * paxos_request_take - Request a chat, taking ownership of the client's
+ * buffer rather than copying it.  If release is NULL, the buffer must have
+ * been allocated with g_malloc.  We release the buffer even if we fail.
+ */
+int
+paxos_request_take(struct paxos_session *session, void *msg, size_t len,
+    motmot_release_t release, void *arg)
+{
+  if (release == NULL) {
+    release = request_data_free;
+  }
+
+  pax = session;
+  if (pax == NULL || pax->ended) {
+    release(msg, arg);
+    return 1;
+  }
+
+  return request_submit(request_new(DEC_CHAT, 0, msg, len, release, arg));
+}
+
+/**
+ * request_send_batch - Send a run of requests which share a route as a
+ * single OP_REQUESTS.
+ */
+static int
+request_send_batch(struct paxos_request **reqs, size_t n,
+    enum request_route route)
+{
+  int r;
+  size_t i;
+  struct paxos_header hdr;
+  struct paxos_yak py;
+
+  if (route == ROUTE_NONE) {
+    return 0;
+  }
+  if (pax->proposer == NULL) {
+    return 1;
+  }
+
+  header_init(&hdr, OP_REQUESTS, pax->proposer->pa_paxid);
+
+  paxos_payload_init(&py, 2);
+  paxos_header_pack(&py, &hdr);
+  paxos_payload_begin_array(&py, n);
+  for (i = 0; i < n; ++i) {
+    paxos_request_pack(&py, reqs[i]);
+  }
+
+  if (route == ROUTE_PROPOSER) {
+    r = paxos_send_to_proposer(&py);
+  } else {
+    r = paxos_broadcast(&py);
+  }
+
+  paxos_payload_destroy(&py);
+  return r;
+}
+
+/**
+ * paxos_requestv - Request chats for several messages at once.
+ *
+ * The chats take consecutive request IDs, and each is routed just as
+ * paxos_request would route it, but each run of consecutive chats going the
+ * same way shares a single message.  We send the runs in order, so that the
+ * proposer sees the chats in the order they were given.
+ *
+ * The call is all or nothing.  Sends only fail when there is no proposer to
+ * send to, so we check for one before making any requests.  If a run fails
+ * anyway, we uncache it and every run after it, none of which has been sent.
+ */
+int
+paxos_requestv(struct paxos_session *session, const struct iovec *iov,
+    size_t n)
+{
+  int r = 0;
+  size_t i, j;
+  enum request_route route;
+  struct paxos_request **reqs;
+
+  pax = session;
+  if (pax == NULL || pax->ended) {
+    return 1;
+  }
+  if (n == 0) {
+    return 0;
+  }
+
+  // A learner cut off from every voter has nowhere to send.
+  if (!is_proposer() && pax->proposer == NULL) {
+    return 1;
+  }
+
+  reqs = g_malloc(n * sizeof(*reqs));
+  for (i = 0; i < n; ++i) {
+    reqs[i] = request_new(DEC_CHAT, 0, iov[i].iov_base, iov[i].iov_len,
+        NULL, NULL);
+  }
+
+  // Send the runs, then hand out any blob fragments.
+  for (i = 0; i < n; i = j) {
+    route = request_route(reqs[i]);
+    for (j = i + 1; j < n && request_route(reqs[j]) == route; ++j);
+    ERR_ACCUM(r, request_send_batch(reqs + i, j - i, route));
+    if (r != 0) {
+      break;
+    }
+  }
+
+  // If a run failed, drop it and everything after it.
+  if (r != 0) {
+    for (; i < n; ++i) {
+      if (request_needs_cached(reqs[i]->pr_val.pv_dkind)) {
+        rcache_remove(pax, reqs[i]);
+      }
+      request_destroy(reqs[i]);
+    }
+    g_free(reqs);
+    return r;
+  }
+
+  for (i = 0; i < n && r == 0; ++i) {
+    ERR_ACCUM(r, request_push(reqs[i]));
+  }
+
+  // Decree them all if we're the proposer.
+  if (r == 0 && is_proposer()) {
+    for (i = 0; i < n; ++i) {
+      ERR_ACCUM(r, proposer_decree_request(reqs[i]));
+    }
+  }
+
+  g_free(reqs);
+  return r;
+}
+
+/**
+ * proposer_relay_request - Pass a request on to everyone but its requester,
+ * who, in a star, can't reach them directly.
+ */
+static int
+proposer_relay_request(struct paxos_request *req)
+{
+  int r = 0;
+  struct paxos_header hdr;
+  struct paxos_acceptor *acc;
+  struct paxos_yak py;
+
+  header_init(&hdr, OP_REQUEST, pax->self_id);
+
+  paxos_payload_init(&py, 2);
+  paxos_header_pack(&py, &hdr);
+  paxos_request_pack(&py, req);
+
+  LIST_FOREACH(acc, &pax->alist, pa_le) {
+    if (acc->pa_peer == NULL || acc->pa_paxid == req->pr_val.pv_reqid.id) {
+      continue;
+    }
+    ERR_ACCUM(r, paxos_send(acc, &py));
+  }
+
+  paxos_payload_destroy(&py);
+  return r;
+}
+
 /**
  * proposer_ack_request - Dispatch a request as a decree.
  */
 int
 proposer_ack_request(struct paxos_header *hdr, msgpack_object *o)
 {
+  int r;
   struct paxos_request *req;
   struct paxos_acceptor *acc;
 
@@ -144,9 +483,16 @@ proposer_ack_request(struct paxos_header *hdr, msgpack_object *o)
     return proposer_decree_part(acc, 1);
   }
 
-  // Add it to the request cache if needed.
+  // Add it to the request cache if needed.  In a star, nobody else has seen
+  // it yet, so pass it on ahead of our decree unless we'll be inlining it.
   if (request_needs_cached(req->pr_val.pv_dkind)) {
-    request_insert(&pax->rcache, req);
+    rcache_insert(pax, req);
+    paxos_blob_await(req);
+    if (pax->options.po_star != 0 &&
+        !(req->pr_val.pv_dkind == DEC_CHAT &&
+          (req->pr_val.pv_extra & CHAT_INLINE))) {
+      ERR_RET(r, proposer_relay_request(req));
+    }
   }
 
   return proposer_decree_request(req);
@@ -166,8 +512,10 @@ acceptor_ack_request(struct paxos_peer *source, struct paxos_header *hdr,
   req = g_malloc0(sizeof(*req));
   paxos_request_unpack(req, o);
 
-  // Add it to the request cache.
-  request_insert(&pax->rcache, req);
+  // Add it to the request cache, and get ready for its fragments if the
+  // requester is pushing them to us.
+  rcache_insert(pax, req);
+  paxos_blob_await(req);
 
   // The requester overloads ph_inst to the acceptor it believes to be the
   // proposer.  If we are incorrectly identified as the proposer (i.e., if
@@ -180,35 +528,205 @@ acceptor_ack_request(struct paxos_peer *source, struct paxos_header *hdr,
 }
 
 /**
- * paxos_retrieve - Ask the originator of request data to send us data which
- * we do not have in our cache.
+ * proposer_ack_requests - Dispatch each of a batch of requests as a decree.
+ */
+int
+proposer_ack_requests(struct paxos_header *hdr, msgpack_object *o)
+{
+  int r;
+  msgpack_object *p, *pend;
+
+  assert(o->type == MSGPACK_OBJECT_ARRAY);
+
+  p = o->via.array.ptr;
+  pend = o->via.array.ptr + o->via.array.size;
+  for (; p != pend; ++p) {
+    ERR_RET(r, proposer_ack_request(hdr, p));
+
+    // If the requester has the wrong proposer, we've already parted them.
+    if (hdr->ph_inum > pax->self_id) {
+      break;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * acceptor_ack_requests - Cache each of a batch of requests.
+ */
+int
+acceptor_ack_requests(struct paxos_peer *source, struct paxos_header *hdr,
+    msgpack_object *o)
+{
+  int r = 0;
+  msgpack_object *p, *pend;
+
+  assert(o->type == MSGPACK_OBJECT_ARRAY);
+
+  p = o->via.array.ptr;
+  pend = o->via.array.ptr + o->via.array.size;
+  for (; p != pend; ++p) {
+    ERR_ACCUM(r, acceptor_ack_request(source, hdr, p));
+  }
+
+  return r;
+}
+
+/**
+ * paxos_retrieve - Ask some acceptor to send us data which we do not have in
+ * our cache.
  *
  * We call this function when and only when we are issued a commit for an
- * instance whose associated request is not in our request cache.
+ * instance whose associated request is not in our request cache.  Rather
+ * than retrieving immediately, we flag the instance and schedule a flush for
+ * when the main loop goes idle, so that all the retrieves we accumulate while
+ * processing a burst of commits (or a welcome) go out in a few batches.
+ *
+ * Our first retrieve for an instance goes to a single acceptor, who may not
+ * have the request after all.  We also schedule a periodic retry which
+ * broadcasts retrieves for everything still missing until it arrives.
  */
 int
 paxos_retrieve(struct paxos_instance *inst)
+{
+  pax_uuid_t *uuid;
+
+  inst->pi_retrieve = true;
+
+  // Schedule a flush if we don't have one pending.
+  if (!pax->retrieve_pending) {
+    pax->retrieve_pending = true;
+
+    uuid = g_malloc0(sizeof(*uuid));
+    *uuid = *pax->session_id;
+    paxos_idle_add(paxos_retrieve_flush, uuid);
+  }
+
+  // Likewise for a retry.
+  if (!pax->retrieve_retry) {
+    pax->retrieve_retry = true;
+
+    uuid = g_malloc0(sizeof(*uuid));
+    *uuid = *pax->session_id;
+    paxos_timeout_add(RETRIEVE_TIMEOUT, paxos_retrieve_retry, uuid);
+  }
+
+  return 0;
+}
+
+/**
+ * paxos_retrieve_retry - GEvent-friendly routine which retrieves again, from
+ * everyone, every committed request we are still missing.
+ */
+int
+paxos_retrieve_retry(void *data)
+{
+  bool waiting = false;
+  pax_uuid_t *uuid;
+  struct paxos_instance *it;
+
+  // Set the session, which may have ended while we were waiting.
+  uuid = (pax_uuid_t *)data;
+  pax = session_find(&state->sessions, uuid);
+  if (pax == NULL) {
+    g_free(uuid);
+    return FALSE;
+  }
+
+  for (it = pax->istart; it != (void *)&pax->ilist; it = LIST_NEXT(it, pi_le)) {
+    if (!it->pi_committed || it->pi_cached ||
+        !request_needs_cached(it->pi_val.pv_dkind) ||
+        rcache_find(pax, it->pi_val.pv_reqid) != NULL) {
+      continue;
+    }
+    it->pi_retried = true;
+    paxos_retrieve(it);
+    waiting = true;
+  }
+
+  if (!waiting) {
+    pax->retrieve_retry = false;
+    g_free(uuid);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/**
+ * retrieve_target - Pick an acceptor who should have the request for a
+ * given instance, or NULL if we should just broadcast.
+ */
+static struct paxos_acceptor *
+retrieve_target(struct paxos_instance *inst)
+{
+  struct paxos_acceptor *acc;
+
+  // If a targeted retrieve went unanswered, ask everyone.
+  if (inst->pi_retried) {
+    return NULL;
+  }
+
+  // Prefer the request originator, if we are still connected to them.
+  acc = acceptor_find(&pax->alist, inst->pi_val.pv_reqid.id);
+  if (acc != NULL && acc->pa_peer != NULL) {
+    return acc;
+  }
+
+  // Otherwise, ask the proposer, who needed the request in order to decree it.
+  if (!is_proposer() && pax->proposer != NULL &&
+      pax->proposer->pa_peer != NULL) {
+    return pax->proposer;
+  }
+
+  return NULL;
+}
+
+/**
+ * retrieve_batch - Send a single retrieve for all the flagged instances,
+ * starting at first, which share first's retrieve target.
+ */
+static int
+retrieve_batch(struct paxos_instance *first)
 {
   int r;
+  unsigned count;
   struct paxos_header hdr;
   struct paxos_acceptor *acc;
+  struct paxos_instance *it;
   struct paxos_yak py;
 
-  // Initialize a header.  We set ph_inum to the instance number of the
-  // request.
-  header_init(&hdr, OP_RETRIEVE, inst->pi_hdr.ph_inum);
+  acc = retrieve_target(first);
+
+  // Count the instances we'll batch, up to a cap.
+  count = 0;
+  for (it = first; it != (void *)&pax->ilist && count < RETRIEVE_BATCH_MAX;
+      it = LIST_NEXT(it, pi_le)) {
+    if (it->pi_retrieve && retrieve_target(it) == acc) {
+      count++;
+    }
+  }
+
+  // Initialize a header.  We set ph_inum to the lowest instance number in
+  // the batch.
+  header_init(&hdr, OP_RETRIEVE, first->pi_hdr.ph_inum);
 
-  // Pack the retrieve.
+  // Pack our ID and the values of everything we are retrieving.
   paxos_payload_init(&py, 2);
   paxos_header_pack(&py, &hdr);
   paxos_payload_begin_array(&py, 2);
   paxos_paxid_pack(&py, pax->self_id);
-  paxos_value_pack(&py, &inst->pi_val);
+  paxos_payload_begin_array(&py, count);
 
-  // Determine the request originator and send.  If we are no longer connected
-  // to the request originator, broadcast the retrieve instead.
-  acc = acceptor_find(&pax->alist, inst->pi_val.pv_reqid.id);
-  if (acc == NULL || acc->pa_peer == NULL) {
+  for (it = first; count > 0; it = LIST_NEXT(it, pi_le)) {
+    if (it->pi_retrieve && retrieve_target(it) == acc) {
+      paxos_value_pack(&py, &it->pi_val);
+      it->pi_retrieve = false;
+      count--;
+    }
+  }
+
+  if (acc == NULL) {
     r = paxos_broadcast(&py);
   } else {
     r = paxos_send(acc, &py);
@@ -218,17 +736,57 @@ paxos_retrieve(struct paxos_instance *inst)
   return r;
 }
 
+/**
+ * paxos_retrieve_flush - GEvent-friendly routine which sends out all the
+ * retrieves queued up for a session.
+ */
+int
+paxos_retrieve_flush(void *data)
+{
+  int r = 0;
+  pax_uuid_t *uuid;
+  struct paxos_instance *it;
+
+  // Set the session, which may have ended while we were waiting.
+  uuid = (pax_uuid_t *)data;
+  pax = session_find(&state->sessions, uuid);
+  g_free(uuid);
+  if (pax == NULL) {
+    return FALSE;
+  }
+
+  pax->retrieve_pending = false;
+
+  // Everything below our hole has been learned, so all the flagged instances
+  // live at or after istart.  Send a batch for each target until we have
+  // cleared all our flags.
+  it = pax->istart;
+  while (it != (void *)&pax->ilist) {
+    if (it->pi_retrieve) {
+      ERR_ACCUM(r, retrieve_batch(it));
+    } else {
+      it = LIST_NEXT(it, pi_le);
+    }
+  }
+
+  return FALSE;
+}
+
 /**
  * paxos_ack_retrieve - Acknowledge a retrieve.
  *
- * This basically just unpacks and wraps a resend.
+ * We resend all of the requested data that we have in a single message and
+ * ignore the rest; the retriever will be able to find it elsewhere.
  */
-int paxos_ack_retrieve(struct paxos_header *hdr, msgpack_object *o)
+int
+paxos_ack_retrieve(struct paxos_header *hdr, msgpack_object *o)
 {
+  int r = 0;
+  unsigned count;
   paxid_t paxid;
-  msgpack_object *p;
+  msgpack_object *p, *pend;
   struct paxos_value val;
-  struct paxos_request *req;
+  struct paxos_request *req, **reqs;
   struct paxos_acceptor *acc;
 
   // Make sure the payload is well-formed.
@@ -236,21 +794,37 @@ int paxos_ack_retrieve(struct paxos_header *hdr, msgpack_object *o)
   assert(o->via.array.size == 2);
   p = o->via.array.ptr;
 
-  // Unpack the retriever's ID and the value being retrieved.
+  // Unpack the retriever's ID.  If we aren't connected to them as a member
+  // of the alist (e.g., we haven't learned their join yet), just return.
   paxos_paxid_unpack(&paxid, p++);
-  paxos_value_unpack(&val, p++);
-
-  // Retrieve the request.
-  assert(request_needs_cached(val.pv_dkind));
-  req = request_find(&pax->rcache, val.pv_reqid);
-  if (req != NULL) {
-    // If we have the request, look up the recipient and resend.
-    acc = acceptor_find(&pax->alist, paxid);
-    return paxos_resend(acc, hdr, req);
-  } else {
-    // If we don't have the request either, just return.
+  acc = acceptor_find(&pax->alist, paxid);
+  if (acc == NULL || acc->pa_peer == NULL) {
     return 0;
   }
+
+  // Look up every request we were asked for.
+  assert(p->type == MSGPACK_OBJECT_ARRAY);
+  reqs = g_malloc0(p->via.array.size * sizeof(*reqs));
+  pend = p->via.array.ptr + p->via.array.size;
+
+  count = 0;
+  for (p = p->via.array.ptr; p != pend; ++p) {
+    paxos_value_unpack(&val, p);
+    assert(request_needs_cached(val.pv_dkind));
+
+    req = rcache_find(pax, val.pv_reqid);
+    if (req != NULL) {
+      reqs[count++] = req;
+    }
+  }
+
+  // Resend whatever we found.
+  if (count > 0) {
+    r = paxos_resend(acc, hdr, reqs, count);
+  }
+
+  g_free(reqs);
+  return r;
 }
 
 /**
@@ -259,9 +833,10 @@ int paxos_ack_retrieve(struct paxos_header *hdr, msgpack_object *o)
  */
 int
 paxos_resend(struct paxos_acceptor *acc, struct paxos_header *hdr,
-    struct paxos_request *req)
+    struct paxos_request **reqs, unsigned count)
 {
   int r;
+  unsigned i;
   struct paxos_yak py;
 
   // Modify the header.
@@ -270,7 +845,10 @@ paxos_resend(struct paxos_acceptor *acc, struct paxos_header *hdr,
   // Just pack and send the resend.
   paxos_payload_init(&py, 2);
   paxos_header_pack(&py, hdr);
-  paxos_request_pack(&py, req);
+  paxos_payload_begin_array(&py, count);
+  for (i = 0; i < count; ++i) {
+    paxos_request_pack(&py, reqs[i]);
+  }
   r = paxos_send(acc, &py);
   paxos_payload_destroy(&py);
 
@@ -279,39 +857,31 @@ paxos_resend(struct paxos_acceptor *acc, struct paxos_header *hdr,
 
 /**
  * paxos_ack_resend - Receive a resend of request data, and re-commit the
- * instance to which the request belongs.
+ * instances to which the requests belong.
  */
 int
 paxos_ack_resend(struct paxos_header *hdr, msgpack_object *o)
 {
-  struct paxos_instance *inst;
+  msgpack_object *p, *pend;
   struct paxos_request *req;
 
-  // Grab the instance for which we wanted the request.  If we find that it
-  // has already been cached and learned since we began our retrieval, we can
-  // just return.
-  //
-  // Note also that an instance should only be NULL if it was committed and
-  // learned and then truncated in a sync operation.
-  inst = instance_find(&pax->ilist, hdr->ph_inum);
-  if (inst == NULL || inst->pi_cached) {
-    return 0;
-  }
+  // Make sure the payload is well-formed.
+  assert(o->type == MSGPACK_OBJECT_ARRAY);
+  p = o->via.array.ptr;
+  pend = o->via.array.ptr + o->via.array.size;
 
-  // See if we already got the request.  It is possible that we received a
-  // commit message for the instance before the original request broadcast
-  // reached us.  However, since the instance-request mapping is one way, we
-  // wait until a resend is received before committing.
-  req = request_find(&pax->rcache, inst->pi_val.pv_reqid);
-  if (req == NULL) {
-    // Allocate a request and unpack it.
+  // Cache all the requests.  It is possible that we received a commit message
+  // for an instance before the original request broadcast reached us, in
+  // which case we already have the request and can discard the copy.
+  for (; p != pend; ++p) {
     req = g_malloc0(sizeof(*req));
-    paxos_request_unpack(req, o);
-
-    // Insert it to our request cache.
-    request_insert(&pax->rcache, req);
+    paxos_request_unpack(req, p);
+    if (rcache_insert(pax, req) != req) {
+      request_destroy(req);
+    }
   }
 
-  // Commit again, now that we have the associated request.
-  return paxos_commit(inst);
+  // Note that any instance we retrieved for which is not in the ilist must
+  // have been learned and then truncated in a sync operation.
+  return paxos_commit_ready();
 }
@@ -42,10 +42,16 @@ acceptor_retry(paxid_t hole)
  * to an interested acceptor.
  */
 int
-proposer_ack_retry(struct paxos_header *hdr)
+proposer_ack_retry(struct paxos_peer *source, struct paxos_header *hdr)
 {
   struct paxos_instance *inst;
 
+  // If we've already truncated the instance, the retrier fell behind while
+  // we couldn't reach it, and must catch up from a snapshot instead.
+  if (hdr->ph_inum < LIST_FIRST(&pax->ilist)->pi_hdr.ph_inum) {
+    return proposer_snapshot(source);
+  }
+
   // Find the requested instance.
   inst = instance_find(&pax->ilist, hdr->ph_inum);
   assert(inst != NULL);
@@ -73,7 +79,7 @@ proposer_recommit(struct paxos_header *hdr, struct paxos_instance *inst)
   // Pack and send the recommit.
   paxos_payload_init(&py, 2);
   paxos_header_pack(&py, hdr);
-  paxos_value_pack(&py, &(inst->pi_val));
+  paxos_value_pack_inline(&py, &(inst->pi_val));
   r = paxos_broadcast(&py);
   paxos_payload_destroy(&py);
 
@@ -105,7 +111,7 @@ int acceptor_ack_recommit(struct paxos_header *hdr, msgpack_object *o)
   }
 
   // Unpack the value.
-  paxos_value_unpack(&inst->pi_val, o);
+  paxos_value_unpack_inline(&inst->pi_val, o);
 
   // Commit it.
   return paxos_commit(inst);
@@ -0,0 +1,421 @@
+/**
+ * paxos_shard.c - Running sessions across several threads.
+ *
+ * If the client asks for it, we spread our sessions across a number of
+ * shards, each a thread running its own main context with its own copy of
+ * our state; a session belongs to the shard indexed by its UUID modulo the
+ * shard count.  Shards share nothing, so they never need to lock.
+ *
+ * Connections are not shared across shards either.  A connection we make
+ * belongs to the shard that makes it, and carries only that shard's
+ * sessions.  A connection the client hands us is read on the main thread
+ * only until its first message arrives, at which point we pass it to the
+ * shard of the session that message is for.  Since our peers shard their
+ * sessions the same way, every session on a connection will then be ours,
+ * so long as all of us use the same shard count.
+ *
+ * The main thread hosts no sessions once we are sharded.  Clients reach
+ * sessions on the shards through the submission queue, or with
+ * motmot_invoke().
+ *
+ * Every event source we add runs its callback against the state of the
+ * shard which added it, so that the shards of any number of contexts may
+ * share a thread and its main context.
+ */
+
+#include <glib.h>
+
+#include "paxos.h"
+#include "paxos_state.h"
+#include "paxos_util.h"
+#include "containers/list.h"
+
+/* A call into a shard, made on its thread while the caller waits. */
+struct shard_call {
+  struct paxos_shard *sc_shard;         // the shard
+  GSourceFunc sc_func;                  // the call
+  void *sc_arg;                         // its argument
+  bool sc_done;                         // has it returned?
+  GMutex sc_lock;                       // lock protecting sc_done
+  GCond sc_cond;                        // signaled when it returns
+};
+
+/* Arguments of a session start. */
+struct shard_start {
+  pax_uuid_t ss_uuid;                   // UUID of the new session
+  const void *ss_desc;                  // our descriptor
+  size_t ss_size;                       // its size
+  void *ss_data;                        // client data for the session
+  void *ss_session;                     // the new session
+};
+
+/* An event source callback, bound to the state it runs against. */
+struct shard_closure {
+  GSourceFunc cl_func;                  // the callback
+  void *cl_data;                        // its data
+  struct paxos_state *cl_state;         // state to run it against
+  GSource *cl_source;                   // the source
+};
+
+/**
+ * paxos_shard_main - Get the main thread's shard.
+ */
+struct paxos_shard *
+paxos_shard_main(void)
+{
+  return &state->ctx->mc_main;
+}
+
+/**
+ * shard_main - Body of a shard thread.
+ */
+static void *
+shard_main(void *data)
+{
+  struct paxos_shard *shard = data;
+
+  g_main_context_push_thread_default(shard->ps_context);
+
+  // Our state took its configuration from the main thread; set up our own
+  // copies of everything we change.
+  state = shard->ps_state;
+  state->shard = shard;
+  paxos_state_init();
+
+  // Clients can only reach us through our submission queue.
+  if (paxos_submit_init()) {
+    g_critical("shard_main: Could not set up submissions.");
+  }
+
+  g_main_loop_run(shard->ps_loop);
+  return NULL;
+}
+
+/**
+ * paxos_shard_init - Start up n shard threads, and run all sessions started
+ * or joined from here on among them.  This must be called from the main
+ * thread, after everything else is configured.
+ */
+int
+paxos_shard_init(unsigned n)
+{
+  unsigned i;
+  struct motmot_ctx *ctx = state->ctx;
+  struct paxos_shard *shard;
+
+  // We can't move sessions we already have, and our log can only be written
+  // from one thread.
+  if (ctx->mc_shard_count != 0 || n == 0 || !LIST_EMPTY(&state->sessions) ||
+      state->wal.w_dir != NULL) {
+    return 1;
+  }
+
+  ctx->mc_shards = g_malloc0(n * sizeof(*ctx->mc_shards));
+  for (i = 0; i < n; ++i) {
+    shard = &ctx->mc_shards[i];
+    shard->ps_index = i + 1;
+    shard->ps_context = g_main_context_new();
+    shard->ps_loop = g_main_loop_new(shard->ps_context, FALSE);
+    shard->ps_state = g_memdup(state, sizeof(*state));
+  }
+
+  // Publish the shards before any of them can hand a session back to us.
+  ctx->mc_shard_count = n;
+  for (i = 0; i < n; ++i) {
+    shard = &ctx->mc_shards[i];
+    shard->ps_thread = g_thread_new("motmot", shard_main, shard);
+  }
+
+  return 0;
+}
+
+/**
+ * paxos_shard_count - Get the number of shard threads; 0 if we aren't
+ * sharded.
+ */
+unsigned
+paxos_shard_count(void)
+{
+  return state->ctx->mc_shard_count;
+}
+
+/**
+ * paxos_shard_get - Get one of a context's shards by its index.
+ */
+struct paxos_shard *
+paxos_shard_get(struct motmot_ctx *ctx, unsigned index)
+{
+  return (index == 0) ? &ctx->mc_main : &ctx->mc_shards[index - 1];
+}
+
+/**
+ * paxos_shard_route - Get the shard of a context which should run the
+ * session with a given UUID.
+ */
+struct paxos_shard *
+paxos_shard_route(struct motmot_ctx *ctx, pax_uuid_t *uuid)
+{
+  if (ctx->mc_shard_count == 0) {
+    return &ctx->mc_main;
+  }
+  return &ctx->mc_shards[*uuid % ctx->mc_shard_count];
+}
+
+/**
+ * shard_call_run - Make a call on behalf of another thread, and wake it.
+ */
+static int
+shard_call_run(void *data)
+{
+  struct shard_call *sc = data;
+  struct paxos_state *prev;
+
+  prev = state;
+  state = sc->sc_shard->ps_state;
+  sc->sc_func(sc->sc_arg);
+  state = prev;
+
+  g_mutex_lock(&sc->sc_lock);
+  sc->sc_done = true;
+  g_cond_signal(&sc->sc_cond);
+  g_mutex_unlock(&sc->sc_lock);
+
+  return FALSE;
+}
+
+/**
+ * shard_call - Make a call on a shard's thread and wait for it to return.
+ */
+static void
+shard_call(struct paxos_shard *shard, GSourceFunc func, void *arg)
+{
+  struct shard_call sc;
+
+  sc.sc_shard = shard;
+  sc.sc_func = func;
+  sc.sc_arg = arg;
+  sc.sc_done = false;
+  g_mutex_init(&sc.sc_lock);
+  g_cond_init(&sc.sc_cond);
+
+  g_main_context_invoke(shard->ps_context, shard_call_run, &sc);
+
+  g_mutex_lock(&sc.sc_lock);
+  while (!sc.sc_done) {
+    g_cond_wait(&sc.sc_cond, &sc.sc_lock);
+  }
+  g_mutex_unlock(&sc.sc_lock);
+
+  g_mutex_clear(&sc.sc_lock);
+  g_cond_clear(&sc.sc_cond);
+}
+
+/**
+ * shard_start - Start a session on the current shard.
+ */
+static int
+shard_start(void *data)
+{
+  struct shard_start *ss = data;
+
+  ss->ss_session = paxos_start(&ss->ss_uuid, ss->ss_desc, ss->ss_size,
+      ss->ss_data);
+  return FALSE;
+}
+
+/**
+ * paxos_shard_start - Start a session on whichever shard its UUID picks.
+ */
+void *
+paxos_shard_start(const void *desc, size_t size, void *data)
+{
+  struct paxos_shard *shard;
+  struct shard_start ss;
+
+  ss.ss_desc = desc;
+  ss.ss_size = size;
+  ss.ss_data = data;
+
+  // If a shard is starting the session itself, keep it there, since calling
+  // into another shard which might be calling into us would deadlock.
+  pax_uuid_gen(&ss.ss_uuid);
+  if (state->shard != paxos_shard_main()) {
+    while (paxos_shard_route(state->ctx, &ss.ss_uuid) != state->shard) {
+      pax_uuid_gen(&ss.ss_uuid);
+    }
+  }
+
+  shard = paxos_shard_route(state->ctx, &ss.ss_uuid);
+  if (shard == state->shard) {
+    shard_start(&ss);
+  } else {
+    shard_call(shard, shard_start, &ss);
+  }
+
+  return ss.ss_session;
+}
+
+/**
+ * paxos_shard_invoke - Call a function on the thread running a session.
+ */
+int
+paxos_shard_invoke(struct paxos_session *session, GSourceFunc func,
+    void *arg)
+{
+  if (session == NULL) {
+    return 1;
+  }
+
+  g_main_context_invoke(session->shard->ps_context, func, arg);
+  return 0;
+}
+
+/**
+ * shard_closure_run - Run a source callback against its state.
+ */
+static int
+shard_closure_run(void *data)
+{
+  int r;
+  struct shard_closure *cl = data;
+  struct paxos_state *prev;
+
+  prev = state;
+  state = cl->cl_state;
+  r = cl->cl_func(cl->cl_data);
+  state = prev;
+
+  return r;
+}
+
+/**
+ * shard_closure_io - Run an I/O watch callback against its state.
+ */
+static int
+shard_closure_io(GIOChannel *channel, GIOCondition condition, void *data)
+{
+  int r;
+  struct shard_closure *cl = data;
+  struct paxos_state *prev;
+
+  prev = state;
+  state = cl->cl_state;
+  r = ((GIOFunc)cl->cl_func)(channel, condition, cl->cl_data);
+  state = prev;
+
+  return r;
+}
+
+/**
+ * shard_closure_forget - Drop a closure from its state's table of sources.
+ * It is fine to forget a closure more than once.
+ */
+static void
+shard_closure_forget(struct shard_closure *cl)
+{
+  GSList *list, *rest;
+
+  list = g_hash_table_lookup(cl->cl_state->sources, cl->cl_data);
+  rest = g_slist_remove(list, cl);
+  if (rest == list) {
+    return;
+  }
+
+  if (rest == NULL) {
+    g_hash_table_remove(cl->cl_state->sources, cl->cl_data);
+  } else {
+    g_hash_table_insert(cl->cl_state->sources, cl->cl_data, rest);
+  }
+}
+
+/**
+ * shard_closure_free - Free a closure once its source is gone.
+ */
+static void
+shard_closure_free(void *data)
+{
+  shard_closure_forget(data);
+  g_free(data);
+}
+
+/**
+ * shard_attach - Attach a source to the current shard's context.  Its
+ * callback will run against the current state, whichever context's thread
+ * runs it.
+ */
+static unsigned
+shard_attach(GSource *source, GSourceFunc func, void *data, bool io)
+{
+  unsigned id;
+  GSList *list;
+  struct shard_closure *cl;
+
+  cl = g_malloc(sizeof(*cl));
+  cl->cl_func = func;
+  cl->cl_data = data;
+  cl->cl_state = state;
+  cl->cl_source = source;
+
+  list = g_hash_table_lookup(state->sources, data);
+  g_hash_table_insert(state->sources, data, g_slist_prepend(list, cl));
+
+  g_source_set_callback(source,
+      io ? (GSourceFunc)shard_closure_io : shard_closure_run, cl,
+      shard_closure_free);
+  id = g_source_attach(source, state->shard->ps_context);
+  g_source_unref(source);
+
+  return id;
+}
+
+/**
+ * paxos_idle_add - As g_idle_add, on the current shard's context.
+ */
+unsigned
+paxos_idle_add(GSourceFunc func, void *data)
+{
+  return shard_attach(g_idle_source_new(), func, data, false);
+}
+
+/**
+ * paxos_timeout_add - As g_timeout_add, on the current shard's context.
+ */
+unsigned
+paxos_timeout_add(unsigned interval, GSourceFunc func, void *data)
+{
+  return shard_attach(g_timeout_source_new(interval), func, data, false);
+}
+
+/**
+ * paxos_io_add_watch - As g_io_add_watch, on the current shard's context.
+ */
+unsigned
+paxos_io_add_watch(GIOChannel *channel, GIOCondition condition, GIOFunc func,
+    void *data)
+{
+  return shard_attach(g_io_create_watch(channel, condition),
+      (GSourceFunc)func, data, true);
+}
+
+/**
+ * paxos_source_remove_by_user_data - As g_source_remove_by_user_data, for
+ * sources added by the current shard.
+ */
+bool
+paxos_source_remove_by_user_data(void *data)
+{
+  GSList *list;
+  struct shard_closure *cl;
+
+  list = g_hash_table_lookup(state->sources, data);
+  if (list == NULL) {
+    return false;
+  }
+
+  // Forget the closure first: it is freed along with the source, unless the
+  // source is the one running, in which case it outlives this call.
+  cl = list->data;
+  shard_closure_forget(cl);
+  g_source_destroy(cl->cl_source);
+  return true;
+}
@@ -1,24 +1,75 @@
 /**
- * paxos_state.h - Global state of the multi-session Paxos protocol.
+ * paxos_state.h - State of the multi-session Paxos protocol.
  */
 
 #include "paxos.h"
 
+/* A thread running some share of a context's sessions on its own main
+ * context.  The main thread's shard, which runs the context the client gave
+ * us, hosts every session unless we are sharded. */
+struct paxos_shard {
+  unsigned ps_index;                  // our place; 0 for the main thread
+  GThread *ps_thread;                 // the thread; NULL for the main thread
+  GMainContext *ps_context;           // its context; NULL for the default
+  GMainLoop *ps_loop;                 // loop running the context
+  struct paxos_state *ps_state;       // state of the shard's sessions
+  int ps_submit_fd;                   // eventfd signaling new submissions
+  struct paxos_submit *ps_submit_head; // submissions from other threads
+  int ps_io_fd;                       // eventfd signaling input from I/O
+  int ps_io_wake;                     // has ps_io_fd been signaled?
+};
+
 struct paxos_state {
+  struct motmot_ctx *ctx;             // the context this state belongs to
+  struct paxos_shard *shard;          // the shard this state belongs to
   connect_t connect;                  // callback for initiating connections
   enter_t enter;                      // callback for entering chat
   leave_t leave;                      // callback for leaving chat
   struct learn_table learn;           // callbacks for paxos_learn
+  GArray *learned;                    // chats awaiting batch delivery
+  GMainContext *deliver_context;      // where to run callbacks; NULL inline
+  struct deliver_event *deliver_head; // events for the client, newest first
+  struct paxos_options options;       // defaults for new sessions
 
   session_container sessions;         // list of active Paxos sessions
   connect_container *connections;     // hash table of connections
+  struct blob_store blobs;            // large chat payloads
+
+  struct wal wal;                     // write-ahead log of acceptor state
+  GQueue *wal_held;                   // replies awaiting a log sync
+  bool wal_pending;                   // is a log sync scheduled?
+  bool wal_each;                      // sync after every record instead?
+  session_container recovered;        // sessions recovered from the log
+  char *history_dir;                  // where we keep chat histories
+  GHashTable *sources;                // our event sources, by their data
+};
+
+/* An independent instance of the protocol, with its own callbacks, sessions,
+ * and connections.  Nothing is shared between contexts. */
+struct motmot_ctx {
+  struct paxos_state mc_state;        // state of the main thread's shard
+  struct paxos_shard mc_main;         // the main thread's shard
+  struct paxos_shard *mc_shards;      // the shard threads, if any
+  unsigned mc_shard_count;            // number of shard threads
+  struct pio_pool *mc_io;             // the I/O threads, if any
 };
 
-extern struct paxos_state state;
+/**
+ * This variable references the state of the shard the current thread is
+ * running on behalf of.  Each shard has its own state, so that its sessions
+ * never contend with those of any other shard or context.  Entry points from
+ * the client, and callbacks from our event sources, point it at the right
+ * state for the duration of the call.
+ */
+extern __thread struct paxos_state *state;
 
 /**
  * This variable always references the current session from the point of view
- * of the current thread.  If we were multithreading, it would be thread-local,
- * but of course we aren't.
+ * of the current thread.
  */
-extern struct paxos_session *pax;
+extern __thread struct paxos_session *pax;
+
+/* Shard routing. */
+unsigned paxos_shard_count(void);
+struct paxos_shard *paxos_shard_get(struct motmot_ctx *, unsigned);
+struct paxos_shard *paxos_shard_route(struct motmot_ctx *, pax_uuid_t *);
@@ -0,0 +1,298 @@
+/**
+ * paxos_submit.c - Submission of requests from other threads.
+ *
+ * Everything else in Paxos runs on the thread of a session's shard, which
+ * unless we are sharded is the thread of the default main context.  If the
+ * client asks for it, other threads may still send chats and invites, by
+ * pushing them onto the shard's lock-free stack and poking an eventfd which
+ * the shard watches.  The shard then takes the whole stack at once, puts it
+ * back in order, and requests everything on it, batching runs of chats for
+ * the same session into one request.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <glib.h>
+
+#include "paxos.h"
+#include "paxos_state.h"
+#include "paxos_util.h"
+#include "containers/list.h"
+
+/* A request submitted from another thread.  Its data trails the structure,
+ * unless the client handed us its buffer. */
+struct paxos_submit {
+  struct paxos_submit *ps_next;       // next submission on the stack
+  pax_uuid_t ps_session;              // ID of the session to request in
+  dkind_t ps_dkind;                   // decree kind
+  paxid_t ps_extra;                   // extra decree data
+  void *ps_take;                      // the client's buffer, if we took it
+  motmot_release_t ps_release;        // callback to release ps_take
+  void *ps_release_arg;               // argument to ps_release
+  size_t ps_size;                     // size of the data
+  char ps_data[];                     // the data
+};
+
+/**
+ * submit_new - Make a submission with room for len bytes of data.
+ */
+static struct paxos_submit *
+submit_new(pax_uuid_t uuid, dkind_t dkind, paxid_t extra, size_t len)
+{
+  struct paxos_submit *ps;
+
+  ps = g_malloc(sizeof(*ps) + len);
+  ps->ps_next = NULL;
+  ps->ps_session = uuid;
+  ps->ps_dkind = dkind;
+  ps->ps_extra = extra;
+  ps->ps_take = NULL;
+  ps->ps_release = NULL;
+  ps->ps_release_arg = NULL;
+  ps->ps_size = len;
+  return ps;
+}
+
+/**
+ * submit_run - Request everything in a list of submissions, in order, and
+ * free them.  We find sessions by ID, since a session which ended after
+ * something was submitted for it may since have been freed.
+ */
+static void
+submit_run(struct paxos_submit *ps)
+{
+  size_t n;
+  struct paxos_submit *end, *next;
+  struct paxos_session *session;
+  struct iovec *iov;
+
+  while (ps != NULL) {
+    // Find the run of copied chats for the same session starting here.
+    n = 0;
+    for (end = ps; end != NULL && end->ps_session == ps->ps_session &&
+        end->ps_dkind == DEC_CHAT && end->ps_take == NULL;
+        end = end->ps_next) {
+      n++;
+    }
+
+    // If the session has ended, the requests below fail, releasing any
+    // buffer we took.
+    session = session_find(&state->sessions, &ps->ps_session);
+    if (ps->ps_take != NULL) {
+      end = ps->ps_next;
+      paxos_request_take(session, ps->ps_take, ps->ps_size, ps->ps_release,
+          ps->ps_release_arg);
+    } else if (n > 1 && session != NULL) {
+      iov = g_malloc(n * sizeof(*iov));
+      for (n = 0, next = ps; next != end; next = next->ps_next, ++n) {
+        iov[n].iov_base = next->ps_data;
+        iov[n].iov_len = next->ps_size;
+      }
+      paxos_requestv(session, iov, n);
+      g_free(iov);
+    } else {
+      end = ps->ps_next;
+      paxos_request(session, ps->ps_dkind, ps->ps_extra, ps->ps_data,
+          ps->ps_size);
+    }
+
+    for (; ps != end; ps = next) {
+      next = ps->ps_next;
+      g_free(ps);
+    }
+  }
+}
+
+/**
+ * paxos_submit_drain - Take everything submitted so far and request it.
+ */
+static int
+paxos_submit_drain(GIOChannel *channel, GIOCondition condition, void *data)
+{
+  uint64_t count;
+  struct paxos_shard *shard = state->shard;
+  struct paxos_submit *head, *ps, *prev;
+
+  // Reset the eventfd before taking the stack, so that a submission which
+  // misses this drain wakes us again.
+  if (read(shard->ps_submit_fd, &count, sizeof(count)) != sizeof(count)) {
+    return TRUE;
+  }
+
+  do {
+    head = g_atomic_pointer_get(&shard->ps_submit_head);
+  } while (!g_atomic_pointer_compare_and_exchange(&shard->ps_submit_head,
+        head, NULL));
+
+  // The stack is newest first, so reverse it.
+  prev = NULL;
+  while (head != NULL) {
+    ps = head;
+    head = ps->ps_next;
+    ps->ps_next = prev;
+    prev = ps;
+  }
+
+  submit_run(prev);
+  return TRUE;
+}
+
+/**
+ * paxos_submit_init - Accept submissions from other threads.  This must be
+ * called from the thread running the current shard.
+ */
+int
+paxos_submit_init(void)
+{
+  GIOChannel *channel;
+  struct paxos_shard *shard = state->shard;
+
+  if (shard->ps_submit_fd > 0) {
+    return 1;
+  }
+
+  shard->ps_submit_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (shard->ps_submit_fd < 0) {
+    shard->ps_submit_fd = 0;
+    return 1;
+  }
+
+  channel = g_io_channel_unix_new(shard->ps_submit_fd);
+  paxos_io_add_watch(channel, G_IO_IN, paxos_submit_drain, NULL);
+  g_io_channel_unref(channel);
+
+  return 0;
+}
+
+/**
+ * submit_shard - Get the shard to submit a request for a session to, or NULL
+ * if we should request it directly, because either the shard accepts no
+ * submissions or this thread runs it.
+ */
+static struct paxos_shard *
+submit_shard(pax_uuid_t uuid)
+{
+  struct paxos_shard *shard;
+
+  shard = paxos_shard_route(state->ctx, &uuid);
+  if (shard->ps_submit_fd <= 0 || g_main_context_is_owner(shard->ps_context)) {
+    return NULL;
+  }
+  return shard;
+}
+
+/**
+ * submit_push - Push a chain of submissions, linked newest first from top
+ * down to bottom, onto a shard's stack, and wake the shard if need be.
+ */
+static void
+submit_push(struct paxos_shard *shard, struct paxos_submit *top,
+    struct paxos_submit *bottom)
+{
+  uint64_t one = 1;
+  struct paxos_submit *head;
+
+  do {
+    head = g_atomic_pointer_get(&shard->ps_submit_head);
+    bottom->ps_next = head;
+  } while (!g_atomic_pointer_compare_and_exchange(&shard->ps_submit_head,
+        head, top));
+
+  // Only the submission which finds the stack empty needs to wake the shard;
+  // the rest will be taken along with it.
+  if (head == NULL && write(shard->ps_submit_fd, &one, sizeof(one)) !=
+      sizeof(one)) {
+    g_warning("submit_push: Could not wake the session's shard.");
+  }
+}
+
+/**
+ * paxos_submit - Make a request in the session with the given ID, or submit
+ * it to the session's shard if we're on some other thread.  We take the ID
+ * rather than the session, since the session may be destroyed by its shard
+ * while another thread is looking at it.
+ */
+int
+paxos_submit(pax_uuid_t uuid, dkind_t dkind, paxid_t extra, const void *msg,
+    size_t len)
+{
+  struct paxos_shard *shard;
+  struct paxos_submit *ps;
+
+  shard = submit_shard(uuid);
+  if (shard == NULL) {
+    return paxos_request(session_find(&state->sessions, &uuid), dkind, extra,
+        msg, len);
+  }
+
+  ps = submit_new(uuid, dkind, extra, len);
+  memcpy(ps->ps_data, msg, len);
+  submit_push(shard, ps, ps);
+  return 0;
+}
+
+/**
+ * paxos_submit_take - Request a chat without copying it, as with
+ * paxos_request_take(), or submit it if we're on some other thread.  The
+ * buffer is released once the chat has been requested or dropped.
+ */
+int
+paxos_submit_take(pax_uuid_t uuid, void *msg, size_t len,
+    motmot_release_t release, void *arg)
+{
+  struct paxos_shard *shard;
+  struct paxos_submit *ps;
+
+  shard = submit_shard(uuid);
+  if (shard == NULL) {
+    return paxos_request_take(session_find(&state->sessions, &uuid), msg, len,
+        release, arg);
+  }
+
+  ps = submit_new(uuid, DEC_CHAT, 0, 0);
+  ps->ps_take = msg;
+  ps->ps_release = release;
+  ps->ps_release_arg = arg;
+  ps->ps_size = len;
+  submit_push(shard, ps, ps);
+  return 0;
+}
+
+/**
+ * paxos_submitv - Request several chats, as with paxos_requestv(), or submit
+ * them if we're on some other thread.  We push them all at once, so that the
+ * shard takes them together and requests them in a single batch.
+ */
+int
+paxos_submitv(pax_uuid_t uuid, const struct iovec *iov, size_t n)
+{
+  size_t i;
+  struct paxos_shard *shard;
+  struct paxos_submit *ps, *top, *bottom;
+
+  shard = submit_shard(uuid);
+  if (shard == NULL) {
+    return paxos_requestv(session_find(&state->sessions, &uuid), iov, n);
+  }
+  if (n == 0) {
+    return 0;
+  }
+
+  // Link the chain newest first, as it will sit on the stack.
+  top = bottom = NULL;
+  for (i = 0; i < n; ++i) {
+    ps = submit_new(uuid, DEC_CHAT, 0, iov[i].iov_len);
+    memcpy(ps->ps_data, iov[i].iov_base, iov[i].iov_len);
+    ps->ps_next = top;
+    top = ps;
+    if (bottom == NULL) {
+      bottom = ps;
+    }
+  }
+
+  submit_push(shard, top, bottom);
+  return 0;
+}
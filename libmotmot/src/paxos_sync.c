@@ -16,6 +16,44 @@
 #include "containers/list.h"
 
 #define SYNC_SKIP_THRESH  30
+#define TRUNCATE_BUDGET   1024
+
+/**
+ * paxos_sync_schedule - Decide when to next sync, after a learn.
+ *
+ * If we are the proposer and have let too many instances or too many bytes
+ * of requests pile up since the last sync, we sync right away.  Otherwise,
+ * we make sure a sync timer is armed.  The timer disarms itself once there
+ * is nothing left to sync, so idle sessions don't keep waking us up.
+ */
+void
+paxos_sync_schedule(void)
+{
+  pax_uuid_t *uuid;
+
+  if (!is_proposer() || pax->ihole - 1 == pax->sync_prev) {
+    return;
+  }
+
+  // Sync now if we've crossed a threshold.  Any sync still outstanding is
+  // left to the timer, which will retry it if it stalls.
+  if (pax->sync == NULL &&
+      ((pax->options.po_sync_count != 0 &&
+        pax->ihole - 1 - pax->sync_prev >= pax->options.po_sync_count) ||
+       (pax->options.po_sync_bytes != 0 &&
+        pax->rcache_bytes >= pax->options.po_sync_bytes))) {
+    proposer_sync();
+  }
+
+  // Arm the timer if it isn't already.
+  if (!pax->sync_armed) {
+    pax->sync_armed = true;
+
+    uuid = g_malloc0(sizeof(*uuid));
+    *uuid = *pax->session_id;
+    paxos_timeout_add(pax->options.po_sync_delay, paxos_sync, uuid);
+  }
+}
 
 /**
  * paxos_sync - GEvent-friendly wrapper around proposer_sync.
@@ -24,24 +62,39 @@ int paxos_sync(void *data)
 {
   pax_uuid_t *uuid;
 
-  // Set the session.  We parametrize paxos_sync with a pointer to a session
-  // ID when we add it to the main event loop.
+  // Set the session, which may have ended while we were waiting.  We
+  // parametrize paxos_sync with a pointer to a session ID when we add it to
+  // the main event loop.
   uuid = (pax_uuid_t *)data;
-  pax = session_find(&state.sessions, uuid);
+  pax = session_find(&state->sessions, uuid);
+  if (pax == NULL) {
+    g_free(uuid);
+    return FALSE;
+  }
 
   if (is_proposer()) {
     proposer_sync();
+
+    // Keep ticking for as long as we have something left to sync.
+    if (pax->sync != NULL || pax->ihole - 1 != pax->sync_prev) {
+      return TRUE;
+    }
   }
 
-  return TRUE;
+  // Otherwise, disarm; we'll be rearmed by our next learn as the proposer.
+  pax->sync_armed = false;
+  g_free(uuid);
+  return FALSE;
 }
 
 /**
- * proposer_sync - Send a sync command to all acceptors.
+ * proposer_sync - Send a sync command to all live acceptors.
  *
- * For a sync to succeed, all acceptors need to tell us the instance number
- * of their last contiguous learn.  We take the minimum of these values
- * and then command everyone to truncate everything before this minimum.
+ * For a sync to succeed, all the acceptors we can reach need to tell us the
+ * instance number of their last contiguous learn.  We take the minimum of
+ * these values and then command everyone to truncate everything before this
+ * minimum.  Acceptors we can't reach don't hold us up; if they come back
+ * having missed part of the log, they catch up from a snapshot.
  */
 int
 proposer_sync()
@@ -55,11 +108,6 @@ proposer_sync()
     return 1;
   }
 
-  // If not everyone is live, we should delay syncing.
-  if (pax->live_count != LIST_COUNT(&pax->alist)) {
-    return 1;
-  }
-
   // If our local last contiguous learn is the same as the previous sync
   // point, we don't need to sync.
   if (pax->ihole - 1 == pax->sync_prev) {
@@ -78,7 +126,7 @@ proposer_sync()
 
   // Create a new sync.
   pax->sync = g_malloc0(sizeof(*(pax->sync)));
-  pax->sync->ps_total = LIST_COUNT(&pax->alist);
+  pax->sync->ps_total = pax->live_count;
   pax->sync->ps_acks = 1;  // Including ourselves.
   pax->sync->ps_skips = 0;
   pax->sync->ps_last = 0;
@@ -165,29 +213,121 @@ proposer_ack_last(struct paxos_header *hdr, msgpack_object *o)
 /**
  * Truncate an ilist up to (but not including) a given inum.
  *
- * We also free all associated requests.
+ * We also free all associated requests, each of which we find by its ID in
+ * constant time.  We free at most budget instances, returning true if there
+ * are more to go.
  */
-static void
-ilist_truncate_prefix(instance_container *ilist, paxid_t inum)
+static bool
+ilist_truncate_prefix(instance_container *ilist, paxid_t inum,
+    unsigned budget)
 {
+  struct paxos_acceptor *acc;
   struct paxos_instance *it;
   struct paxos_request *req;
 
+  // Don't truncate past anything we are still streaming to a new acceptor.
+  LIST_FOREACH(acc, &pax->alist, pa_le) {
+    if (acc->pa_backfill != NULL && acc->pa_backfill->pi_hdr.ph_inum < inum) {
+      inum = acc->pa_backfill->pi_hdr.ph_inum;
+    }
+  }
+  LIST_FOREACH(acc, &pax->adefer, pa_le) {
+    if (acc->pa_backfill != NULL && acc->pa_backfill->pi_hdr.ph_inum < inum) {
+      inum = acc->pa_backfill->pi_hdr.ph_inum;
+    }
+  }
+
   for (it = LIST_FIRST(ilist); it != (void *)ilist; it = LIST_FIRST(ilist)) {
     // Break if we've hit the desired stopping point.
     if (it->pi_hdr.ph_inum >= inum) {
       break;
     }
 
+    // Yield if we've used up our budget.
+    if (budget-- == 0) {
+      return true;
+    }
+
     // Free the instance and its associated request.
-    req = request_find(&pax->rcache, it->pi_val.pv_reqid);
+    req = rcache_find(pax, it->pi_val.pv_reqid);
     if (req != NULL) {
-      LIST_REMOVE(&pax->rcache, req, pr_le);
+      pax->rcache_bytes -= MIN(req->pr_size, pax->rcache_bytes);
+
+      // Everyone has learned our large chats now, so we needn't keep them.
+      if (req->pr_val.pv_dkind == DEC_CHAT &&
+          (req->pr_val.pv_extra & CHAT_BLOB) &&
+          req->pr_val.pv_reqid.id == pax->self_id) {
+        blob_store_unpin(&state->blobs, req->pr_data);
+      }
+      rcache_remove(pax, req);
       request_destroy(req);
     }
     LIST_REMOVE(ilist, it, pi_le);
     instance_destroy(it);
   }
+
+  return false;
+}
+
+/**
+ * paxos_truncate - GEvent-friendly routine which frees a slice of the prefix
+ * of our ilist below ibase.
+ *
+ * After a long stall, a truncate may cover a great many instances.  Rather
+ * than freeing them all at once and holding up every session, we free them
+ * a budgeted slice per main loop iteration.  We run at default priority,
+ * since a busy loop may never go idle, and the prefix must still be freed.
+ *
+ * We time each slice, and report the longest once the truncate is done, as
+ * a debug message.
+ */
+int
+paxos_truncate(void *data)
+{
+  bool more;
+  gint64 start;
+  pax_uuid_t *uuid;
+
+  // Set the session, which may have ended while we were waiting.
+  uuid = (pax_uuid_t *)data;
+  pax = session_find(&state->sessions, uuid);
+  if (pax == NULL) {
+    g_free(uuid);
+    return FALSE;
+  }
+
+  start = g_get_monotonic_time();
+  more = ilist_truncate_prefix(&pax->ilist, pax->ibase, TRUNCATE_BUDGET);
+  pax->truncate_stall = MAX(pax->truncate_stall,
+      g_get_monotonic_time() - start);
+  if (more) {
+    return TRUE;
+  }
+
+  g_debug("paxos_truncate: Longest slice took %" G_GINT64_FORMAT "us.",
+      pax->truncate_stall);
+  pax->truncate_stall = 0;
+  pax->truncate_pending = false;
+  g_free(uuid);
+  return FALSE;
+}
+
+/**
+ * truncate_schedule - Start freeing everything below ibase, if we aren't
+ * already.
+ */
+static void
+truncate_schedule(void)
+{
+  pax_uuid_t *uuid;
+
+  if (!pax->truncate_pending) {
+    pax->truncate_pending = true;
+
+    uuid = g_malloc0(sizeof(*uuid));
+    *uuid = *pax->session_id;
+    paxos_timeout_add(0, paxos_truncate, uuid);
+  }
 }
 
 /**
@@ -212,6 +352,7 @@ proposer_truncate(struct paxos_header *hdr)
   // at least one committed instance.
   assert(pax->sync->ps_last >= pax->ibase);
   pax->ibase = pax->sync->ps_last;
+  paxos_wal_truncate();
 
   // Modify the header.
   hdr->ph_opcode = OP_TRUNCATE;
@@ -229,7 +370,7 @@ proposer_truncate(struct paxos_header *hdr)
   }
 
   // Do the truncate (< pax->ibase).
-  ilist_truncate_prefix(&pax->ilist, pax->ibase);
+  truncate_schedule();
 
   // End the sync.
   g_free(pax->sync);
@@ -241,11 +382,227 @@ proposer_truncate(struct paxos_header *hdr)
 int
 acceptor_ack_truncate(struct paxos_header *hdr, msgpack_object *o)
 {
-  // Unpack the new ibase.
+  // Unpack the new ibase.  If we were out of touch during the sync, we may
+  // not have learned that far; keep everything we haven't learned, and
+  // we'll catch up from a snapshot when we retry.
   paxos_paxid_unpack(&pax->ibase, o);
+  if (pax->ibase > pax->ihole - 1) {
+    pax->ibase = pax->ihole - 1;
+  }
+  paxos_wal_truncate();
 
   // Do the truncate (< pax->ibase).
-  ilist_truncate_prefix(&pax->ilist, pax->ibase);
+  truncate_schedule();
 
   return 0;
 }
+
+/**
+ * proposer_snapshot - Send an acceptor who has fallen behind our truncation
+ * point everything it needs to resume learning from our last learn.
+ *
+ * Our last learn is never truncated, since truncation respects our own
+ * learns.
+ */
+int
+proposer_snapshot(struct paxos_peer *source)
+{
+  int r;
+  struct paxos_header hdr;
+  struct paxos_acceptor *acc;
+  struct paxos_instance *inst;
+  struct paxos_yak py;
+
+  inst = instance_find(&pax->ilist, pax->ihole - 1);
+  assert(inst != NULL && inst->pi_learned);
+
+  // Initialize a header.  We pass the instance number of the snapshot.
+  header_init(&hdr, OP_SNAPSHOT, inst->pi_hdr.ph_inum);
+
+  // Pack the alist as of our last learn, followed by the instance itself.
+  paxos_payload_init(&py, 2);
+  paxos_header_pack(&py, &hdr);
+  paxos_payload_begin_array(&py, 2);
+  paxos_payload_begin_array(&py, LIST_COUNT(&pax->alist));
+  LIST_FOREACH(acc, &pax->alist, pa_le) {
+    paxos_acceptor_pack(&py, acc);
+  }
+  paxos_instance_pack(&py, inst);
+
+  r = paxos_peer_send(source, paxos_payload_data(&py), paxos_payload_size(&py));
+  paxos_payload_destroy(&py);
+
+  return r;
+}
+
+/**
+ * ilist_streaming - Check whether we are streaming our ilist to anyone.
+ */
+static bool
+ilist_streaming(void)
+{
+  struct paxos_acceptor *acc;
+
+  LIST_FOREACH(acc, &pax->alist, pa_le) {
+    if (acc->pa_backfill != NULL) {
+      return true;
+    }
+  }
+  LIST_FOREACH(acc, &pax->adefer, pa_le) {
+    if (acc->pa_backfill != NULL) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/**
+ * acceptor_ack_snapshot - Skip ahead to the proposer's last learn.
+ *
+ * We can no longer learn the instances we missed, so we take on the
+ * proposer's alist wholesale, telling our client about any joins and parts
+ * along the way, and resume learning from the snapshot instance.  Chats in
+ * the gap are lost to us.
+ */
+int
+acceptor_ack_snapshot(struct paxos_header *hdr, msgpack_object *o)
+{
+  int r = 0;
+  msgpack_object *arr, *p, *pend;
+  acceptor_container snap;
+  struct paxos_acceptor *acc, *next, *old;
+  struct paxos_instance *inst, *it;
+
+  // Ignore stale snapshots.  We also hold off while anything is streaming
+  // into or out of our ilist, unless we are resuming; we'll get another
+  // snapshot when we next retry.
+  if (hdr->ph_inum < pax->ihole || ilist_streaming() ||
+      (pax->backfill != NULL && !pax->backfill->pb_resume)) {
+    return 0;
+  }
+
+  // Make sure the payload is well-formed.
+  assert(o->type == MSGPACK_OBJECT_ARRAY);
+  assert(o->via.array.size == 2);
+  arr = o->via.array.ptr;
+  assert(arr[0].type == MSGPACK_OBJECT_ARRAY);
+
+  // Unpack the proposer's alist.
+  LIST_INIT(&snap);
+  p = arr[0].via.array.ptr;
+  pend = arr[0].via.array.ptr + arr[0].via.array.size;
+  for (; p != pend; ++p) {
+    acc = g_malloc0(sizeof(*acc));
+    paxos_acceptor_unpack(acc, p);
+    LIST_INSERT_TAIL(&snap, acc, pa_le);
+  }
+
+  // Part everyone who left while we were away.  If that includes us, leave
+  // the protocol.
+  for (acc = LIST_FIRST(&pax->alist); acc != (void *)&pax->alist;
+      acc = next) {
+    next = LIST_NEXT(acc, pa_le);
+    if (acceptor_find(&snap, acc->pa_paxid) != NULL) {
+      continue;
+    }
+
+    paxos_deliver_learn(state->learn.part, acc->pa_desc, acc->pa_size,
+        acc->pa_desc, acc->pa_size, pax->client_data);
+
+    if (acc->pa_paxid == pax->self_id) {
+      acceptor_container_destroy(&snap);
+      return paxos_end(pax);
+    }
+
+    LIST_REMOVE(&pax->alist, acc, pa_le);
+    if (acc->pa_peer != NULL) {
+      pax->live_count--;
+    }
+    acceptor_destroy(acc);
+  }
+
+  // Join everyone who arrived while we were away, picking up any hellos
+  // we deferred for them.
+  LIST_WHILE_FIRST(acc, &snap) {
+    LIST_REMOVE(&snap, acc, pa_le);
+
+    old = acceptor_find(&pax->alist, acc->pa_paxid);
+    if (old != NULL) {
+      old->pa_learner = acc->pa_learner;
+      acceptor_destroy(acc);
+      continue;
+    }
+
+    old = acceptor_find(&pax->adefer, acc->pa_paxid);
+    if (old != NULL) {
+      LIST_REMOVE(&pax->adefer, old, pa_le);
+      acc->pa_peer = old->pa_peer;
+      old->pa_peer = NULL;
+      acceptor_destroy(old);
+      pax->live_count++;
+    }
+    acceptor_insert(&pax->alist, acc);
+
+    paxos_deliver_learn(state->learn.join, acc->pa_desc, acc->pa_size,
+        acc->pa_desc, acc->pa_size, pax->client_data);
+  }
+
+  // Redo our membership accounting.
+  pax->learner_count = 0;
+  LIST_FOREACH(acc, &pax->alist, pa_le) {
+    if (acc->pa_learner) {
+      pax->learner_count++;
+    }
+  }
+  pax->learner = acceptor_find(&pax->alist, pax->self_id)->pa_learner;
+  quorum_validate();
+  paxos_wal_members();
+  reset_proposer();
+
+  // Install the snapshot instance, which is committed and learned by
+  // everyone, as our new base, and truncate everything before it.
+  inst = g_malloc0(sizeof(*inst));
+  paxos_instance_unpack(inst, &arr[1]);
+  assert(inst->pi_hdr.ph_inum == hdr->ph_inum);
+  assert(inst->pi_committed);
+
+  it = instance_find(&pax->ilist, inst->pi_hdr.ph_inum);
+  if (it != NULL) {
+    memcpy(&it->pi_hdr, &inst->pi_hdr, sizeof(inst->pi_hdr));
+    memcpy(&it->pi_val, &inst->pi_val, sizeof(inst->pi_val));
+    it->pi_committed = true;
+    instance_destroy(inst);
+    inst = it;
+  } else {
+    instance_insert(&pax->ilist, inst);
+  }
+  inst->pi_cached = true;
+  inst->pi_learned = true;
+
+  pax->ibase = inst->pi_hdr.ph_inum;
+  pax->ihole = pax->ibase + 1;
+  pax->istart = inst;
+  paxos_wal_instance(inst);
+  paxos_wal_truncate();
+  truncate_schedule();
+
+  // If we were resuming, the proposer has now taken us back.
+  if (pax->backfill != NULL) {
+    acceptor_resume_ballot(hdr);
+    g_free(pax->backfill);
+    pax->backfill = NULL;
+  }
+
+  // Connect to anyone we're missing, then learn onward as far as we can,
+  // retrying our new hole if necessary.
+  ERR_ACCUM(r, acceptor_connect_neighbors());
+  for (it = LIST_NEXT(inst, pi_le); it != (void *)&pax->ilist;
+      it = LIST_NEXT(it, pi_le)) {
+    if (it->pi_committed && it->pi_cached) {
+      return r | paxos_commit(it);
+    }
+  }
+
+  return r;
+}
@@ -32,13 +32,19 @@ is_proposer()
 
 /**
  * reset_proposer - Realias the proposer after an update to the acceptor list.
+ * Learners are never proposers, so a learner with no live voters is left
+ * with no proposer at all until one reconnects.
  */
 void
 reset_proposer()
 {
   struct paxos_acceptor *it;
 
+  pax->proposer = NULL;
   LIST_FOREACH(it, &pax->alist, pa_le) {
+    if (it->pa_learner) {
+      continue;
+    }
     if (it->pa_paxid == pax->self_id || it->pa_peer != NULL) {
       pax->proposer = it;
       break;
@@ -57,11 +63,125 @@ next_instance()
 
 /**
  * majority - Get the minimum number of acceptors needed in a simple majority.
+ * Only voters count.
  */
 unsigned
 majority()
 {
-  return (LIST_COUNT(&pax->alist) / 2) + 1;
+  return ((LIST_COUNT(&pax->alist) - pax->learner_count) / 2) + 1;
+}
+
+/**
+ * accept_quorum - Get the number of votes needed to commit a decree.
+ */
+unsigned
+accept_quorum()
+{
+  unsigned voters, q;
+
+  voters = LIST_COUNT(&pax->alist) - pax->learner_count;
+  q = pax->options.po_quorum[1];
+
+  if (q == 0) {
+    return majority();
+  }
+  return (q < voters) ? q : voters;
+}
+
+/**
+ * prepare_quorum - Get the number of promises needed to prepare.
+ *
+ * Every prepare quorum must intersect every accept quorum, so we never
+ * return less than the number of voters outside some accept quorum.
+ */
+unsigned
+prepare_quorum()
+{
+  unsigned voters, q, min;
+
+  voters = LIST_COUNT(&pax->alist) - pax->learner_count;
+  q = pax->options.po_quorum[0];
+  min = voters - accept_quorum() + 1;
+
+  if (q == 0) {
+    q = majority();
+  } else if (q > voters) {
+    q = voters;
+  }
+  return (q < min) ? min : q;
+}
+
+/**
+ * quorum_validate - Check our configured quorums against the membership,
+ * warning if they no longer intersect.  Called on membership changes.
+ *
+ * Quorums larger than the voter set are expected while a room fills up, so
+ * we don't warn about those.
+ */
+void
+quorum_validate()
+{
+  unsigned voters, q;
+
+  voters = LIST_COUNT(&pax->alist) - pax->learner_count;
+  q = pax->options.po_quorum[0];
+
+  if (q != 0 && q < voters && prepare_quorum() > q) {
+    g_warning("quorum_validate: Prepare quorum raised from %u to %u of %u.",
+        q, prepare_quorum(), voters);
+  }
+}
+
+/**
+ * live_voters - Count the voters we think are live, including ourselves.
+ */
+unsigned
+live_voters()
+{
+  unsigned count = 0;
+  struct paxos_acceptor *acc;
+
+  LIST_FOREACH(acc, &pax->alist, pa_le) {
+    if (!acc->pa_learner &&
+        (acc->pa_peer != NULL || acc->pa_paxid == pax->self_id)) {
+      count++;
+    }
+  }
+
+  return count;
+}
+
+/**
+ * star_neighbor - Check whether we should hold a connection to an acceptor.
+ *
+ * In star mode, we connect only to the first few voters of the alist: the
+ * proposer and the successors who would take over from it.  Everyone
+ * connects to these, so whoever is next in line can reach everyone.
+ */
+bool
+star_neighbor(struct paxos_acceptor *acc)
+{
+  unsigned rank = 0;
+  struct paxos_acceptor *it;
+
+  if (pax->options.po_star == 0) {
+    return true;
+  }
+  if (acc->pa_learner) {
+    return false;
+  }
+
+  LIST_FOREACH(it, &pax->alist, pa_le) {
+    if (it->pa_learner) {
+      continue;
+    }
+    if (it == acc) {
+      return rank <= pax->options.po_star;
+    }
+    rank++;
+  }
+
+  return false;
 }
 
 /**
@@ -95,9 +215,57 @@ instance_insert_and_upstart(struct paxos_instance *inst)
   }
 }
 
+/**
+ * paxos_value_pack_inline - Pack a value for a decree or commit.  If the value
+ * is an inline chat and we have its request, pack the whole request instead.
+ */
+void
+paxos_value_pack_inline(struct paxos_yak *py, struct paxos_value *val)
+{
+  struct paxos_request *req = NULL;
+
+  if (val->pv_dkind == DEC_CHAT && (val->pv_extra & CHAT_INLINE)) {
+    req = rcache_find(pax, val->pv_reqid);
+  }
+
+  if (req != NULL) {
+    paxos_request_pack(py, req);
+  } else {
+    paxos_value_pack(py, val);
+  }
+}
+
+/**
+ * paxos_value_unpack_inline - Unpack a value packed by
+ * paxos_value_pack_inline, caching the request if it was sent along.
+ */
+void
+paxos_value_unpack_inline(struct paxos_value *val, msgpack_object *o)
+{
+  struct paxos_request *req;
+
+  assert(o->type == MSGPACK_OBJECT_ARRAY && o->via.array.size > 0);
+
+  // A bare value starts with its dkind; a request starts with its value.
+  if (o->via.array.ptr->type != MSGPACK_OBJECT_ARRAY) {
+    paxos_value_unpack(val, o);
+    return;
+  }
+
+  req = g_malloc0(sizeof(*req));
+  paxos_request_unpack(req, o);
+  memcpy(val, &req->pr_val, sizeof(*val));
+
+  if (rcache_insert(pax, req) != req) {
+    request_destroy(req);
+  }
+}
+
 /**
  * paxos_broadcast_instance - Pack the header and value of an instance and
- * broadcast.
+ * broadcast.  Learners don't vote, so decrees go only to voters, unless we
+ * are relaying, in which case everyone forwards.  Acceptors in a star don't
+ * hold the connections to relay, so we always send directly.
  */
 int
 paxos_broadcast_instance(struct paxos_instance *inst)
@@ -105,10 +273,18 @@ paxos_broadcast_instance(struct paxos_instance *inst)
   int r;
   struct paxos_yak py;
 
+  if (pax->options.po_fanout != 0 && pax->options.po_star == 0) {
+    return paxos_relay_instance(inst);
+  }
+
   paxos_payload_init(&py, 2);
   paxos_header_pack(&py, &(inst->pi_hdr));
-  paxos_value_pack(&py, &(inst->pi_val));
-  r = paxos_broadcast(&py);
+  paxos_value_pack_inline(&py, &(inst->pi_val));
+  if (inst->pi_hdr.ph_opcode == OP_DECREE) {
+    r = paxos_broadcast_voters(&py);
+  } else {
+    r = paxos_broadcast(&py);
+  }
   paxos_payload_destroy(&py);
 
   return r;
@@ -188,3 +364,23 @@ paxos_broadcast(struct paxos_yak *py)
 
   return r;
 }
+
+/**
+ * Broadcast a message to all voting acceptors.
+ */
+int
+paxos_broadcast_voters(struct paxos_yak *py)
+{
+  int r = 0;
+  struct paxos_acceptor *acc;
+
+  LIST_FOREACH(acc, &(pax->alist), pa_le) {
+    if (acc->pa_peer == NULL || acc->pa_learner) {
+      continue;
+    }
+
+    ERR_ACCUM(r, paxos_send(acc, py));
+  }
+
+  return r;
+}
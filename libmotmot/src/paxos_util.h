@@ -15,21 +15,39 @@
 #define ERR_ACCUM(r, cmd) \
   (r) = (r) | (cmd);
 
+/* Count dead voters towards a tally of rejects or redirects. */
+#define DEATH_ADJUSTED(n) \
+  ((n) + (LIST_COUNT(&pax->alist) - pax->learner_count - live_voters()))
+
 /* Convenience functions. */
 inline int is_proposer(void);
 inline void reset_proposer(void);
 inline paxid_t next_instance(void);
 inline int request_needs_cached(dkind_t dkind);
 unsigned majority(void);
+unsigned accept_quorum(void);
+unsigned prepare_quorum(void);
+void quorum_validate(void);
+unsigned live_voters(void);
+bool star_neighbor(struct paxos_acceptor *);
 
 /* Protocol utilities. */
 void instance_insert_and_upstart(struct paxos_instance *);
+void paxos_value_pack_inline(struct paxos_yak *, struct paxos_value *);
+void paxos_value_unpack_inline(struct paxos_value *, msgpack_object *);
 int paxos_broadcast_instance(struct paxos_instance *);
 int proposer_decree_part(struct paxos_acceptor *, int force);
 
+/* Main loop wrappers, which use the current shard's context. */
+unsigned paxos_idle_add(GSourceFunc, void *);
+unsigned paxos_timeout_add(unsigned, GSourceFunc, void *);
+unsigned paxos_io_add_watch(GIOChannel *, GIOCondition, GIOFunc, void *);
+bool paxos_source_remove_by_user_data(void *);
+
 /* Message delivery I/O wrappers. */
 int paxos_send(struct paxos_acceptor *, struct paxos_yak *);
 int paxos_send_to_proposer(struct paxos_yak *);
 int paxos_broadcast(struct paxos_yak *);
+int paxos_broadcast_voters(struct paxos_yak *);
 
 #endif /* __PAXOS_UTIL_H__ */
@@ -0,0 +1,663 @@
+/**
+ * paxos_wal.c - Durable logging of acceptor state.
+ *
+ * If the client gives us a directory, we log every ballot we promise, every
+ * instance we accept or learn, every truncate, and every change to the alist,
+ * so that a restarted process can restore its sessions and resume them.  Each
+ * record is a msgpack array of the record kind, the session ID, and the
+ * record's contents.
+ *
+ * A promise or accept must not reach the proposer before it is durable, and
+ * the proposer must not commit before its own accept is.  Rather than syncing
+ * for every record, we hold those replies and commits back and sync once per
+ * main loop iteration, releasing everything the sync covered.  For comparison,
+ * MOTMOT_OPT_WAL_EACH has us sync after every record instead.  If we cannot
+ * append or sync, we can no longer vouch for anything we have promised, so we
+ * abort and let a restart recover from what did reach the disk.  When
+ * a segment fills up, we start a new one with a checkpoint of every session
+ * and delete the old ones, so that the log stays about as small as our
+ * ilists.
+ */
+
+#include <assert.h>
+#include <glib.h>
+
+#include "paxos.h"
+#include "paxos_continue.h"
+#include "paxos_io.h"
+#include "paxos_msgpack.h"
+#include "paxos_print.h"
+#include "paxos_protocol.h"
+#include "paxos_state.h"
+#include "paxos_util.h"
+#include "containers/list.h"
+
+#define WAL_BALLOT    0     // [kind, session, ballot id, ballot gen, gen_high]
+#define WAL_INSTANCE  1     // [kind, session, instance, request or nil]
+#define WAL_TRUNCATE  2     // [kind, session, ibase]
+#define WAL_MEMBERS   3     // [kind, session, self_id, alist]
+#define WAL_END       4     // [kind, session]
+
+/* A reply or commit held back until the records it depends on are
+ * durable. */
+struct wal_reply {
+  pax_uuid_t wr_session;  // session the reply belongs to
+  paxid_t wr_to;          // acceptor to send it to
+  char *wr_data;          // the packed reply, or NULL for a commit
+  size_t wr_size;         // size of the reply
+  paxid_t wr_inum;        // instance to commit
+};
+
+/**
+ * Make sure a sync is scheduled.  We use a timeout rather than an idle source
+ * so that a busy main loop can't starve it; at default priority, it fires
+ * after the I/O dispatched in the same iteration.
+ */
+static void
+wal_schedule(void)
+{
+  if (!state->wal_pending) {
+    state->wal_pending = true;
+    paxos_timeout_add(0, paxos_wal_flush, NULL);
+  }
+}
+
+/**
+ * Start a record for the current session.
+ */
+static void
+wal_record_init(struct paxos_yak *py, paxid_t kind, size_t n)
+{
+  paxos_payload_init(py, n);
+  paxos_paxid_pack(py, kind);
+  paxos_uuid_pack(py, pax->session_id);
+}
+
+/**
+ * Append a record to the log and make sure a sync is scheduled.
+ */
+static void
+wal_record_write(struct paxos_yak *py)
+{
+  if (wal_append(&state->wal, paxos_payload_data(py),
+        paxos_payload_size(py))) {
+    g_error("wal_record_write: Append to log failed.");
+  }
+  paxos_payload_destroy(py);
+
+  // If we sync every record, nothing is ever held back for a sync.
+  if (state->wal_each) {
+    if (wal_sync(&state->wal)) {
+      g_error("wal_record_write: Log sync failed.");
+    }
+    return;
+  }
+
+  wal_schedule();
+}
+
+/**
+ * paxos_wal_ballot - Log our current ballot and ballot high water mark.
+ */
+void
+paxos_wal_ballot(void)
+{
+  struct paxos_yak py;
+
+  if (state->wal.w_dir == NULL) {
+    return;
+  }
+
+  wal_record_init(&py, WAL_BALLOT, 5);
+  paxos_paxid_pack(&py, pax->ballot.id);
+  paxos_paxid_pack(&py, pax->ballot.gen);
+  paxos_paxid_pack(&py, pax->gen_high);
+  wal_record_write(&py);
+}
+
+/**
+ * paxos_wal_instance - Log an instance we have accepted or committed, along
+ * with its request if we have it.
+ */
+void
+paxos_wal_instance(struct paxos_instance *inst)
+{
+  struct paxos_request *req = NULL;
+  struct paxos_yak py;
+
+  if (state->wal.w_dir == NULL || inst == NULL) {
+    return;
+  }
+
+  if (request_needs_cached(inst->pi_val.pv_dkind)) {
+    req = rcache_find(pax, inst->pi_val.pv_reqid);
+  }
+
+  wal_record_init(&py, WAL_INSTANCE, 4);
+  paxos_instance_pack(&py, inst);
+  if (req != NULL) {
+    paxos_request_pack(&py, req);
+  } else {
+    msgpack_pack_nil(py.pk);
+  }
+  wal_record_write(&py);
+}
+
+/**
+ * paxos_wal_truncate - Log a truncate.
+ */
+void
+paxos_wal_truncate(void)
+{
+  struct paxos_yak py;
+
+  if (state->wal.w_dir == NULL) {
+    return;
+  }
+
+  wal_record_init(&py, WAL_TRUNCATE, 3);
+  paxos_paxid_pack(&py, pax->ibase);
+  wal_record_write(&py);
+}
+
+/**
+ * paxos_wal_members - Log our identity and the alist.
+ */
+void
+paxos_wal_members(void)
+{
+  struct paxos_acceptor *acc;
+  struct paxos_yak py;
+
+  if (state->wal.w_dir == NULL) {
+    return;
+  }
+
+  wal_record_init(&py, WAL_MEMBERS, 4);
+  paxos_paxid_pack(&py, pax->self_id);
+  paxos_payload_begin_array(&py, LIST_COUNT(&pax->alist));
+  LIST_FOREACH(acc, &pax->alist, pa_le) {
+    paxos_acceptor_pack(&py, acc);
+  }
+  wal_record_write(&py);
+}
+
+/**
+ * paxos_wal_end - Log that we have left a session.
+ */
+void
+paxos_wal_end(void)
+{
+  struct paxos_yak py;
+
+  if (state->wal.w_dir == NULL) {
+    return;
+  }
+
+  wal_record_init(&py, WAL_END, 2);
+  wal_record_write(&py);
+}
+
+/**
+ * paxos_wal_send - Send a reply to the proposer once everything we have
+ * logged is durable.
+ */
+int
+paxos_wal_send(struct paxos_yak *py)
+{
+  struct wal_reply *wr;
+
+  if (!state->wal.w_dirty) {
+    return paxos_send_to_proposer(py);
+  }
+  if (pax->proposer == NULL) {
+    return 1;
+  }
+
+  wr = g_malloc0(sizeof(*wr));
+  wr->wr_session = *pax->session_id;
+  wr->wr_to = pax->proposer->pa_paxid;
+  wr->wr_size = paxos_payload_size(py);
+  wr->wr_data = g_memdup(paxos_payload_data(py), wr->wr_size);
+  g_queue_push_tail(state->wal_held, wr);
+  wal_schedule();
+
+  return 0;
+}
+
+/**
+ * paxos_wal_hold_commit - Hold back a commit until everything we have logged
+ * is durable.  Returns nonzero if the commit is held, in which case it will be
+ * made by proposer_commit_durable() after the next sync.
+ */
+int
+paxos_wal_hold_commit(struct paxos_instance *inst)
+{
+  struct wal_reply *wr;
+
+  if (inst->pi_committing) {
+    return 1;
+  }
+  if (!state->wal.w_dirty) {
+    return 0;
+  }
+
+  wr = g_malloc0(sizeof(*wr));
+  wr->wr_session = *pax->session_id;
+  wr->wr_inum = inst->pi_hdr.ph_inum;
+  g_queue_push_tail(state->wal_held, wr);
+  wal_schedule();
+
+  inst->pi_committing = true;
+  return 1;
+}
+
+/**
+ * Send all the replies and make all the commits we were holding back.  Their
+ * sessions, recipients, or instances may have gone away in the meantime.
+ */
+static void
+wal_release(void)
+{
+  struct wal_reply *wr;
+  struct paxos_acceptor *acc;
+  struct paxos_instance *inst;
+  struct paxos_session *session;
+
+  while ((wr = g_queue_pop_head(state->wal_held)) != NULL) {
+    session = session_find(&state->sessions, &wr->wr_session);
+    if (session != NULL && wr->wr_data == NULL) {
+      pax = session;
+      inst = instance_find(&pax->ilist, wr->wr_inum);
+      if (inst != NULL && inst->pi_committing) {
+        proposer_commit_durable(inst);
+      }
+    } else if (session != NULL) {
+      acc = acceptor_find(&session->alist, wr->wr_to);
+      if (acc != NULL && acc->pa_peer != NULL) {
+        paxos_peer_send(acc->pa_peer, wr->wr_data, wr->wr_size);
+      }
+    }
+
+    g_free(wr->wr_data);
+    g_free(wr);
+  }
+}
+
+/**
+ * Make everything we have logged durable, and send the replies and make the
+ * commits which were waiting on it.
+ */
+static void
+wal_barrier(void)
+{
+  if (state->wal.w_dir == NULL) {
+    return;
+  }
+
+  // The kernel may have dropped the pages it failed to write, so a retry
+  // could succeed without them ever reaching the disk.
+  if (wal_sync(&state->wal)) {
+    g_error("wal_barrier: Log sync failed.");
+  }
+  wal_release();
+}
+
+/**
+ * Log everything we know about the current session.
+ */
+static void
+wal_checkpoint_session(void)
+{
+  struct paxos_instance *it;
+
+  paxos_wal_members();
+  paxos_wal_ballot();
+  LIST_FOREACH(it, &pax->ilist, pi_le) {
+    if (it->pi_hdr.ph_inum >= pax->ibase) {
+      paxos_wal_instance(it);
+    }
+  }
+  paxos_wal_truncate();
+}
+
+/**
+ * Start a new segment with a checkpoint of every session, and delete the
+ * segments it supersedes.
+ */
+static void
+wal_checkpoint(void)
+{
+  struct paxos_session *saved;
+
+  if (wal_rotate(&state->wal)) {
+    g_error("wal_checkpoint: Could not start a new segment.");
+  }
+
+  saved = pax;
+  LIST_FOREACH(pax, &state->sessions, session_le) {
+    wal_checkpoint_session();
+  }
+  LIST_FOREACH(pax, &state->recovered, session_le) {
+    wal_checkpoint_session();
+  }
+  pax = saved;
+
+  wal_barrier();
+  wal_prune(&state->wal);
+}
+
+/**
+ * paxos_wal_flush - GEvent-friendly routine which syncs everything logged
+ * during the last main loop iteration.
+ */
+int
+paxos_wal_flush(void *data)
+{
+  state->wal_pending = false;
+
+  wal_barrier();
+  if (state->wal.w_size >= WAL_SEGMENT_MAX) {
+    wal_checkpoint();
+  }
+
+  return FALSE;
+}
+
+/**
+ * Check that an object is an array of n unsigned integers.
+ */
+static bool
+wal_valid_ints(msgpack_object *o, size_t n)
+{
+  size_t i;
+
+  if (o->type != MSGPACK_OBJECT_ARRAY || o->via.array.size != n) {
+    return false;
+  }
+  for (i = 0; i < n; ++i) {
+    if (o->via.array.ptr[i].type != MSGPACK_OBJECT_POSITIVE_INTEGER) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Check that an object is a tuple of the given msgpack types.  An array type
+ * only requires that the element be some array.
+ */
+static bool
+wal_valid_tuple(msgpack_object *o, size_t n, const msgpack_object_type *types)
+{
+  size_t i;
+
+  if (o->type != MSGPACK_OBJECT_ARRAY || o->via.array.size != n) {
+    return false;
+  }
+  for (i = 0; i < n; ++i) {
+    if (o->via.array.ptr[i].type != types[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Check that a logged record is well-formed, so that unpacking it can't trip
+ * an assertion.  Corruption which still parses as msgpack is unlikely, but a
+ * damaged disk shouldn't keep us from starting.
+ */
+static bool
+wal_valid(msgpack_object *o)
+{
+  msgpack_object *p, *pend;
+  static const msgpack_object_type inst_types[] = {
+    MSGPACK_OBJECT_ARRAY, MSGPACK_OBJECT_BOOLEAN, MSGPACK_OBJECT_ARRAY
+  };
+  static const msgpack_object_type req_types[] = {
+    MSGPACK_OBJECT_ARRAY, MSGPACK_OBJECT_RAW
+  };
+  static const msgpack_object_type acc_types[] = {
+    MSGPACK_OBJECT_POSITIVE_INTEGER, MSGPACK_OBJECT_RAW, MSGPACK_OBJECT_BOOLEAN
+  };
+
+  if (o->type != MSGPACK_OBJECT_ARRAY || o->via.array.size < 2) {
+    return false;
+  }
+  p = o->via.array.ptr;
+  if (p[0].type != MSGPACK_OBJECT_POSITIVE_INTEGER ||
+      p[1].type != MSGPACK_OBJECT_POSITIVE_INTEGER) {
+    return false;
+  }
+
+  switch (p[0].via.u64) {
+    case WAL_BALLOT:
+      return wal_valid_ints(o, 5);
+
+    case WAL_INSTANCE:
+      if (o->via.array.size != 4 || !wal_valid_tuple(&p[2], 3, inst_types)) {
+        return false;
+      }
+      p = p[2].via.array.ptr;
+      if (!wal_valid_ints(&p[0], 5) || !wal_valid_ints(&p[2], 4)) {
+        return false;
+      }
+      p = o->via.array.ptr + 3;
+      if (p->type == MSGPACK_OBJECT_NIL) {
+        return true;
+      }
+      return wal_valid_tuple(p, 2, req_types) &&
+          wal_valid_ints(p->via.array.ptr, 4);
+
+    case WAL_TRUNCATE:
+      return wal_valid_ints(o, 3);
+
+    case WAL_MEMBERS:
+      if (o->via.array.size != 4 ||
+          p[2].type != MSGPACK_OBJECT_POSITIVE_INTEGER ||
+          p[3].type != MSGPACK_OBJECT_ARRAY) {
+        return false;
+      }
+      pend = p[3].via.array.ptr + p[3].via.array.size;
+      for (p = p[3].via.array.ptr; p != pend; ++p) {
+        if (!wal_valid_tuple(p, 3, acc_types)) {
+          return false;
+        }
+      }
+      return true;
+
+    case WAL_END:
+      return (o->via.array.size == 2);
+
+    default:
+      return false;
+  }
+}
+
+/**
+ * Apply a logged record to the recovered session it belongs to.  Returns
+ * nonzero, having changed nothing, if the record is corrupt.
+ */
+static int
+wal_apply(msgpack_object *o, void *data)
+{
+  paxid_t kind;
+  pax_uuid_t uuid;
+  msgpack_object *p, *pend;
+  struct paxos_session *session;
+  struct paxos_acceptor *acc;
+  struct paxos_instance *inst, *it;
+  struct paxos_request *req;
+
+  // Make sure the record is well-formed.
+  if (!wal_valid(o)) {
+    return 1;
+  }
+  p = o->via.array.ptr;
+
+  paxos_paxid_unpack(&kind, p++);
+  paxos_uuid_unpack(&uuid, p++);
+
+  // Find the session, or start recovering a new one.
+  session = session_find(&state->recovered, &uuid);
+  if (session == NULL) {
+    session = session_new(NULL, 0);
+    LIST_REMOVE(&state->sessions, session, session_le);
+    *session->session_id = uuid;
+    session_insert(&state->recovered, session);
+  }
+
+  switch (kind) {
+    case WAL_BALLOT:
+      paxos_paxid_unpack(&session->ballot.id, p++);
+      paxos_paxid_unpack(&session->ballot.gen, p++);
+      paxos_paxid_unpack(&session->gen_high, p++);
+      break;
+
+    case WAL_INSTANCE:
+      inst = g_malloc0(sizeof(*inst));
+      paxos_instance_unpack(inst, p++);
+
+      // Later records supersede earlier ones, but never uncommit.
+      it = instance_find(&session->ilist, inst->pi_hdr.ph_inum);
+      if (it == NULL) {
+        instance_insert(&session->ilist, inst);
+      } else {
+        if (!it->pi_committed) {
+          memcpy(&it->pi_hdr, &inst->pi_hdr, sizeof(inst->pi_hdr));
+          memcpy(&it->pi_val, &inst->pi_val, sizeof(inst->pi_val));
+          it->pi_committed = inst->pi_committed;
+        }
+        instance_destroy(inst);
+      }
+
+      if (p->type != MSGPACK_OBJECT_NIL) {
+        req = g_malloc0(sizeof(*req));
+        paxos_request_unpack(req, p);
+        if (rcache_find(session, req->pr_val.pv_reqid) == NULL) {
+          rcache_insert(session, req);
+        } else {
+          request_destroy(req);
+        }
+      }
+      break;
+
+    case WAL_TRUNCATE:
+      paxos_paxid_unpack(&session->ibase, p++);
+
+      LIST_WHILE_FIRST(it, &session->ilist) {
+        if (it->pi_hdr.ph_inum >= session->ibase) {
+          break;
+        }
+        req = rcache_find(session, it->pi_val.pv_reqid);
+        if (req != NULL) {
+          rcache_remove(session, req);
+          request_destroy(req);
+        }
+        LIST_REMOVE(&session->ilist, it, pi_le);
+        instance_destroy(it);
+      }
+      break;
+
+    case WAL_MEMBERS:
+      paxos_paxid_unpack(&session->self_id, p++);
+
+      // Replace the alist wholesale.
+      acceptor_container_destroy(&session->alist);
+      pend = p->via.array.ptr + p->via.array.size;
+      for (p = p->via.array.ptr; p != pend; ++p) {
+        acc = g_malloc0(sizeof(*acc));
+        paxos_acceptor_unpack(acc, p);
+        LIST_INSERT_TAIL(&session->alist, acc, pa_le);
+      }
+      break;
+
+    case WAL_END:
+      LIST_REMOVE(&state->recovered, session, session_le);
+      pax = session;
+      session_destroy(session);
+      break;
+  }
+
+  return 0;
+}
+
+/**
+ * Set up the learn protocol parameters of a recovered session.  We log
+ * commits only as we learn them, so everything from ibase up through our
+ * last contiguous commit counts as learned.
+ */
+static bool
+wal_recover(struct paxos_session *session)
+{
+  struct paxos_instance *it;
+
+  // We need to know who we are and whom to reconnect to.
+  if (LIST_EMPTY(&session->ilist) || session->self_id == 0 ||
+      acceptor_find(&session->alist, session->self_id) == NULL) {
+    return false;
+  }
+
+  it = LIST_FIRST(&session->ilist);
+  if (session->ibase == 0) {
+    session->ibase = it->pi_hdr.ph_inum;
+  }
+  session->ihole = session->ibase;
+  session->istart = it;
+
+  for (; it != (void *)&session->ilist; it = LIST_NEXT(it, pi_le)) {
+    if (it->pi_hdr.ph_inum != session->ihole || !it->pi_committed) {
+      break;
+    }
+    it->pi_cached = true;
+    it->pi_learned = true;
+
+    session->istart = it;
+    session->ihole++;
+  }
+
+  // Our log must at least contain our base.
+  return session->ihole > session->ibase;
+}
+
+/**
+ * paxos_wal_open - Start logging to a directory, first recovering whatever
+ * sessions were logged there and resuming them.
+ *
+ * We checkpoint the recovered sessions into a fresh segment, so that the log
+ * we replayed can be deleted, before rejoining them.
+ */
+int
+paxos_wal_open(const char *dir)
+{
+  struct paxos_session *session, *next;
+
+  // Our log can only be written from one thread, so it can't be used by
+  // shards.
+  if (state->wal.w_dir != NULL || paxos_shard_count() != 0 ||
+      wal_open(&state->wal, dir)) {
+    return 1;
+  }
+
+  wal_replay(&state->wal, wal_apply, NULL);
+
+  for (session = LIST_FIRST(&state->recovered);
+      session != (void *)&state->recovered; session = next) {
+    next = LIST_NEXT(session, session_le);
+    if (!wal_recover(session)) {
+      g_warning("paxos_wal_open: Discarding unusable session log.");
+      LIST_REMOVE(&state->recovered, session, session_le);
+      pax = session;
+      session_destroy(session);
+    }
+  }
+
+  wal_checkpoint();
+
+  LIST_WHILE_FIRST(session, &state->recovered) {
+    acceptor_resume(session);
+  }
+
+  return 0;
+}
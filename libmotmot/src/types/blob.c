@@ -0,0 +1,524 @@
+/**
+ * blob.c - Content-addressed store for large chat payloads.
+ */
+
+#include <string.h>
+#include <unistd.h>
+
+#include "containers/hashtable_factory.h"
+#include "types/blob.h"
+#include "types/erasure.h"
+
+HASHTABLE_IMPLEMENT(blob, pb_id, blob_key_hash, blob_key_equals, _INL);
+
+/**
+ * Hash a payload into a blob ID.  The store is shared among sessions and
+ * takes any payload whose ID matches as the one it names, so the hash must
+ * be one that no member can collide on purpose.
+ */
+static void
+blob_id_compute(const void *data, size_t size, unsigned char *id)
+{
+  gsize len = BLOB_ID_SIZE;
+  GChecksum *sum;
+
+  sum = g_checksum_new(G_CHECKSUM_SHA256);
+  g_checksum_update(sum, data, size);
+  g_checksum_get_digest(sum, id, &len);
+  g_checksum_free(sum);
+}
+
+/**
+ * Hash a blob ID.  It's a hash already, so just take its first word.
+ */
+unsigned
+blob_key_hash(const void *data)
+{
+  const unsigned char *id = data;
+
+  return (id[0] << 24) | (id[1] << 16) | (id[2] << 8) | id[3];
+}
+
+/**
+ * Check two blob IDs for equality.
+ */
+int
+blob_key_equals(const void *x, const void *y)
+{
+  return !memcmp(x, y, BLOB_ID_SIZE);
+}
+
+/**
+ * Write a reference to a blob, i.e., its ID followed by its size and its
+ * coding parameters, all big-endian.
+ */
+void
+blob_ref_encode(struct paxos_blob *blob, char *ref)
+{
+  int i;
+  uint64_t size = blob->pb_size;
+
+  memcpy(ref, blob->pb_id, BLOB_ID_SIZE);
+  for (i = 0; i < 8; ++i) {
+    ref[BLOB_ID_SIZE + i] = size >> (56 - 8 * i);
+  }
+  ref[BLOB_ID_SIZE + 8] = blob->pb_k >> 8;
+  ref[BLOB_ID_SIZE + 9] = blob->pb_k;
+  ref[BLOB_ID_SIZE + 10] = blob->pb_n >> 8;
+  ref[BLOB_ID_SIZE + 11] = blob->pb_n;
+}
+
+/**
+ * Read the size out of a blob reference.
+ */
+static size_t
+blob_ref_size(const char *ref)
+{
+  int i;
+  uint64_t size = 0;
+
+  for (i = 0; i < 8; ++i) {
+    size = (size << 8) | (unsigned char)ref[BLOB_ID_SIZE + i];
+  }
+  return size;
+}
+
+/**
+ * Read the coding parameters out of a blob reference.
+ */
+static void
+blob_ref_coding(const char *ref, unsigned *k, unsigned *n)
+{
+  const unsigned char *p = (const unsigned char *)ref + BLOB_ID_SIZE + 8;
+
+  *k = (p[0] << 8) | p[1];
+  *n = (p[2] << 8) | p[3];
+}
+
+/**
+ * blob_ref_coded - Does a reference name an erasure-coded blob?
+ */
+bool
+blob_ref_coded(const char *ref)
+{
+  unsigned k, n;
+
+  blob_ref_coding(ref, &k, &n);
+  return k != 0;
+}
+
+/**
+ * Check that a reference describes a blob the same way that we do.
+ */
+static bool
+blob_ref_matches(struct paxos_blob *blob, const char *ref)
+{
+  unsigned k, n;
+
+  blob_ref_coding(ref, &k, &n);
+  return blob->pb_size == blob_ref_size(ref) && blob->pb_k == k &&
+      blob->pb_n == n;
+}
+
+/**
+ * Get the number of pieces a blob is fetched in.
+ */
+unsigned
+blob_chunk_count(struct paxos_blob *blob)
+{
+  if (blob->pb_k != 0) {
+    return blob->pb_n;
+  }
+  return (blob->pb_size + BLOB_CHUNK - 1) / BLOB_CHUNK;
+}
+
+/**
+ * Get the size of a piece of a blob.
+ */
+static size_t
+blob_chunk_size(struct paxos_blob *blob, unsigned i)
+{
+  if (blob->pb_k != 0) {
+    return erasure_frag_size(blob->pb_size, blob->pb_k);
+  }
+  return MIN(BLOB_CHUNK, blob->pb_size - (size_t)i * BLOB_CHUNK);
+}
+
+/**
+ * Set up a blob to be fetched from scratch.
+ */
+static void
+blob_fetch_init(struct paxos_blob *blob)
+{
+  g_free(blob->pb_data);
+  g_free(blob->pb_chunks);
+  g_free(blob->pb_slots);
+  blob->pb_chunks = NULL;
+  blob->pb_slots = NULL;
+
+  // Coded blobs collect any k fragments, side by side, before decoding.
+  if (blob->pb_k != 0) {
+    blob->pb_data = g_malloc(blob->pb_k *
+        erasure_frag_size(blob->pb_size, blob->pb_k));
+    blob->pb_slots = g_malloc0(blob->pb_k * sizeof(*blob->pb_slots));
+    blob->pb_missing = blob->pb_k;
+  } else {
+    blob->pb_data = g_malloc(blob->pb_size);
+    blob->pb_missing = blob_chunk_count(blob);
+  }
+
+  if (blob->pb_missing > 0 && blob->pb_size > 0) {
+    blob->pb_chunks = g_malloc0(blob_chunk_count(blob) *
+        sizeof(*blob->pb_chunks));
+  } else {
+    blob->pb_missing = 0;
+  }
+}
+
+/**
+ * Move a resident blob to the back of the LRU list.
+ */
+static void
+blob_touch(struct blob_store *bs, struct paxos_blob *blob)
+{
+  LIST_REMOVE(&bs->bs_lru, blob, pb_le);
+  LIST_INSERT_TAIL(&bs->bs_lru, blob, pb_le);
+}
+
+/**
+ * Write a resident blob out to a temporary file and free its memory.
+ */
+static int
+blob_spill(struct blob_store *bs, struct paxos_blob *blob)
+{
+  int fd;
+  ssize_t n;
+  size_t off;
+
+  fd = g_file_open_tmp("motmot-blob-XXXXXX", &blob->pb_path, NULL);
+  if (fd < 0) {
+    return 1;
+  }
+
+  for (off = 0; off < blob->pb_size; off += n) {
+    n = write(fd, blob->pb_data + off, blob->pb_size - off);
+    if (n <= 0) {
+      close(fd);
+      unlink(blob->pb_path);
+      g_free(blob->pb_path);
+      blob->pb_path = NULL;
+      return 1;
+    }
+  }
+  close(fd);
+
+  LIST_REMOVE(&bs->bs_lru, blob, pb_le);
+  bs->bs_resident -= blob->pb_size;
+  g_free(blob->pb_data);
+  blob->pb_data = NULL;
+
+  return 0;
+}
+
+/**
+ * Bring the store back under its size bound, oldest blobs first.  We never
+ * evict blobs which are still being fetched or the blob we were just asked
+ * for, and we never drop the only copy of our own sends.
+ */
+static void
+blob_evict(struct blob_store *bs, struct paxos_blob *keep)
+{
+  struct paxos_blob *it, *next;
+
+  for (it = LIST_FIRST(&bs->bs_lru);
+      it != (void *)&bs->bs_lru && bs->bs_resident > bs->bs_max; it = next) {
+    next = LIST_NEXT(it, pb_le);
+    if (it == keep || it->pb_chunks != NULL) {
+      continue;
+    }
+
+    if (bs->bs_spill && blob_spill(bs, it) == 0) {
+      continue;
+    }
+    if (it->pb_pins == 0) {
+      LIST_REMOVE(&bs->bs_lru, it, pb_le);
+      bs->bs_resident -= it->pb_size;
+      g_hash_table_remove(bs->bs_table, it->pb_id);
+      g_free(it->pb_data);
+      g_free(it);
+    }
+  }
+}
+
+/**
+ * blob_store_init - Set up an empty blob store.
+ */
+void
+blob_store_init(struct blob_store *bs, size_t max)
+{
+  bs->bs_table = blob_container_new();
+  LIST_INIT(&bs->bs_lru);
+  bs->bs_resident = 0;
+  bs->bs_max = max;
+  bs->bs_spill = false;
+}
+
+/**
+ * Allocate a blob and add it to the store.
+ */
+static struct paxos_blob *
+blob_new(struct blob_store *bs, const unsigned char *id, size_t size,
+    unsigned k, unsigned n)
+{
+  struct paxos_blob *blob;
+
+  blob = g_malloc0(sizeof(*blob));
+  memcpy(blob->pb_id, id, BLOB_ID_SIZE);
+  blob->pb_size = size;
+  blob->pb_k = k;
+  blob->pb_n = n;
+  blob->pb_data = g_malloc(size);
+
+  blob_insert(bs->bs_table, blob);
+  LIST_INSERT_TAIL(&bs->bs_lru, blob, pb_le);
+  bs->bs_resident += size;
+
+  return blob;
+}
+
+/**
+ * blob_store_put - Add a payload we are sending to the store, pinning it
+ * until the send is truncated.  If k is nonzero, we will code it into n
+ * fragments, any k of which rebuild it.
+ */
+struct paxos_blob *
+blob_store_put(struct blob_store *bs, const void *data, size_t size,
+    unsigned k, unsigned n)
+{
+  unsigned char id[BLOB_ID_SIZE];
+  struct paxos_blob *blob;
+
+  blob_id_compute(data, size, id);
+  blob = blob_find(bs->bs_table, id);
+
+  if (blob == NULL) {
+    blob = blob_new(bs, id, size, k, n);
+    memcpy(blob->pb_data, data, size);
+  } else if (blob->pb_chunks != NULL) {
+    // We were fetching this very payload; just finish it off.
+    g_free(blob->pb_data);
+    blob->pb_data = g_memdup(data, size);
+    g_free(blob->pb_chunks);
+    g_free(blob->pb_slots);
+    blob->pb_chunks = NULL;
+    blob->pb_slots = NULL;
+    blob->pb_missing = 0;
+  }
+
+  // A complete blob can serve any coding, so describe it the way we're
+  // about to send it.
+  blob->pb_k = k;
+  blob->pb_n = n;
+
+  blob->pb_pins++;
+  blob_evict(bs, blob);
+
+  return blob;
+}
+
+/**
+ * blob_store_expect - Look up the blob named by a reference, making an empty
+ * one to fetch into if we don't have it.  References come from our peers,
+ * so we return NULL rather than allocate for one that makes no sense.
+ */
+struct paxos_blob *
+blob_store_expect(struct blob_store *bs, const char *ref)
+{
+  unsigned k, n;
+  size_t size;
+  struct paxos_blob *blob;
+
+  blob = blob_find(bs->bs_table, (void *)ref);
+  if (blob != NULL) {
+    return blob;
+  }
+
+  blob_ref_coding(ref, &k, &n);
+  size = blob_ref_size(ref);
+  if (k > n || n > ERASURE_MAX_FRAGS || size > BLOB_MAX_SIZE) {
+    return NULL;
+  }
+  blob = blob_new(bs, (const unsigned char *)ref, size, k, n);
+  blob_fetch_init(blob);
+  blob_evict(bs, blob);
+
+  return blob;
+}
+
+/**
+ * blob_store_data - Get the contents of a complete blob, reading it back in
+ * if it was spilled.  Returns NULL if we don't have it all.
+ *
+ * If a spilled blob can't be read back, we have lost it, so we set it up to
+ * be fetched again and also return NULL.
+ */
+const char *
+blob_store_data(struct blob_store *bs, struct paxos_blob *blob)
+{
+  gsize size;
+  bool ok;
+
+  if (blob->pb_chunks != NULL) {
+    return NULL;
+  }
+
+  if (blob->pb_data == NULL) {
+    ok = g_file_get_contents(blob->pb_path, &blob->pb_data, &size, NULL);
+
+    unlink(blob->pb_path);
+    g_free(blob->pb_path);
+    blob->pb_path = NULL;
+
+    LIST_INSERT_TAIL(&bs->bs_lru, blob, pb_le);
+    bs->bs_resident += blob->pb_size;
+
+    if (!ok || size != blob->pb_size) {
+      g_warning("blob_store_data: Could not read back spilled blob.");
+      blob_fetch_init(blob);
+      return NULL;
+    }
+  } else {
+    blob_touch(bs, blob);
+  }
+
+  blob_evict(bs, blob);
+  return blob->pb_data;
+}
+
+/**
+ * blob_store_unpin - Release the pin taken by blob_store_put.
+ */
+void
+blob_store_unpin(struct blob_store *bs, const char *ref)
+{
+  struct paxos_blob *blob;
+
+  blob = blob_find(bs->bs_table, (void *)ref);
+  if (blob != NULL && blob->pb_pins > 0) {
+    blob->pb_pins--;
+  }
+  blob_evict(bs, NULL);
+}
+
+/**
+ * blob_chunk_copy - Copy out a piece of a blob, as coded by the given
+ * reference, if we have it; otherwise return NULL.  The caller frees it.
+ */
+char *
+blob_chunk_copy(struct blob_store *bs, struct paxos_blob *blob,
+    const char *ref, unsigned i, size_t *len)
+{
+  unsigned s, k, n;
+  const char *data;
+  char *piece;
+
+  // If we have the whole payload, we can produce any piece of any coding.
+  if (blob->pb_chunks == NULL) {
+    data = blob_store_data(bs, blob);
+    if (data == NULL) {
+      return NULL;
+    }
+
+    blob_ref_coding(ref, &k, &n);
+    if (k == 0) {
+      if ((size_t)i * BLOB_CHUNK >= blob->pb_size) {
+        return NULL;
+      }
+      *len = MIN(BLOB_CHUNK, blob->pb_size - (size_t)i * BLOB_CHUNK);
+      return g_memdup(data + (size_t)i * BLOB_CHUNK, *len);
+    }
+
+    if (k > n || i >= n || n > ERASURE_MAX_FRAGS) {
+      return NULL;
+    }
+    *len = erasure_frag_size(blob->pb_size, k);
+    piece = g_malloc(*len);
+    erasure_encode(data, blob->pb_size, k, n, i, piece);
+    return piece;
+  }
+
+  // Otherwise, we can only pass along pieces we've been given.
+  if (!blob_ref_matches(blob, ref) || i >= blob_chunk_count(blob) ||
+      !blob->pb_chunks[i]) {
+    return NULL;
+  }
+
+  *len = blob_chunk_size(blob, i);
+  if (blob->pb_k == 0) {
+    return g_memdup(blob->pb_data + (size_t)i * BLOB_CHUNK, *len);
+  }
+
+  for (s = 0; blob->pb_slots[s] != i; ++s);
+  return g_memdup(blob->pb_data + s * *len, *len);
+}
+
+/**
+ * blob_chunk_fill - Copy a fetched piece into a blob, decoding it if it is
+ * coded and this was the last fragment we needed.  Returns true iff this
+ * completes the blob.
+ */
+bool
+blob_chunk_fill(struct blob_store *bs, struct paxos_blob *blob,
+    const char *ref, unsigned i, const char *data, size_t len)
+{
+  unsigned s;
+  char *out;
+  unsigned char id[BLOB_ID_SIZE];
+
+  // Ignore anything we don't need or which is the wrong size.
+  if (blob->pb_chunks == NULL || !blob_ref_matches(blob, ref) ||
+      i >= blob_chunk_count(blob) || blob->pb_chunks[i] ||
+      len != blob_chunk_size(blob, i)) {
+    return false;
+  }
+
+  if (blob->pb_k == 0) {
+    memcpy(blob->pb_data + (size_t)i * BLOB_CHUNK, data, len);
+  } else {
+    s = blob->pb_k - blob->pb_missing;
+    memcpy(blob->pb_data + s * len, data, len);
+    blob->pb_slots[s] = i;
+  }
+  blob->pb_chunks[i] = true;
+  if (--blob->pb_missing > 0) {
+    return false;
+  }
+
+  // Rebuild the payload from its fragments.
+  if (blob->pb_k != 0) {
+    out = g_malloc(blob->pb_size);
+    if (!erasure_decode(blob->pb_data, blob->pb_slots, blob->pb_k,
+          blob->pb_n, blob->pb_size, out)) {
+      g_warning("blob_chunk_fill: Could not decode blob.");
+      g_free(out);
+      blob_fetch_init(blob);
+      return false;
+    }
+    g_free(blob->pb_data);
+    blob->pb_data = out;
+  }
+
+  // Make sure we got what we asked for; if not, start over.
+  blob_id_compute(blob->pb_data, blob->pb_size, id);
+  if (memcmp(id, blob->pb_id, BLOB_ID_SIZE) != 0) {
+    g_warning("blob_chunk_fill: Blob failed verification.");
+    blob_fetch_init(blob);
+    return false;
+  }
+
+  g_free(blob->pb_chunks);
+  g_free(blob->pb_slots);
+  blob->pb_chunks = NULL;
+  blob->pb_slots = NULL;
+  return true;
+}
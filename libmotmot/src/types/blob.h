@@ -0,0 +1,68 @@
+/**
+ * blob.h - Content-addressed store for large chat payloads.
+ */
+#ifndef __PAXOS_TYPES_BLOB_H__
+#define __PAXOS_TYPES_BLOB_H__
+
+#include <glib.h>
+
+#include "containers/hashtable_factory.h"
+#include "containers/list.h"
+#include "types/primitives.h"
+
+#define BLOB_ID_SIZE    32
+#define BLOB_REF_SIZE   (BLOB_ID_SIZE + 12)
+#define BLOB_CHUNK      16384
+#define BLOB_MAX_SIZE   ((size_t)1 << 32)
+
+/* A large payload, identified by the hash of its contents; shared among
+ * sessions.  We fetch it either in fixed-size chunks or, if it is erasure
+ * coded, as any pb_k of its pb_n fragments. */
+struct paxos_blob {
+  unsigned char pb_id[BLOB_ID_SIZE];  // SHA-256 of the payload
+  size_t pb_size;                     // size of the payload
+  unsigned pb_k;                      // fragments needed; 0 if not coded
+  unsigned pb_n;                      // total number of fragments
+  char *pb_data;                      // the payload; NULL if spilled
+  char *pb_path;                      // spill file; NULL if resident
+  unsigned pb_missing;                // number of pieces we still need
+  bool *pb_chunks;                    // which pieces we have; NULL if complete
+  unsigned *pb_slots;                 // fragment in each slot of pb_data
+  unsigned pb_pins;                   // local sends which may not be evicted
+  LIST_ENTRY(paxos_blob) pb_le;       // LRU list of resident blobs
+};
+
+HASHTABLE_DECLARE(blob);
+
+/* The blob store. */
+struct blob_store {
+  blob_container *bs_table;           // hash table of all blobs
+  LIST_HEAD(blob_lru, paxos_blob) bs_lru; // resident blobs, oldest first
+  size_t bs_resident;                 // total size of resident blobs
+  size_t bs_max;                      // resident size before we evict
+  bool bs_spill;                      // spill to disk rather than dropping?
+};
+
+/* Paxos blob GLib hashtable utilities. */
+unsigned blob_key_hash(const void *);
+int blob_key_equals(const void *, const void *);
+
+/* Blob store operations. */
+void blob_store_init(struct blob_store *, size_t);
+struct paxos_blob *blob_store_put(struct blob_store *, const void *, size_t,
+    unsigned, unsigned);
+struct paxos_blob *blob_store_expect(struct blob_store *, const char *);
+const char *blob_store_data(struct blob_store *, struct paxos_blob *);
+void blob_store_unpin(struct blob_store *, const char *);
+
+/* Chunk and reference helpers.  The pieces of a blob are its chunks, or its
+ * fragments if it is erasure coded. */
+unsigned blob_chunk_count(struct paxos_blob *);
+char *blob_chunk_copy(struct blob_store *, struct paxos_blob *, const char *,
+    unsigned, size_t *);
+bool blob_chunk_fill(struct blob_store *, struct paxos_blob *, const char *,
+    unsigned, const char *, size_t);
+void blob_ref_encode(struct paxos_blob *, char *);
+bool blob_ref_coded(const char *);
+
+#endif /* __PAXOS_TYPES_BLOB_H__ */
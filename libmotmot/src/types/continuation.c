@@ -19,6 +19,7 @@ continuation_new(motmot_connect_continuation_t func, paxid_t paxid)
   k = g_malloc0(sizeof(*k));
   k->pk_cb.func = func;
   k->pk_cb.data = k;
+  k->pk_state = state;
   k->pk_session_id = pax->session_id;
   k->pk_paxid = paxid;
 
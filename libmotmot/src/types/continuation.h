@@ -15,6 +15,7 @@
 /* Continuation-style callbacks for connect_t calls. */
 struct paxos_continuation {
   struct motmot_connect_cb pk_cb;     // Callback object
+  struct paxos_state *pk_state;       // state of the session's shard
   pax_uuid_t *pk_session_id;          // session ID of the continuation
   paxid_t pk_paxid;                   // ID of the target acceptor
   union {
@@ -49,6 +49,29 @@ typedef enum paxos_opcode {
   OP_SYNC,                // sync up ilists in preparation for a truncate
   OP_LAST,                // give the proposer our sync information
   OP_TRUNCATE,            // order acceptors to truncate their ilists
+
+  /* Later additions follow, in the order they were added, so that the
+   * opcodes above keep their values on the wire. */
+
+  /* Streamed initiation. */
+  OP_BACKFILL,            // stream the rest of the welcome to the new acceptor
+  OP_FETCH,               // ask any acceptor to stream us its ilist
+
+  /* Large payloads. */
+  OP_BLOB_GET,            // fetch chunks of a large chat payload
+  OP_BLOB_PUT,            // send a chunk of a large chat payload
+
+  /* Tree fan-out. */
+  OP_RELAY,               // forward a message down the relay tree
+
+  /* Catch-up after truncation. */
+  OP_SNAPSHOT,            // catch up an acceptor who missed a truncate
+
+  /* Restart recovery. */
+  OP_RESUME,              // rejoin under our old identity after a restart
+
+  /* Batched requests. */
+  OP_REQUESTS,            // request several chat decrees at once
 } paxop_t;
 
 /* Paxos message header that is included with any message. */
@@ -78,8 +101,8 @@ struct paxos_header {
    * - OP_REQUEST: The paxid of the acceptor who we think is the proposer who
    *   will send our request.  This allows us to send a redirect appropriately.
    *
-   * - OP_RETRIEVE, OP_RESEND: The instance number associated with the
-   *   desired request.
+   * - OP_RETRIEVE, OP_RESEND: The lowest instance number associated with
+   *   the batch of desired requests.
    *
    * - OP_REDIRECT, OP_REFUSE: The ID of the proposer we are redirecting to.
    *
@@ -91,6 +114,21 @@ struct paxos_header {
    *   proposer; this is used only by the proposer and is simply echoed across
    *   all messages in the sync operation.
    *
+   * - OP_BACKFILL: The instance number of the last instance in the stream for
+   *   the final chunk, and 0 for all others.
+   *
+   * - OP_FETCH: The instance number of the fetcher's last contiguous learn.
+   *
+   * - OP_BLOB_GET, OP_BLOB_PUT: Unused.
+   *
+   * - OP_RELAY: The ID of the acceptor at the root of the relay tree.
+   *
+   * - OP_SNAPSHOT: The instance number of the proposer's last learn.
+   *
+   * - OP_RESUME: The ID of the resumer.
+   *
+   * - OP_REQUESTS: As for OP_REQUEST.
+   *
    * Note that ALL of our ID's start counting at 1; 0 is always a sentinel
    * value.
    */
@@ -126,15 +164,33 @@ struct paxos_value {
   reqid_t pv_reqid;   // totally ordered request ID
   paxid_t pv_extra;   // we get one 32-bit data value (mostly for PART)
   /**
+   * For a PART or KILL, pv_extra is the ID of the departing acceptor; for a
+   * JOIN, it is nonzero iff the joiner is a learner, i.e., a member which
+   * receives commits but does not vote; for a CHAT, it holds CHAT_* flags.
+   *
    * In order to reduce network traffic, requesters broadcast any requests
    * carrying nontrivial data to all acceptors, associating with each a
    * session-unique ID (the combination of the requester's acceptor ID with
    * an incrementing requester-local request number).  Any data they pass
    * along is cached by the acceptors.  The proposer then makes decrees and
    * orders commits with values taking the form of this request ID.
+   *
+   * Small chats are instead sent only to the proposer, who packs the entire
+   * request in place of the value in its decrees and commits, so that
+   * acceptors can cache and learn the message without any retrieves.
+   *
+   * Large chats are instead stored in the blob store, and the request
+   * carries only a reference to them; learners fetch the chunks from their
+   * peers as they need them.  If the blob is erasure coded, the requester
+   * also pushes one fragment to each member up front, and learners rebuild
+   * the payload from any majority of fragments.
    */
 };
 
+/* Flags for the pv_extra of a CHAT. */
+#define CHAT_INLINE   0x1     // request rides in decrees and commits
+#define CHAT_BLOB     0x2     // request data is a reference to a blob
+
 int reqid_compare(reqid_t, reqid_t);
 
 void paxos_value_pack(struct paxos_yak *, struct paxos_value *);
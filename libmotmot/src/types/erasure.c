@@ -0,0 +1,197 @@
+/**
+ * erasure.c - Systematic Reed-Solomon erasure coding over GF(2^8).
+ *
+ * Fragments 0 through k - 1 are just the payload, striped and zero-padded.
+ * Fragment k + r is the r-th row of a Cauchy matrix applied to the stripes;
+ * since every square submatrix of a Cauchy matrix is invertible, any k
+ * fragments determine the stripes.
+ */
+
+#include <assert.h>
+#include <string.h>
+#include <glib.h>
+
+#include "types/erasure.h"
+
+static unsigned char gf_exp[512];
+static unsigned char gf_log[256];
+static gsize gf_ready = 0;
+
+/**
+ * Build the log and antilog tables for GF(2^8) modulo x^8+x^4+x^3+x^2+1.
+ * Shards code blobs concurrently, so the first caller builds them while any
+ * others wait.
+ */
+static void
+gf_init(void)
+{
+  unsigned i, x;
+
+  if (!g_once_init_enter(&gf_ready)) {
+    return;
+  }
+
+  for (i = 0, x = 1; i < 255; ++i) {
+    gf_exp[i] = x;
+    gf_log[x] = i;
+    x <<= 1;
+    if (x & 0x100) {
+      x ^= 0x11d;
+    }
+  }
+  for (i = 255; i < 512; ++i) {
+    gf_exp[i] = gf_exp[i - 255];
+  }
+
+  g_once_init_leave(&gf_ready, 1);
+}
+
+static inline unsigned char
+gf_mul(unsigned char a, unsigned char b)
+{
+  if (a == 0 || b == 0) {
+    return 0;
+  }
+  return gf_exp[gf_log[a] + gf_log[b]];
+}
+
+static inline unsigned char
+gf_inv(unsigned char a)
+{
+  return gf_exp[255 - gf_log[a]];
+}
+
+/**
+ * Get the coefficient of stripe j in fragment i.
+ */
+static unsigned char
+coefficient(unsigned k, unsigned i, unsigned j)
+{
+  if (i < k) {
+    return (i == j);
+  }
+  return gf_inv(i ^ j);
+}
+
+/**
+ * erasure_frag_size - Size of each fragment of a payload split k ways.
+ */
+size_t
+erasure_frag_size(size_t size, unsigned k)
+{
+  return (size + k - 1) / k;
+}
+
+/**
+ * erasure_encode - Write fragment i of n of a payload split k ways into frag,
+ * which must have room for erasure_frag_size(size, k) bytes.
+ */
+void
+erasure_encode(const char *data, size_t size, unsigned k, unsigned n,
+    unsigned i, char *frag)
+{
+  unsigned j;
+  unsigned char c;
+  size_t b, fs, off;
+
+  assert(k > 0 && k <= n && i < n && n <= ERASURE_MAX_FRAGS);
+  gf_init();
+
+  fs = erasure_frag_size(size, k);
+  memset(frag, 0, fs);
+
+  for (j = 0; j < k; ++j) {
+    c = coefficient(k, i, j);
+    if (c == 0) {
+      continue;
+    }
+    off = j * fs;
+    for (b = 0; b < fs && off + b < size; ++b) {
+      frag[b] ^= gf_mul(c, data[off + b]);
+    }
+  }
+}
+
+/**
+ * erasure_decode - Rebuild a payload from k fragments.  The s-th fragment,
+ * whose index is idx[s], lives at frags + s * erasure_frag_size(size, k).
+ * Returns false if the fragment indices aren't distinct.
+ */
+bool
+erasure_decode(const char *frags, const unsigned *idx, unsigned k,
+    unsigned n, size_t size, char *out)
+{
+  unsigned r, s, j;
+  unsigned char *m, *inv, c;
+  size_t b, fs, off;
+
+  assert(k > 0 && k <= n && n <= ERASURE_MAX_FRAGS);
+  gf_init();
+
+  fs = erasure_frag_size(size, k);
+  m = g_malloc(k * k);
+  inv = g_malloc0(k * k);
+
+  // Build the matrix taking stripes to the fragments we have, alongside an
+  // identity which we will turn into its inverse.
+  for (s = 0; s < k; ++s) {
+    for (j = 0; j < k; ++j) {
+      m[s * k + j] = coefficient(k, idx[s], j);
+    }
+    inv[s * k + s] = 1;
+  }
+
+  // Gauss-Jordan elimination.  Addition in GF(2^8) is XOR.
+  for (j = 0; j < k; ++j) {
+    for (r = j; r < k && m[r * k + j] == 0; ++r);
+    if (r == k) {
+      g_free(m);
+      g_free(inv);
+      return false;
+    }
+
+    if (r != j) {
+      for (s = 0; s < k; ++s) {
+        c = m[r * k + s];
+        m[r * k + s] = m[j * k + s];
+        m[j * k + s] = c;
+        c = inv[r * k + s];
+        inv[r * k + s] = inv[j * k + s];
+        inv[j * k + s] = c;
+      }
+    }
+
+    c = gf_inv(m[j * k + j]);
+    for (s = 0; s < k; ++s) {
+      m[j * k + s] = gf_mul(c, m[j * k + s]);
+      inv[j * k + s] = gf_mul(c, inv[j * k + s]);
+    }
+
+    for (r = 0; r < k; ++r) {
+      c = m[r * k + j];
+      if (r == j || c == 0) {
+        continue;
+      }
+      for (s = 0; s < k; ++s) {
+        m[r * k + s] ^= gf_mul(c, m[j * k + s]);
+        inv[r * k + s] ^= gf_mul(c, inv[j * k + s]);
+      }
+    }
+  }
+
+  // Each stripe is now a combination of the fragments we have.
+  for (j = 0; j < k; ++j) {
+    off = j * fs;
+    for (b = 0; b < fs && off + b < size; ++b) {
+      c = 0;
+      for (s = 0; s < k; ++s) {
+        c ^= gf_mul(inv[j * k + s], frags[s * fs + b]);
+      }
+      out[off + b] = c;
+    }
+  }
+
+  g_free(m);
+  g_free(inv);
+  return true;
+}
@@ -0,0 +1,20 @@
+/**
+ * erasure.h - Systematic Reed-Solomon erasure coding over GF(2^8).
+ */
+#ifndef __PAXOS_TYPES_ERASURE_H__
+#define __PAXOS_TYPES_ERASURE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define ERASURE_MAX_FRAGS   256
+
+/* Erasure coding routines.  A payload is split into k fragments, from which
+ * we derive n - k more; any k of the n fragments suffice to rebuild it. */
+size_t erasure_frag_size(size_t, unsigned);
+void erasure_encode(const char *, size_t, unsigned, unsigned, unsigned,
+    char *);
+bool erasure_decode(const char *, const unsigned *, unsigned, unsigned,
+    size_t, char *);
+
+#endif /* __PAXOS_TYPES_ERASURE_H__ */
@@ -0,0 +1,424 @@
+/**
+ * history.c - Memory-mapped history of learned chats.
+ *
+ * Segments are named hist.N for N counting up from 0, and are allocated at
+ * full size up front so that appending a record is just a copy into the
+ * mapping.  Every HISTORY_INDEX_STRIDE records, as well as at the start of
+ * each segment, we append a mark to the index file locating the record by
+ * instance number and time.  A lookup binary searches the marks and then
+ * walks at most a stride's worth of records.
+ *
+ * We leave writeback of the mappings to the kernel.  A crash may cost us
+ * the last few records, which is fine for a history, but it may also leave
+ * index marks or record headers pointing at pages that never made it to
+ * disk.  Each record therefore carries a checksum, and on opening we only
+ * trust a mark, or a record past the last mark, which checks out.
+ */
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <glib.h>
+#include <murmurhash3.h>
+
+#include "types/history.h"
+
+#define HISTORY_INDEX   "index"
+#define HISTORY_PAD(n)  (((n) + 7) & ~(size_t)7)
+
+/**
+ * Get the path of a segment.  The caller must free it.
+ */
+static char *
+history_path(struct history *h, unsigned n)
+{
+  return g_strdup_printf("%s/hist.%08u", h->h_dir, n);
+}
+
+/**
+ * Map the next segment.  If we are creating it, we allocate it at the given
+ * size; otherwise, it must already exist.
+ */
+static int
+history_map(struct history *h, size_t size, bool create)
+{
+  int fd;
+  char *path;
+  struct stat st;
+  struct history_segment seg;
+
+  path = history_path(h, h->h_segments->len);
+  fd = open(path, O_RDWR | (create ? O_CREAT : 0), 0600);
+  g_free(path);
+  if (fd < 0) {
+    return 1;
+  }
+
+  if (fstat(fd, &st) != 0 || (st.st_size == 0 && ftruncate(fd, size) != 0)) {
+    close(fd);
+    return 1;
+  }
+  seg.hs_size = (st.st_size == 0) ? size : (size_t)st.st_size;
+  seg.hs_base = mmap(NULL, seg.hs_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+      fd, 0);
+  close(fd);
+  if (seg.hs_base == MAP_FAILED) {
+    return 1;
+  }
+
+  g_array_append_val(h->h_segments, seg);
+  return 0;
+}
+
+/**
+ * Get the size of a record, including its padding.
+ */
+static inline size_t
+history_record_size(const struct history_record *rec)
+{
+  return HISTORY_PAD(sizeof(*rec) + rec->hr_desc_size + rec->hr_size);
+}
+
+/**
+ * Compute the checksum of a record with a given instance number.  It covers
+ * the instance number through the seed, so a record whose header reached the
+ * disk without its contents, or vice versa, fails it.
+ */
+static uint32_t
+history_record_check(const struct history_record *rec, uint64_t inum)
+{
+  uint32_t check;
+
+  MurmurHash3_x86_32(&rec->hr_time, sizeof(rec->hr_time) +
+      sizeof(rec->hr_desc_size) + sizeof(rec->hr_size), (uint32_t)inum,
+      &check);
+  MurmurHash3_x86_32(rec + 1, rec->hr_desc_size + rec->hr_size, check,
+      &check);
+  return check;
+}
+
+/**
+ * Get the record at a position, or NULL if there are no more records in its
+ * segment.
+ */
+static struct history_record *
+history_at(struct history *h, unsigned segment, size_t offset)
+{
+  struct history_segment *seg;
+  struct history_record *rec;
+
+  seg = &g_array_index(h->h_segments, struct history_segment, segment);
+  if (offset + sizeof(*rec) > seg->hs_size) {
+    return NULL;
+  }
+
+  rec = (struct history_record *)(seg->hs_base + offset);
+  if (rec->hr_inum == 0 || offset + history_record_size(rec) > seg->hs_size) {
+    return NULL;
+  }
+  return rec;
+}
+
+/**
+ * Mark the end of the records in the last segment, hiding anything left
+ * past it from before a crash.
+ */
+static void
+history_terminate(struct history *h)
+{
+  struct history_segment *seg;
+
+  seg = &g_array_index(h->h_segments, struct history_segment,
+      h->h_segments->len - 1);
+  if (h->h_used + sizeof(struct history_record) <= seg->hs_size) {
+    ((struct history_record *)(seg->hs_base + h->h_used))->hr_inum = 0;
+  }
+}
+
+/**
+ * Check that the record a mark points to is intact and is the one marked.
+ */
+static bool
+history_mark_valid(struct history *h, struct history_mark *mark)
+{
+  struct history_record *rec;
+
+  if (mark->hm_segment >= h->h_segments->len) {
+    return false;
+  }
+  rec = history_at(h, mark->hm_segment, mark->hm_offset);
+  return (rec != NULL && rec->hr_inum == mark->hm_inum &&
+      rec->hr_time == mark->hm_time &&
+      rec->hr_check == history_record_check(rec, rec->hr_inum));
+}
+
+/**
+ * Get the first record at or past a position, moving on to later segments
+ * as needed.  Returns NULL once we run out of records.
+ */
+static struct history_record *
+history_next(struct history *h, unsigned *segment, size_t *offset)
+{
+  struct history_record *rec;
+
+  for (; *segment < h->h_segments->len; ++*segment, *offset = 0) {
+    rec = history_at(h, *segment, *offset);
+    if (rec != NULL) {
+      return rec;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Find the last mark whose instance number, or time, is at most key.
+ */
+static struct history_mark *
+history_mark_find(struct history *h, uint64_t key, bool by_time)
+{
+  unsigned lo, hi, mid;
+  struct history_mark *mark;
+
+  lo = 0;
+  hi = h->h_marks->len;
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    mark = &g_array_index(h->h_marks, struct history_mark, mid);
+    if ((by_time ? mark->hm_time : mark->hm_inum) <= key) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  if (lo == 0) {
+    return NULL;
+  }
+  return &g_array_index(h->h_marks, struct history_mark, lo - 1);
+}
+
+/**
+ * history_open - Open the history in a directory, creating it if necessary.
+ */
+struct history *
+history_open(const char *dir)
+{
+  unsigned n;
+  size_t offset;
+  gsize len;
+  char *buf, *path;
+  struct history *h;
+  struct history_mark *mark;
+  struct history_record *rec;
+
+  if (g_mkdir_with_parents(dir, 0700) != 0) {
+    return NULL;
+  }
+
+  h = g_malloc0(sizeof(*h));
+  h->h_dir = g_strdup(dir);
+  h->h_index_fd = -1;
+  h->h_segments = g_array_new(FALSE, FALSE, sizeof(struct history_segment));
+  h->h_marks = g_array_new(FALSE, FALSE, sizeof(struct history_mark));
+
+  // Load the index, dropping any torn mark at its tail.
+  path = g_strdup_printf("%s/" HISTORY_INDEX, dir);
+  if (g_file_get_contents(path, &buf, &len, NULL)) {
+    g_array_append_vals(h->h_marks, buf, len / sizeof(*mark));
+    g_free(buf);
+  }
+
+  // Map the segments we have.
+  while (history_map(h, 0, false) == 0);
+
+  // Drop the marks at the tail of the index whose records didn't survive.
+  while (h->h_marks->len > 0) {
+    mark = &g_array_index(h->h_marks, struct history_mark,
+        h->h_marks->len - 1);
+    if (history_mark_valid(h, mark)) {
+      break;
+    }
+    g_array_set_size(h->h_marks, h->h_marks->len - 1);
+  }
+
+  h->h_index_fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0600);
+  g_free(path);
+  if (h->h_index_fd < 0 ||
+      ftruncate(h->h_index_fd, h->h_marks->len * sizeof(*mark)) != 0) {
+    history_close(h);
+    return NULL;
+  }
+  if (h->h_segments->len == 0) {
+    return h;
+  }
+
+  // Find the end of the last segment, walking from its last mark and
+  // stopping at the first record that fails its checksum.
+  n = h->h_segments->len - 1;
+  offset = 0;
+  if (h->h_marks->len > 0) {
+    mark = &g_array_index(h->h_marks, struct history_mark,
+        h->h_marks->len - 1);
+    h->h_last = mark->hm_inum;
+    if (mark->hm_segment == n) {
+      offset = mark->hm_offset;
+    }
+  }
+  while ((rec = history_at(h, n, offset)) != NULL &&
+      rec->hr_check == history_record_check(rec, rec->hr_inum)) {
+    h->h_last = rec->hr_inum;
+    h->h_unmarked = (h->h_unmarked + 1) % HISTORY_INDEX_STRIDE;
+    offset += history_record_size(rec);
+  }
+  h->h_used = offset;
+  history_terminate(h);
+
+  return h;
+}
+
+/**
+ * history_close - Unmap and free a history.
+ */
+void
+history_close(struct history *h)
+{
+  unsigned n;
+  struct history_segment *seg;
+
+  for (n = 0; n < h->h_segments->len; ++n) {
+    seg = &g_array_index(h->h_segments, struct history_segment, n);
+    munmap(seg->hs_base, seg->hs_size);
+  }
+  if (h->h_index_fd >= 0) {
+    close(h->h_index_fd);
+  }
+
+  g_array_free(h->h_segments, TRUE);
+  g_array_free(h->h_marks, TRUE);
+  g_free(h->h_dir);
+  g_free(h);
+}
+
+/**
+ * history_append - Append a chat to the history.  Chats must be appended in
+ * order of instance number; we ignore any we have already.
+ */
+int
+history_append(struct history *h, uint64_t inum, const char *desc,
+    size_t desc_size, const char *data, size_t size)
+{
+  size_t need;
+  struct history_segment *seg;
+  struct history_record *rec;
+  struct history_mark mark;
+
+  if (inum <= h->h_last) {
+    return 0;
+  }
+
+  // Start a new segment if the record doesn't fit in this one.
+  need = HISTORY_PAD(sizeof(*rec) + desc_size + size);
+  seg = NULL;
+  if (h->h_segments->len > 0) {
+    seg = &g_array_index(h->h_segments, struct history_segment,
+        h->h_segments->len - 1);
+  }
+  if (seg == NULL || h->h_used + need > seg->hs_size) {
+    if (history_map(h, MAX(HISTORY_SEGMENT_SIZE, need), true)) {
+      return 1;
+    }
+    seg = &g_array_index(h->h_segments, struct history_segment,
+        h->h_segments->len - 1);
+    h->h_used = 0;
+    h->h_unmarked = 0;
+    if (need > seg->hs_size) {
+      return 1;
+    }
+  }
+
+  // Fill in the record, ending the segment after it.  We write the instance
+  // number last, since it is what makes the record visible.
+  rec = (struct history_record *)(seg->hs_base + h->h_used);
+  rec->hr_time = g_get_real_time() / 1000;
+  rec->hr_desc_size = desc_size;
+  rec->hr_size = size;
+  rec->hr_unused = 0;
+  memcpy((char *)(rec + 1), desc, desc_size);
+  memcpy((char *)(rec + 1) + desc_size, data, size);
+  rec->hr_check = history_record_check(rec, inum);
+  h->h_used += need;
+  history_terminate(h);
+  rec->hr_inum = inum;
+
+  // Mark the record in the index if it's due.
+  if (h->h_unmarked == 0) {
+    mark.hm_inum = inum;
+    mark.hm_time = rec->hr_time;
+    mark.hm_segment = h->h_segments->len - 1;
+    mark.hm_offset = (char *)rec - seg->hs_base;
+    g_array_append_val(h->h_marks, mark);
+    if (write(h->h_index_fd, &mark, sizeof(mark)) != sizeof(mark)) {
+      g_warning("history_append: Could not write index mark.");
+    }
+  }
+  h->h_unmarked = (h->h_unmarked + 1) % HISTORY_INDEX_STRIDE;
+
+  h->h_last = inum;
+  return 0;
+}
+
+/**
+ * history_read - Fill in up to n records with instance numbers of at least
+ * from, in order.  Returns the number of records read.
+ */
+size_t
+history_read(struct history *h, uint64_t from,
+    const struct history_record **recs, size_t n)
+{
+  size_t count, offset;
+  unsigned segment;
+  struct history_mark *mark;
+  struct history_record *rec;
+
+  mark = history_mark_find(h, from, false);
+  segment = (mark == NULL) ? 0 : mark->hm_segment;
+  offset = (mark == NULL) ? 0 : mark->hm_offset;
+
+  count = 0;
+  while (count < n && (rec = history_next(h, &segment, &offset)) != NULL) {
+    if (rec->hr_inum >= from) {
+      recs[count++] = rec;
+    }
+    offset += history_record_size(rec);
+  }
+
+  return count;
+}
+
+/**
+ * history_find_time - Get the instance number of the first record learned
+ * at or after a time, or 0 if there is none.
+ */
+uint64_t
+history_find_time(struct history *h, uint64_t time)
+{
+  size_t offset;
+  unsigned segment;
+  struct history_mark *mark;
+  struct history_record *rec;
+
+  mark = history_mark_find(h, time, true);
+  segment = (mark == NULL) ? 0 : mark->hm_segment;
+  offset = (mark == NULL) ? 0 : mark->hm_offset;
+
+  while ((rec = history_next(h, &segment, &offset)) != NULL) {
+    if (rec->hr_time >= time) {
+      return rec->hr_inum;
+    }
+    offset += history_record_size(rec);
+  }
+
+  return 0;
+}
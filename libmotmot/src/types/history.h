@@ -0,0 +1,77 @@
+/**
+ * history.h - Memory-mapped history of learned chats.
+ */
+#ifndef __PAXOS_TYPES_HISTORY_H__
+#define __PAXOS_TYPES_HISTORY_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <glib.h>
+
+#define HISTORY_SEGMENT_SIZE  (64 << 20)
+#define HISTORY_INDEX_STRIDE  64
+
+/* Header of a record in a history segment.  It is followed by the sender's
+ * descriptor and then the chat itself, padded to a multiple of 8 bytes.  A
+ * zero hr_inum marks the end of the records in a segment. */
+struct history_record {
+  uint64_t hr_inum;       // instance number of the chat
+  uint64_t hr_time;       // when we learned it, in ms since the epoch
+  uint32_t hr_desc_size;  // size of the sender's descriptor
+  uint32_t hr_size;       // size of the chat
+  uint32_t hr_check;      // checksum of everything else in the record
+  uint32_t hr_unused;     // zero
+};
+
+/* An entry of the sparse index, made for every HISTORY_INDEX_STRIDE'th
+ * record. */
+struct history_mark {
+  uint64_t hm_inum;       // instance number of the record
+  uint64_t hm_time;       // time of the record
+  uint32_t hm_segment;    // index of the segment holding the record
+  uint32_t hm_offset;     // offset of the record in its segment
+};
+
+/* A segment file, mapped into memory. */
+struct history_segment {
+  char *hs_base;          // the mapping
+  size_t hs_size;         // size of the mapping
+};
+
+/* An append-only history of learned chats, kept in a directory of segments
+ * alongside a file of index marks. */
+struct history {
+  char *h_dir;            // directory of segments and the index
+  int h_index_fd;         // descriptor of the index file
+  GArray *h_segments;     // the segments, in order
+  GArray *h_marks;        // the sparse index, in order
+  size_t h_used;          // bytes of records in the last segment
+  uint64_t h_last;        // instance number of the last record
+  unsigned h_unmarked;    // records since the last mark
+};
+
+/* Record accessors. */
+static inline const char *
+history_record_desc(const struct history_record *rec)
+{
+  return (const char *)(rec + 1);
+}
+
+static inline const char *
+history_record_data(const struct history_record *rec)
+{
+  return history_record_desc(rec) + rec->hr_desc_size;
+}
+
+/* History operations.  Records we read point directly into our mappings, so
+ * they remain valid until the history is closed. */
+struct history *history_open(const char *);
+void history_close(struct history *);
+int history_append(struct history *, uint64_t, const char *, size_t,
+    const char *, size_t);
+size_t history_read(struct history *, uint64_t,
+    const struct history_record **, size_t);
+uint64_t history_find_time(struct history *, uint64_t);
+
+#endif /* __PAXOS_TYPES_HISTORY_H__ */
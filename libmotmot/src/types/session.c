@@ -8,6 +8,26 @@
 #include "containers/list_factory.h"
 #include "types/session.h"
 
+/**
+ * Hash a request ID.
+ */
+static unsigned
+reqid_hash(const void *data)
+{
+  const reqid_t *reqid = data;
+
+  return (reqid->id * 2654435761u) ^ reqid->gen;
+}
+
+/**
+ * Compare two request IDs for equality.
+ */
+static int
+reqid_equals(const void *x, const void *y)
+{
+  return reqid_compare(*(const reqid_t *)x, *(const reqid_t *)y) == 0;
+}
+
 struct paxos_session *
 session_new(void *data, int gen_uuid)
 {
@@ -21,9 +41,11 @@ session_new(void *data, int gen_uuid)
     pax_uuid_gen(session->session_id);
   }
   session->client_data = data;
+  session->options = state->options;
+  session->shard = state->shard;
 
   // Insert into the sessions list.
-  session_insert(&state.sessions, session);
+  session_insert(&state->sessions, session);
 
   // Initialize all our lists.
   LIST_INIT(&session->alist);
@@ -32,6 +54,7 @@ session_new(void *data, int gen_uuid)
   LIST_INIT(&session->ilist);
   LIST_INIT(&session->idefer);
   LIST_INIT(&session->rcache);
+  session->rindex = g_hash_table_new(reqid_hash, reqid_equals);
 
   return session;
 }
@@ -45,10 +68,62 @@ session_destroy(struct paxos_session *session)
   continuation_container_destroy(&pax->clist);
   instance_container_destroy(&pax->ilist);
   instance_container_destroy(&pax->idefer);
+  g_hash_table_destroy(pax->rindex);
   request_container_destroy(&pax->rcache);
 
+  if (session->history != NULL) {
+    history_close(session->history);
+  }
+  g_free(session->backfill);
   g_free(session);
 }
 
+///////////////////////////////////////////////////////////////////////////
+//
+//  Request cache.
+//
+//  The cache is looked up and pruned one request at a time as instances are
+//  committed and truncated, so we index it by request ID rather than keeping
+//  it sorted.
+//
+
+/**
+ * rcache_find - Find a cached request by its ID.
+ */
+struct paxos_request *
+rcache_find(struct paxos_session *session, reqid_t reqid)
+{
+  return g_hash_table_lookup(session->rindex, &reqid);
+}
+
+/**
+ * rcache_insert - Cache a request.  If one with the same ID is already
+ * cached, return it and leave the new one alone.
+ */
+struct paxos_request *
+rcache_insert(struct paxos_session *session, struct paxos_request *req)
+{
+  struct paxos_request *old;
+
+  old = rcache_find(session, req->pr_val.pv_reqid);
+  if (old != NULL) {
+    return old;
+  }
+
+  LIST_INSERT_TAIL(&session->rcache, req, pr_le);
+  g_hash_table_insert(session->rindex, &req->pr_val.pv_reqid, req);
+  return req;
+}
+
+/**
+ * rcache_remove - Uncache a request, without freeing it.
+ */
+void
+rcache_remove(struct paxos_session *session, struct paxos_request *req)
+{
+  g_hash_table_remove(session->rindex, &req->pr_val.pv_reqid);
+  LIST_REMOVE(&session->rcache, req, pr_le);
+}
+
 LIST_IMPLEMENT(session, pax_uuid_t *, session_le, session_id, pax_uuid_compare,
     session_destroy, _FWD, _FWD);
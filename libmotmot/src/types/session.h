@@ -11,6 +11,7 @@
 #include "types/primitives.h"
 #include "types/core.h"
 #include "types/continuation.h"
+#include "types/history.h"
 #include "types/session_local.h"
 
 /* Preparation state used by new proposers. */
@@ -29,12 +30,41 @@ struct paxos_sync {
   paxid_t ps_last;        // the last contiguous learn across the system
 };
 
+/* Backfill state used by new acceptors while their welcome streams in. */
+struct paxos_backfill {
+  paxid_t pb_learned;     // the proposer had learned everything below this
+  paxid_t pb_source;      // acceptor streaming to us; 0 if not yet fetched
+  unsigned pb_connects;   // connections pending before we pick a source
+  bool pb_resume;         // are we resuming after a restart?
+};
+
+/* Tunable protocol options; see motmot_option_t. */
+struct paxos_options {
+  bool po_snapshot_join;  // do joiners pull their log from a peer?
+  bool po_thrifty;        // do we decree to just a majority at first?
+  unsigned po_max_voters; // joiners past this many voters are learners
+  unsigned po_quorum[2];  // prepare and accept quorums; 0 for majority
+  unsigned po_inline_max; // chats of at most this many bytes ride in decrees
+  unsigned po_blob_min;   // chats of at least this many bytes are blobs
+  bool po_erasure;        // do we push erasure-coded fragments of blobs?
+  unsigned po_fanout;     // relay tree fanout; 0 to send directly
+  unsigned po_star;       // successors we connect to; 0 for a full mesh
+  unsigned po_sync_count; // sync once this many instances are unsynced
+  unsigned po_sync_bytes; // sync once this many request bytes are cached
+  unsigned po_sync_delay; // longest we let learns go unsynced, in ms
+  unsigned po_part_delay; // ms we wait for the dropped to resume before parting
+};
+
 /* Session state. */
 struct paxos_session {
   pax_uuid_t *session_id;             // ID of the Paxos session
   void *client_data;                  // opaque client session object
+  bool ended;                         // have we left, pending the client?
+  struct paxos_shard *shard;          // shard running the session
+  struct paxos_options options;       // tunable protocol options
 
   paxid_t self_id;                    // our own acceptor ID
+  bool learner;                       // are we a non-voting member?
   paxid_t req_id;                     // local incrementing request ID
   struct paxos_acceptor *proposer;    // the acceptor we think is the proposer
   ballot_t ballot;                    // identity of the current ballot
@@ -42,11 +72,23 @@ struct paxos_session {
   paxid_t gen_high;                   // high water mark of ballots we've seen
   struct paxos_prep *prep;            // prepare state; NULL if not preparing
 
+  paxid_t thrifty_next;               // first target of our next thrifty decree
+  paxid_t thrifty_mark;               // thrifty decrees below this are overdue
+  bool thrifty_pending;               // is a widen scheduled?
+
   paxid_t sync_id;                    // locally-unique sync ID
   paxid_t sync_prev;                  // sync point of the last sync
   struct paxos_sync *sync;            // sync state; NULL if not syncing
+  bool sync_armed;                    // is a sync timer running?
+  size_t rcache_bytes;                // bytes of learned requests cached
+  bool truncate_pending;              // is a truncation slice scheduled?
+  gint64 truncate_stall;              // longest truncation slice so far, in us
+
+  struct paxos_backfill *backfill;    // backfill state; NULL if not joining
+  bool backfill_pending;              // is a backfill stream scheduled?
 
   unsigned live_count;                // number of acceptors we think are live
+  unsigned learner_count;             // number of learners in the alist
   acceptor_container alist;           // list of all Paxos participants
   acceptor_container adefer;          // list of deferred hello acks
   continuation_container clist;       // list of connectinuations
@@ -54,11 +96,18 @@ struct paxos_session {
   instance_container ilist;           // list of all instances
   instance_container idefer;          // list of deferred instances
   request_container rcache;           // cached requests waiting for commit
+  GHashTable *rindex;                 // rcache, by request ID
+  bool retrieve_pending;              // is a retrieve flush scheduled?
+  bool retrieve_retry;                // is a retrieve retry scheduled?
+  bool blob_pending;                  // is a blob fetch scheduled?
+  unsigned blob_round;                // rotates blob fetches among peers
 
   paxid_t ibase;                      // base value for instance numbers
   paxid_t ihole;                      // number of first uncommitted instance
   struct paxos_instance *istart;      // lower bound instance of first hole
 
+  struct history *history;            // chats we have learned; may be NULL
+
   LIST_ENTRY(paxos_session) session_le; // session list entry
 };
 
@@ -66,4 +115,9 @@ LIST_DECLARE(session, pax_uuid_t *);
 struct paxos_session *session_new(void *, int);
 void session_destroy(struct paxos_session *);
 
+struct paxos_request *rcache_find(struct paxos_session *, reqid_t);
+struct paxos_request *rcache_insert(struct paxos_session *,
+    struct paxos_request *);
+void rcache_remove(struct paxos_session *, struct paxos_request *);
+
 #endif /* __PAXOS_TYPES_SESSION_H__ */
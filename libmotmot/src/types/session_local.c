@@ -19,6 +19,11 @@ instance_init_metadata(struct paxos_instance *inst)
   inst->pi_committed = false;
   inst->pi_cached = false;
   inst->pi_learned = false;
+  inst->pi_retrieve = false;
+  inst->pi_retried = false;
+  inst->pi_committing = false;
+  inst->pi_subset_lo = 0;
+  inst->pi_subset_hi = 0;
   inst->pi_votes = 1;
   inst->pi_rejects = 0;
 }
@@ -60,7 +65,11 @@ void
 request_destroy(struct paxos_request *req)
 {
   if (req != NULL) {
-    g_free(req->pr_data);
+    if (req->pr_release != NULL) {
+      req->pr_release(req->pr_data, req->pr_release_arg);
+    } else {
+      g_free(req->pr_data);
+    }
   }
   g_free(req);
 }
@@ -73,10 +82,11 @@ request_destroy(struct paxos_request *req)
 void
 paxos_acceptor_pack(struct paxos_yak *py, struct paxos_acceptor *acc)
 {
-  msgpack_pack_array(py->pk, 2);
+  msgpack_pack_array(py->pk, 3);
   msgpack_pack_paxid(py->pk, acc->pa_paxid);
   msgpack_pack_raw(py->pk, acc->pa_size);
   msgpack_pack_raw_body(py->pk, acc->pa_desc, acc->pa_size);
+  acc->pa_learner ? msgpack_pack_true(py->pk) : msgpack_pack_false(py->pk);
 }
 
 void
@@ -86,7 +96,7 @@ paxos_acceptor_unpack(struct paxos_acceptor *acc, msgpack_object *o)
 
   // Make sure the input is well-formed.
   assert(o->type == MSGPACK_OBJECT_ARRAY);
-  assert(o->via.array.size == 2);
+  assert(o->via.array.size == 3);
 
   p = o->via.array.ptr;
 
@@ -96,6 +106,9 @@ paxos_acceptor_unpack(struct paxos_acceptor *acc, msgpack_object *o)
   assert(p->type == MSGPACK_OBJECT_RAW);
   acc->pa_size = p->via.raw.size;
   acc->pa_desc = g_memdup(p->via.raw.ptr, p->via.raw.size);
+  p++;
+  assert(p->type == MSGPACK_OBJECT_BOOLEAN);
+  acc->pa_learner = (p++)->via.boolean;
 }
 
 void
@@ -127,6 +140,11 @@ paxos_instance_unpack(struct paxos_instance *inst, msgpack_object *o)
   // Set everything else to 0.
   inst->pi_cached = false;
   inst->pi_learned = false;
+  inst->pi_retrieve = false;
+  inst->pi_retried = false;
+  inst->pi_committing = false;
+  inst->pi_subset_lo = 0;
+  inst->pi_subset_hi = 0;
   inst->pi_votes = 0;
   inst->pi_rejects = 0;
 }
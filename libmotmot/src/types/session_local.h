@@ -15,6 +15,9 @@ struct paxos_acceptor {
   paxid_t pa_paxid;                   // instance number of the agent's JOIN
   struct paxos_connect *pa_conn;      // connection to acceptor
   LIST_ENTRY(paxos_acceptor) pa_le;   // sorted linked list of all participants
+  bool pa_learner;                    // true if the acceptor doesn't vote
+  struct paxos_instance *pa_backfill; // next instance to stream to a newcomer
+  paxid_t pa_backfill_end;            // last instance to stream to a newcomer
   // TODO: remove
   struct paxos_peer *pa_peer;
   size_t pa_size;
@@ -30,6 +33,11 @@ struct paxos_instance {
   bool pi_committed;                  // true if a commit has been received
   bool pi_cached;                     // true if the request is cached; not sent
   bool pi_learned;                    // true if learned; not sent
+  bool pi_retrieve;                   // true if a retrieve is queued; not sent
+  bool pi_retried;                    // true if retrieves go to all; not sent
+  bool pi_committing;                 // true if our commit awaits a log sync
+  paxid_t pi_subset_lo;               // first thrifty decree target; not sent
+  paxid_t pi_subset_hi;               // last thrifty decree target; not sent
   unsigned pi_votes;                  // number of accepts; not sent
   unsigned pi_rejects;                // number of rejects; not sent
   LIST_ENTRY(paxos_instance) pi_le;   // sorted linked list of instances
@@ -45,6 +53,8 @@ struct paxos_request {
   struct paxos_value pr_val;          // request ID and kind
   size_t pr_size;                     // size of data
   void *pr_data;                      // data pointer dependent on kind
+  void (*pr_release)(void *, void *); // releases client-owned data, if any
+  void *pr_release_arg;               // argument to pr_release
   LIST_ENTRY(paxos_request) pr_le;    // sorted linked list of requests
 };
 
@@ -0,0 +1,215 @@
+/**
+ * wal.c - Segmented write-ahead log.
+ *
+ * Segments are named wal.N for increasing N.  We never append to a segment
+ * left over from a previous run, since its tail may be torn; instead we
+ * replay the old segments and start a new one.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <glib.h>
+
+#include "types/wal.h"
+
+#define WAL_PREFIX  "wal."
+
+/**
+ * Get the path of a segment.  The caller must free it.
+ */
+static char *
+wal_path(struct wal *wal, unsigned n)
+{
+  return g_strdup_printf("%s/" WAL_PREFIX "%08u", wal->w_dir, n);
+}
+
+/**
+ * Open a fresh segment to append to.
+ */
+static int
+wal_start_segment(struct wal *wal)
+{
+  char *path;
+
+  path = wal_path(wal, wal->w_segment);
+  wal->w_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0600);
+  g_free(path);
+
+  wal->w_size = 0;
+  wal->w_dirty = false;
+
+  return (wal->w_fd < 0);
+}
+
+/**
+ * wal_open - Open the log in a directory, creating it if necessary.  The
+ * segments already there are left for wal_replay.
+ */
+int
+wal_open(struct wal *wal, const char *dir)
+{
+  unsigned n;
+  const char *name;
+  GDir *d;
+
+  if (g_mkdir_with_parents(dir, 0700) != 0) {
+    return 1;
+  }
+  d = g_dir_open(dir, 0, NULL);
+  if (d == NULL) {
+    return 1;
+  }
+
+  wal->w_dir = g_strdup(dir);
+  wal->w_first = 0;
+  wal->w_segment = 0;
+
+  // Find the range of segments we have.
+  while ((name = g_dir_read_name(d)) != NULL) {
+    if (!g_str_has_prefix(name, WAL_PREFIX)) {
+      continue;
+    }
+    n = strtoul(name + sizeof(WAL_PREFIX) - 1, NULL, 10);
+    if (n == 0) {
+      continue;
+    }
+    if (wal->w_first == 0 || n < wal->w_first) {
+      wal->w_first = n;
+    }
+    if (n > wal->w_segment) {
+      wal->w_segment = n;
+    }
+  }
+  g_dir_close(d);
+
+  if (wal->w_first == 0) {
+    wal->w_first = 1;
+  }
+  wal->w_segment++;
+
+  if (wal_start_segment(wal)) {
+    g_free(wal->w_dir);
+    wal->w_dir = NULL;
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * wal_replay - Invoke a callback on every record in the segments which
+ * predate the one we are appending to, oldest first, stopping at the first
+ * torn or corrupt record of each.
+ */
+int
+wal_replay(struct wal *wal, wal_replay_t cb, void *data)
+{
+  unsigned n;
+  char *path, *buf;
+  gsize len;
+  size_t off, rec;
+  msgpack_unpacked result;
+
+  msgpack_unpacked_init(&result);
+
+  for (n = wal->w_first; n < wal->w_segment; ++n) {
+    path = wal_path(wal, n);
+    if (!g_file_get_contents(path, &buf, &len, NULL)) {
+      // Pruning may have left gaps.
+      g_free(path);
+      continue;
+    }
+    g_free(path);
+
+    off = 0;
+    for (rec = off; msgpack_unpack_next(&result, buf, len, &off); rec = off) {
+      if (cb(&result.data, data)) {
+        off = rec;
+        break;
+      }
+    }
+    if (off != len) {
+      g_warning("wal_replay: Discarding torn tail of segment %u.", n);
+    }
+
+    g_free(buf);
+  }
+
+  msgpack_unpacked_destroy(&result);
+  return 0;
+}
+
+/**
+ * wal_append - Append a record.  It isn't durable until the next wal_sync.
+ */
+int
+wal_append(struct wal *wal, const char *data, size_t len)
+{
+  ssize_t r;
+  size_t off;
+
+  for (off = 0; off < len; off += r) {
+    r = write(wal->w_fd, data + off, len - off);
+    if (r < 0 && errno == EINTR) {
+      r = 0;
+    } else if (r <= 0) {
+      return 1;
+    }
+  }
+
+  wal->w_size += len;
+  wal->w_dirty = true;
+  return 0;
+}
+
+/**
+ * wal_sync - Make everything we have appended durable.
+ */
+int
+wal_sync(struct wal *wal)
+{
+  if (!wal->w_dirty) {
+    return 0;
+  }
+  if (fdatasync(wal->w_fd) != 0) {
+    return 1;
+  }
+
+  wal->w_dirty = false;
+  return 0;
+}
+
+/**
+ * wal_rotate - Sync the current segment and start appending to a new one.
+ */
+int
+wal_rotate(struct wal *wal)
+{
+  int r;
+
+  r = wal_sync(wal);
+  close(wal->w_fd);
+
+  wal->w_segment++;
+  return r | wal_start_segment(wal);
+}
+
+/**
+ * wal_prune - Delete every segment before the one we are appending to.  The
+ * caller should first make sure the current segment supersedes them.
+ */
+void
+wal_prune(struct wal *wal)
+{
+  unsigned n;
+  char *path;
+
+  for (n = wal->w_first; n < wal->w_segment; ++n) {
+    path = wal_path(wal, n);
+    unlink(path);
+    g_free(path);
+  }
+
+  wal->w_first = wal->w_segment;
+}
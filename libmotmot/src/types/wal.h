@@ -0,0 +1,38 @@
+/**
+ * wal.h - Segmented write-ahead log.
+ */
+#ifndef __PAXOS_TYPES_WAL_H__
+#define __PAXOS_TYPES_WAL_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <msgpack.h>
+
+#define WAL_SEGMENT_MAX   (16 << 20)
+
+/* An append-only log of msgpack records, split across numbered segment files
+ * in a directory.  A torn or corrupt record ends our replay of the segment
+ * it is in. */
+struct wal {
+  char *w_dir;            // directory of segments; NULL if we aren't logging
+  int w_fd;               // descriptor of the segment we append to
+  unsigned w_first;       // number of our oldest segment
+  unsigned w_segment;     // number of the segment we append to
+  size_t w_size;          // bytes appended to the current segment
+  bool w_dirty;           // have we appended since our last sync?
+};
+
+/* Callback invoked on each record during a replay.  It returns nonzero if
+ * the record is corrupt, which ends our replay of the segment like a torn
+ * tail would. */
+typedef int (*wal_replay_t)(msgpack_object *, void *);
+
+/* Write-ahead log operations. */
+int wal_open(struct wal *, const char *);
+int wal_replay(struct wal *, wal_replay_t, void *);
+int wal_append(struct wal *, const char *, size_t);
+int wal_sync(struct wal *);
+int wal_rotate(struct wal *);
+void wal_prune(struct wal *);
+
+#endif /* __PAXOS_TYPES_WAL_H__ */
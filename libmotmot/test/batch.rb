@@ -0,0 +1,65 @@
+#!/usr/bin/env ruby
+
+# Delivers chats through the batch callback, which prints a BATCH line with
+# the size of each run ahead of its chats.  Every chat must come in exactly
+# one run, in order, and a join must fall between runs rather than within
+# one.  One member is frozen while chats pile up, so that when it thaws it
+# learns them together.
+
+require_relative './group'
+
+COUNT = 100
+
+# Read a member's output until it has learned count chats, checking that
+# every chat comes in a batch of the size announced, and returning the
+# chats, and the joins of the given member, in the order they came.
+def stream member, count, joiner
+  events, left, chats = [], 0, 0
+  pattern = /^(BATCH: \d+|CHAT\(.*\): |JOIN: #{Regexp.escape joiner.sock}$)/
+  while chats < count
+    line = member.expect(pattern, 1, 60)
+    case line
+    when /^BATCH: (\d+)$/
+      abort 'batch: batch cut short' unless left == 0
+      left = $1.to_i
+      abort 'batch: empty batch' if left == 0
+    when /^CHAT\(.*?\): (.*)$/
+      abort 'batch: chat outside a batch' if left == 0
+      events << $1
+      left -= 1
+      chats += 1
+    else
+      abort 'batch: join within a batch' unless left == 0
+      events << :join
+    end
+  end
+  abort 'batch: batch cut short' unless left == 0
+  events
+end
+
+scratch do
+  env = { 'MOTMOT_BATCH' => '1' }
+  members = group 3 do |i|
+    env
+  end
+  one = COUNT.times.map { |i| "one #{i}" }
+  two = COUNT.times.map { |i| "two #{i}" }
+
+  members[2].stop
+  one.each { |msg| members[0].say msg }
+  joiner = Member.new 'm3', [], env
+  $members << joiner
+  members[0].say "/invite #{joiner.sock}"
+  joiner.expect(/^Welcome/)
+  two.each { |msg| members[1].say msg }
+  members[2].cont
+
+  members[0..2].each do |m|
+    abort 'batch: chats or join out of order' unless
+        stream(m, 2 * COUNT, joiner) == one + [:join] + two
+  end
+  abort 'batch: joiner learned the wrong chats' unless
+      stream(joiner, COUNT, joiner) - [:join] == two
+end
+
+puts 'batch: ok'
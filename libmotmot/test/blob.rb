@@ -0,0 +1,32 @@
+#!/usr/bin/env ruby
+
+# Sends chats several blob chunks long through a three-member session, one
+# of them twice over, and checks that each arrives intact.  One member is
+# frozen throughout, and the sender dies before it thaws, so that member
+# must fetch every payload from the one peer left holding it.
+
+require_relative './group'
+
+COUNT = 10
+
+def payload i
+  "blob #{i} " + ("%05d" % i) * 8000
+end
+
+scratch do
+  members = group 3 do |i|
+    { 'MOTMOT_BLOB_MIN' => '1024' }
+  end
+  sent = COUNT.times.map { |i| payload i } + [payload(0)]
+
+  members[2].stop
+  sent.each { |msg| members[1].say msg }
+  abort 'blob: payloads corrupted' unless members[0].chats(sent.size) == sent
+
+  members[1].kill
+  members[2].cont
+  abort 'blob: refetched payloads corrupted' unless
+      members[2].chats(sent.size) == sent
+end
+
+puts 'blob: ok'
@@ -0,0 +1,55 @@
+#!/usr/bin/env ruby
+
+# Runs two independent contexts in the first two of three processes, each
+# with its own socket and its own session: all three members are in the
+# first session, but only the first two are in the second.  Chats in one
+# session must never show up in the other, and each session must see its
+# own chats in the same order at every member.
+
+require_relative './group'
+
+COUNT = 200
+
+# Collect a member's chats from both of its contexts, in order, until it has
+# learned the given number from each.
+def both member, first, second
+  logs = { '' => [], '2' => [] }
+  while logs[''].size < first || logs['2'].size < second
+    line = member.expect(/^CHAT2?\(/, 1, 60)
+    line =~ /^CHAT(2?)\(.*?\): (.*)$/
+    logs[$1] << $2
+  end
+  logs
+end
+
+scratch do
+  members = group 3 do |i|
+    case i
+    when 0 then { 'MOTMOT_SECOND' => "#{SCRATCH}b0 #{SCRATCH}b1" }
+    when 1 then { 'MOTMOT_SECOND' => "#{SCRATCH}b1" }
+    else {}
+    end
+  end
+
+  members[0].say '/second ready'
+  [0, 1].each { |j| members[j].expect(/^CHAT2\(.*\): ready$/) }
+
+  COUNT.times do |i|
+    members[2].say "first #{i}"
+    members[1].say "/second second #{i}"
+  end
+  first = COUNT.times.map { |i| "first #{i}" }
+  second = COUNT.times.map { |i| "second #{i}" }
+
+  [0, 1].each do |j|
+    logs = both members[j], COUNT, COUNT
+    abort 'ctx: first session crossed or out of order' unless
+        logs[''] == first
+    abort 'ctx: second session crossed or out of order' unless
+        logs['2'] == second
+  end
+  abort 'ctx: first session went wrong at its own member' unless
+      members[2].chats(COUNT) == first
+end
+
+puts 'ctx: ok'
@@ -0,0 +1,33 @@
+#!/usr/bin/env ruby
+
+# Runs a three-member session in which two members take 10ms over every
+# chat callback, but have their callbacks delivered on a thread of their
+# own.  Their slowness must not hold up the chat: the proposer, which needs
+# one of them to commit anything, learns every chat well before either of
+# them has got through half.  They must still learn everything, in order.
+
+require_relative './group'
+
+COUNT = 200
+
+scratch do
+  members = group 3 do |i|
+    (i == 0) ? {} : { 'MOTMOT_DELIVER' => '1', 'MOTMOT_CHAT_DELAY' => '10' }
+  end
+  sent = COUNT.times.map { |i| "deliver #{i}" }
+
+  sent.each { |msg| members[0].say msg }
+  abort 'deliver: proposer learned chats out of order' unless
+      members[0].chats(COUNT) == sent
+  done = members[0].arrived
+
+  [1, 2].each do |j|
+    log = members[j].chats(COUNT / 2)
+    abort 'deliver: slow callbacks held up the chat' unless
+        members[j].arrived > done
+    log += members[j].chats(COUNT - COUNT / 2)
+    abort 'deliver: delivered chats out of order' unless log == sent
+  end
+end
+
+puts 'deliver: ok'
@@ -0,0 +1,36 @@
+#!/usr/bin/env ruby
+
+# Sends erasure-coded chats through a five-member session, in which any
+# three of the five fragments rebuild a payload.  One member is frozen
+# while they go out; then the sender and one other member die, and the
+# frozen member thaws.  It can only rebuild the payloads from its own
+# fragments and those of the two members left, which must be exactly enough.
+# The dead are kept in the membership so that fragments keep their places.
+
+require_relative './group'
+
+COUNT = 5
+
+def payload i
+  "coded #{i} " + ("%05d" % i) * 8000
+end
+
+scratch do
+  members = group 5 do |i|
+    { 'MOTMOT_BLOB_MIN' => '1024', 'MOTMOT_ERASURE' => '1',
+      'MOTMOT_PART_DELAY' => '60000' }
+  end
+  sent = COUNT.times.map { |i| payload i }
+
+  members[3].stop
+  sent.each { |msg| members[4].say msg }
+  abort 'erasure: payloads corrupted' unless members[0].chats(COUNT) == sent
+
+  members[4].kill
+  members[2].kill
+  members[3].cont
+  abort 'erasure: rebuilt payloads corrupted' unless
+      members[3].chats(COUNT) == sent
+end
+
+puts 'erasure: ok'
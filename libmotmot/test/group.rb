@@ -0,0 +1,97 @@
+# Helpers for driving a group of motmot processes and watching their output,
+# without the debugger plumbing of lib.rb.
+
+require 'fileutils'
+require 'thread'
+require 'timeout'
+
+MOTMOT_PATH = File.dirname(__FILE__) + '/../src/motmot'
+SCRATCH = 'scratch/'
+
+class Member
+  attr_reader :sock
+  attr_reader :arrived    # when the line expect last returned was read
+
+  def initialize name, connect=[], env={}
+    @sock = SCRATCH + name
+    @env = env
+    start connect
+  end
+
+  # (Re)start the process, inviting the given members.
+  def start connect=[]
+    FileUtils.rm_f @sock
+    @io = IO.popen [@env, MOTMOT_PATH, @sock, *connect.map(&:sock)], 'r+',
+        err: [:child, :out]
+    @lines = Queue.new
+    Thread.new do
+      @io.each_line { |line| @lines << [line.chomp, Time.now] }
+    end
+  end
+
+  def say msg
+    @io.write msg + "\n"
+    @io.flush
+  end
+
+  # Wait until n lines of output match pattern, returning the last one.
+  def expect pattern, n=1, timeout=30
+    line = nil
+    Timeout.timeout timeout do
+      while n > 0
+        line, @arrived = @lines.pop
+        n -= 1 if line =~ pattern
+      end
+    end
+    line
+  end
+
+  # Collect the messages of the next n chats learned, in order.
+  def chats n, timeout=60
+    n.times.map do
+      expect(/^CHAT\(.*\): /, 1, timeout).sub(/^CHAT\(.*?\): /, '')
+    end
+  end
+
+  # Freeze the process, leaving its connections open, as a stalled member
+  # would; and thaw it again.
+  def stop
+    Process.kill 'STOP', @io.pid
+  end
+
+  def cont
+    Process.kill 'CONT', @io.pid
+  end
+
+  def kill
+    Process.kill 'KILL', @io.pid
+    Process.wait @io.pid
+    @io.close
+  rescue Errno::ESRCH, Errno::ECHILD, IOError
+    # Already gone.
+  end
+end
+
+module Kernel
+  # Start a session of n members, the first of which invites the rest.  The
+  # block, if given, maps a member's index to its environment.
+  def group n
+    env = block_given? ? lambda { |i| yield i } : lambda { |i| {} }
+    others = (1...n).map { |i| Member.new "m#{i}", [], env.call(i) }
+    sleep 0.5
+    members = [Member.new('m0', others, env.call(0))] + others
+    members.each { |m| m.expect(/^Welcome/) }
+    $members.concat members
+    members
+  end
+
+  # Run a test in a scratch directory, cleaning up after it.
+  def scratch
+    $members = []
+    FileUtils.mkdir_p SCRATCH
+    yield
+  ensure
+    $members.each &:kill
+    FileUtils.rm_rf SCRATCH
+  end
+end
@@ -0,0 +1,71 @@
+#!/usr/bin/env ruby
+
+# Keeps a history of a three-member session at each member, and reads one
+# back: all of it, and from a chat found by the time it was learned.  The
+# member is then restarted from its write-ahead log, and its history must
+# hold just what it did before, and then pick up where it left off, with no
+# chat kept twice.
+
+require_relative './group'
+
+COUNT = 20
+
+# Read a member's history from an instance on, as [inum, message] pairs.
+def history member, from=0
+  member.say "/history #{from} 1000"
+  entries = []
+  loop do
+    line = member.expect(/^HISTORY/)
+    break if line =~ /^HISTORY: \d+ read$/
+    line =~ /^HISTORY\((\d+)\): (.*)$/
+    entries << [$1.to_i, $2]
+  end
+  entries
+end
+
+def now_ms
+  (Time.now.to_f * 1000).to_i
+end
+
+scratch do
+  members = group 3 do |i|
+    { 'MOTMOT_HISTORY' => SCRATCH + "hist#{i}",
+      'MOTMOT_WAL' => SCRATCH + "wal#{i}", 'MOTMOT_PART_DELAY' => '10000' }
+  end
+  early = COUNT.times.map { |i| "early #{i}" }
+  late = COUNT.times.map { |i| "late #{i}" }
+
+  early.each { |msg| members[0].say msg }
+  members[2].expect(/^CHAT\(.*\): #{early.last}$/)
+  sleep 0.2
+  mark = now_ms
+  sleep 0.2
+  late.each { |msg| members[0].say msg }
+  members[2].expect(/^CHAT\(.*\): #{late.last}$/)
+
+  entries = history members[2]
+  abort 'history: wrong chats kept' unless
+      entries.map(&:last) == early + late
+  abort 'history: instance numbers out of order' unless
+      entries.map(&:first) == entries.map(&:first).sort.uniq
+
+  members[2].say "/find #{mark}"
+  first = members[2].expect(/^FIND: /)[/\d+/].to_i
+  abort 'history: find missed the first late chat' unless
+      first == entries[COUNT].first
+  abort 'history: read from the found chat went wrong' unless
+      history(members[2], first).map(&:last) == late
+
+  members[2].kill
+  members[2].start
+  members[2].expect(/^Welcome/)
+  abort 'history: lost across a restart' unless
+      history(members[2]).map(&:last) == early + late
+
+  members[0].say 'after'
+  members[2].expect(/^CHAT\(.*\): after$/)
+  abort 'history: did not pick up where it left off' unless
+      history(members[2]).map(&:last) == early + late + ['after']
+end
+
+puts 'history: ok'
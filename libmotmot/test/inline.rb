@@ -0,0 +1,45 @@
+#!/usr/bin/env ruby
+
+# Sends a mix of chats small enough to be inlined in their decrees and chats
+# too large to be, from two members at once, and checks that every member
+# learns the same chats in the same order, with each sender's chats in the
+# order sent.  The proposer then dies, and its successor must carry on from
+# the inlined decrees it was left with.
+
+require_relative './group'
+
+COUNT = 200
+LONG = 'x' * 200
+
+def message sender, i
+  (i.odd?) ? "#{sender} #{i} #{LONG}" : "#{sender} #{i}"
+end
+
+def check logs, senders, count
+  logs.each do |log|
+    abort 'inline: members learned different chats' unless log == logs[0]
+  end
+  senders.each do |s|
+    mine = logs[0].select { |msg| msg.start_with? "#{s} " }
+    abort "inline: #{s}'s chats out of order" unless
+        mine == count.times.map { |i| message s, i }
+  end
+end
+
+scratch do
+  members = group 4 do |i|
+    { 'MOTMOT_INLINE_MAX' => '64' }
+  end
+
+  COUNT.times do |i|
+    members[1].say message('one', i)
+    members[2].say message('two', i)
+  end
+  check members.map { |m| m.chats(2 * COUNT) }, ['one', 'two'], COUNT
+
+  members[0].kill
+  COUNT.times { |i| members[3].say message('three', i) }
+  check members[1..3].map { |m| m.chats(COUNT) }, ['three'], COUNT
+end
+
+puts 'inline: ok'
@@ -0,0 +1,54 @@
+#!/usr/bin/env ruby
+
+# Runs a five-member session with its socket I/O on two threads per member,
+# first alone and then along with shards.  Two members send a burst of
+# chats, some of them large enough to arrive over many reads, while another
+# is frozen so that its peers' output to it backs up.  Every member must
+# learn the same chats in the same order, with each sender's in order, the
+# frozen one once it thaws.  A member then dies, and the rest carry on.
+
+require_relative './group'
+
+COUNT = 1000
+BIG = 'x' * 100000
+
+def message tag, i
+  (i % 100 == 0) ? "#{tag} #{i} #{BIG}" : "#{tag} #{i}"
+end
+
+def check logs, tags
+  logs.each do |log|
+    abort 'iothreads: members learned different chats' unless log == logs[0]
+  end
+  tags.each do |tag|
+    abort "iothreads: #{tag}'s chats out of order" unless
+        logs[0].select { |msg| msg.start_with? "#{tag} " } ==
+        COUNT.times.map { |i| message tag, i }
+  end
+end
+
+def run env
+  scratch do
+    members = group 5 do |i|
+      { 'MOTMOT_IO_THREADS' => '2' }.merge env
+    end
+
+    members[4].stop
+    COUNT.times do |i|
+      members[1].say message('one', i)
+      members[2].say message('two', i)
+    end
+    logs = members[0..3].map { |m| m.chats(2 * COUNT) }
+    members[4].cont
+    check logs + [members[4].chats(2 * COUNT)], ['one', 'two']
+
+    members[3].kill
+    COUNT.times { |i| members[4].say message('four', i) }
+    check [0, 1, 2, 4].map { |j| members[j].chats(COUNT) }, ['four']
+  end
+end
+
+run({})
+run({ 'MOTMOT_SHARDS' => '2' })
+
+puts 'iothreads: ok'
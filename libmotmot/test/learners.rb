@@ -0,0 +1,40 @@
+#!/usr/bin/env ruby
+
+# Caps a five-member session at three voters, so that the last two members
+# to join are learners.  Learners must learn every chat, but their votes
+# must not count: with two of the three voters frozen, nothing commits even
+# though three of five members are up.  Thawing one voter lets the stalled
+# chat through, and losing both learners costs nothing.
+
+require_relative './group'
+
+scratch do
+  members = group 5 do |i|
+    { 'MOTMOT_MAX_VOTERS' => '3' }
+  end
+
+  members[4].say 'first'
+  members.each { |m| m.expect(/^CHAT\(.*\): first$/) }
+
+  members[1].stop
+  members[2].stop
+  members[3].say 'stalled'
+  begin
+    members[0].expect(/^CHAT\(.*\): stalled$/, 1, 3)
+    abort 'learners: committed without a quorum of voters'
+  rescue Timeout::Error
+  end
+
+  members[2].cont
+  [0, 2, 3, 4].each { |j| members[j].expect(/^CHAT\(.*\): stalled$/, 1, 60) }
+
+  members[3].kill
+  members[4].kill
+  members[2].say 'after'
+  [0, 2].each { |j| members[j].expect(/^CHAT\(.*\): after$/, 1, 60) }
+
+  members[1].cont
+  members[1].expect(/^CHAT\(.*\): after$/, 1, 60)
+end
+
+puts 'learners: ok'
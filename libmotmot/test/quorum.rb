@@ -0,0 +1,40 @@
+#!/usr/bin/env ruby
+
+# Starts a five-member session whose initiator asks for accept quorums of
+# two; the rest must take that from it.  With three acceptors frozen, the
+# proposer and one other still commit.  The prepare quorum is raised to four
+# so that it meets every accept quorum, so once the proposer dies, nobody
+# takes over until the frozen acceptors thaw, and then the successor must
+# carry on from every chat the pair committed.
+
+require_relative './group'
+
+COUNT = 10
+
+scratch do
+  members = group 5 do |i|
+    (i == 0) ? { 'MOTMOT_ACCEPT_QUORUM' => '2' } : {}
+  end
+
+  (1..3).each { |j| members[j].stop }
+  COUNT.times { |i| members[4].say "pair #{i}" }
+  [0, 4].each do |j|
+    COUNT.times { |i| members[j].expect(/^CHAT\(.*\): pair #{i}$/, 1, 60) }
+  end
+
+  members[0].kill
+  members[4].say 'orphan'
+  begin
+    members[4].expect(/^CHAT\(.*\): orphan$/, 1, 3)
+    abort 'quorum: committed without a prepare quorum'
+  rescue Timeout::Error
+  end
+
+  (1..3).each { |j| members[j].cont }
+  (1..3).each do |j|
+    members[j].expect(/^CHAT\(.*\): pair #{COUNT - 1}$/, 1, 60)
+  end
+  (1..4).each { |j| members[j].expect(/^CHAT\(.*\): orphan$/, 1, 60) }
+end
+
+puts 'quorum: ok'
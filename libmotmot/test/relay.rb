@@ -0,0 +1,41 @@
+#!/usr/bin/env ruby
+
+# Relays decrees and commits down a binary tree of seven members, in which
+# members 1 and 2 each forward to two others.  Every member must learn every
+# chat in the same order.  Member 2 then freezes with its connections open,
+# cutting off its subtree while the rest still make a quorum; once it thaws,
+# its subtree must catch up.  Finally member 1 dies, and the proposer must
+# adopt its children.
+
+require_relative './group'
+
+COUNT = 100
+
+def check logs, count, tag
+  logs.each do |log|
+    abort "relay: #{tag} chats out of order" unless
+        log == count.times.map { |i| "#{tag} #{i}" }
+  end
+end
+
+scratch do
+  members = group 7 do |i|
+    { 'MOTMOT_RELAY_FANOUT' => '2' }
+  end
+
+  COUNT.times { |i| members[6].say "tree #{i}" }
+  check members.map { |m| m.chats(COUNT) }, COUNT, 'tree'
+
+  members[2].stop
+  COUNT.times { |i| members[3].say "stalled #{i}" }
+  check [0, 1, 3, 4].map { |j| members[j].chats(COUNT) }, COUNT, 'stalled'
+  members[2].cont
+  check [2, 5, 6].map { |j| members[j].chats(COUNT) }, COUNT, 'stalled'
+
+  members[1].kill
+  COUNT.times { |i| members[5].say "adopted #{i}" }
+  check [0, 2, 3, 4, 5, 6].map { |j| members[j].chats(COUNT) }, COUNT,
+      'adopted'
+end
+
+puts 'relay: ok'
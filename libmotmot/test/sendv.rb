@@ -0,0 +1,48 @@
+#!/usr/bin/env ruby
+
+# Sends vectors of chats with motmot_sendv from the proposer and from an
+# acceptor, while a third member sends single chats in among them.  Every
+# member must learn the same chats in the same order, with each sender's
+# chats in the order sent, and the chats of each vector back to back.
+
+require_relative './group'
+
+COUNT = 50
+WIDTH = 5
+
+def vector sender, i
+  WIDTH.times.map { |j| "#{sender} #{i}.#{j}" }
+end
+
+scratch do
+  members = group 3
+  total = 2 * COUNT * WIDTH + COUNT
+
+  COUNT.times do |i|
+    members[0].say "/sendv #{vector('zero', i).join '|'}"
+    members[1].say "/sendv #{vector('one', i).join '|'}"
+    members[2].say "single #{i}"
+  end
+
+  logs = members.map { |m| m.chats total }
+  logs.each do |log|
+    abort 'sendv: members learned different chats' unless log == logs[0]
+  end
+
+  log = logs[0]
+  ['zero', 'one'].each do |s|
+    sent = COUNT.times.flat_map { |i| vector s, i }
+    abort "sendv: #{s}'s chats out of order" unless
+        log.select { |msg| msg.start_with? "#{s} " } == sent
+    COUNT.times do |i|
+      at = log.index vector(s, i).first
+      abort "sendv: #{s}'s vector #{i} split up" unless
+          log[at, WIDTH] == vector(s, i)
+    end
+  end
+  abort 'sendv: single chats out of order' unless
+      log.select { |msg| msg.start_with? 'single ' } ==
+      COUNT.times.map { |i| "single #{i}" }
+end
+
+puts 'sendv: ok'
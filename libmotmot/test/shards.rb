@@ -0,0 +1,45 @@
+#!/usr/bin/env ruby
+
+# Runs a three-member session whose members each spread their sessions over
+# four shard threads, so that every connection must be handed to the shard
+# running the session it belongs to.  Chats come from each member's main
+# thread and from threads of their own; every member must learn the same
+# chats in the same order, with each thread's in the order it sent them.
+# A member then dies, and the others must carry on.
+
+require_relative './group'
+
+THREADS = 2
+COUNT = 100
+
+def check logs, tags
+  logs.each do |log|
+    abort 'shards: members learned different chats' unless log == logs[0]
+  end
+  tags.each do |tag|
+    abort "shards: #{tag} chats out of order" unless
+        logs[0].select { |msg| msg.start_with? "#{tag} " } ==
+        COUNT.times.map { |i| "#{tag} #{i}" }
+  end
+end
+
+scratch do
+  members = group 3 do |i|
+    { 'MOTMOT_SHARDS' => '4' }
+  end
+
+  members.each_with_index do |m, j|
+    m.say "/spray #{THREADS} #{COUNT} s#{j}"
+    COUNT.times { |i| m.say "main#{j} #{i}" }
+  end
+  tags = 3.times.flat_map do |j|
+    ["main#{j}"] + THREADS.times.map { |t| "s#{j} #{t}" }
+  end
+  check members.map { |m| m.chats(3 * (THREADS + 1) * COUNT) }, tags
+
+  members[2].kill
+  COUNT.times { |i| members[1].say "after #{i}" }
+  check members[0..1].map { |m| m.chats(COUNT) }, ['after']
+end
+
+puts 'shards: ok'
@@ -0,0 +1,37 @@
+#!/usr/bin/env ruby
+
+# Runs a five-member session as a star, in which everyone connects only to
+# the proposer and the one member next in line.  Chats between members who
+# hold no connection to each other must still be learned by everyone, in
+# order.  Then the proposer dies, and after it its successor, so that each
+# time the new line must connect to everyone before the chat can go on.
+
+require_relative './group'
+
+COUNT = 100
+
+def check logs, count, tag
+  logs.each do |log|
+    abort "star: #{tag} chats out of order" unless
+        log == count.times.map { |i| "#{tag} #{i}" }
+  end
+end
+
+scratch do
+  members = group 5 do |i|
+    { 'MOTMOT_STAR' => '1' }
+  end
+
+  COUNT.times { |i| members[4].say "leaf #{i}" }
+  check members.map { |m| m.chats(COUNT) }, COUNT, 'leaf'
+
+  members[0].kill
+  COUNT.times { |i| members[3].say "second #{i}" }
+  check members[1..4].map { |m| m.chats(COUNT) }, COUNT, 'second'
+
+  members[1].kill
+  COUNT.times { |i| members[4].say "third #{i}" }
+  check members[2..4].map { |m| m.chats(COUNT) }, COUNT, 'third'
+end
+
+puts 'star: ok'
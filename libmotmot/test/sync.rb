@@ -0,0 +1,50 @@
+#!/usr/bin/env ruby
+
+# Checks what triggers a sync, by watching for the debug message each
+# member logs once a sync has let it truncate its log.  With the sync delay
+# set far off, a sync must still come as soon as enough learns or enough
+# cached bytes pile up, and must not come at all if neither threshold is
+# set.  With a short delay and no thresholds, the timer alone must sync.
+
+require_relative './group'
+
+COUNT = 200
+PAD = 'x' * 200
+
+def truncates? env, wait
+  scratch do
+    members = group 3 do |i|
+      { 'G_MESSAGES_DEBUG' => 'all', 'MOTMOT_SYNC_COUNT' => '0',
+        'MOTMOT_SYNC_BYTES' => '0' }.merge env
+    end
+
+    # Watch for the truncate and the last chat together, in whichever order
+    # they come, since expect drops what it doesn't match.
+    COUNT.times { |i| members[1].say "sync #{i} #{PAD}" }
+    truncated, done = false, false
+    begin
+      Timeout.timeout wait do
+        until truncated && done
+          line = members[0].expect(
+              /^CHAT\(.*\): sync #{COUNT - 1} |paxos_truncate: /, 1, wait)
+          (line =~ /paxos_truncate: /) ? truncated = true : done = true
+        end
+      end
+    rescue Timeout::Error
+    end
+    abort 'sync: chats not learned' unless done
+    truncated
+  end
+end
+
+FAR = { 'MOTMOT_SYNC_DELAY' => '600000' }
+
+abort 'sync: no sync on count' unless
+    truncates? FAR.merge('MOTMOT_SYNC_COUNT' => '50'), 10
+abort 'sync: no sync on bytes' unless
+    truncates? FAR.merge('MOTMOT_SYNC_BYTES' => '16384'), 10
+abort 'sync: synced with no threshold set' if truncates? FAR, 5
+abort 'sync: no sync on the timer' unless
+    truncates?({ 'MOTMOT_SYNC_DELAY' => '500' }, 10)
+
+puts 'sync: ok'
@@ -0,0 +1,33 @@
+#!/usr/bin/env ruby
+
+# Sends chats with motmot_send_take, which hands the buffer to motmot to
+# release when it is done with it, and checks that every chat arrives in
+# order and every buffer is released exactly once.  Frequent syncs let
+# motmot finish with the buffers while we watch.  The second run makes the
+# chats blobs, whose buffers are released as soon as they are stored.
+
+require_relative './group'
+
+COUNT = 100
+
+def run env, pad
+  scratch do
+    members = group 3 do |i|
+      { 'MOTMOT_SYNC_COUNT' => '16', 'MOTMOT_SYNC_DELAY' => '100' }.merge env
+    end
+    sent = COUNT.times.map { |i| "take #{i} #{pad}" }
+
+    sent.each { |msg| members[1].say "/take #{msg}" }
+    abort 'take: chats out of order' unless members[2].chats(COUNT) == sent
+
+    released = COUNT.times.map do
+      members[1].expect(/^RELEASED: /, 1, 60).sub(/^RELEASED: /, '')
+    end
+    abort 'take: buffers released wrongly' unless released.sort == sent.sort
+  end
+end
+
+run({}, '')
+run({ 'MOTMOT_BLOB_MIN' => '1024' }, 'x' * 2000)
+
+puts 'take: ok'
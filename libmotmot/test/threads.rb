@@ -0,0 +1,45 @@
+#!/usr/bin/env ruby
+
+# Sends chats into a three-member session from several threads at once, by
+# motmot_send, motmot_send_take, and motmot_sendv in turn, on both the
+# proposer and an acceptor, while their main threads send chats of their
+# own.  Every member must learn every chat, the same chats in the same
+# order, with each thread's chats in the order it sent them.
+
+require_relative './group'
+
+THREADS = 4
+COUNT = 150
+
+scratch do
+  members = group 3 do |i|
+    { 'MOTMOT_THREADS' => '1' }
+  end
+
+  members[0].say "/spray #{THREADS} #{COUNT} zs"
+  members[1].say "/spray #{THREADS} #{COUNT} os"
+  COUNT.times do |i|
+    members[0].say "zero #{i}"
+    members[1].say "one #{i}"
+  end
+
+  total = 2 * THREADS * COUNT + 2 * COUNT
+  logs = members.map { |m| m.chats total }
+  logs.each do |log|
+    abort 'threads: members learned different chats' unless log == logs[0]
+  end
+
+  log = logs[0]
+  ['zero', 'one'].each do |tag|
+    abort "threads: #{tag}'s chats out of order" unless
+        log.select { |msg| msg.start_with? "#{tag} " } ==
+        COUNT.times.map { |i| "#{tag} #{i}" }
+  end
+  ['zs', 'os'].product(THREADS.times.to_a).each do |tag, t|
+    abort "threads: #{tag} thread #{t}'s chats out of order" unless
+        log.select { |msg| msg.start_with? "#{tag} #{t} " } ==
+        COUNT.times.map { |i| "#{tag} #{t} #{i}" }
+  end
+end
+
+puts 'threads: ok'
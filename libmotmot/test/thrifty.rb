@@ -0,0 +1,34 @@
+#!/usr/bin/env ruby
+
+# Runs a five-member session in thrifty mode, in which each decree goes to
+# just enough acceptors for a quorum.  Two acceptors are frozen with their
+# connections still open, so any decree sent their way can only commit once
+# it is widened to the rest.  Every chat must still be learned, in order,
+# by the live members, and by the frozen ones once they thaw.
+
+require_relative './group'
+
+COUNT = 50
+
+scratch do
+  members = group 5 do |i|
+    { 'MOTMOT_THRIFTY' => '1' }
+  end
+
+  members[1].stop
+  members[2].stop
+
+  COUNT.times { |i| members[3].say "thrifty #{i}" }
+  [0, 3, 4].each do |j|
+    COUNT.times do |i|
+      members[j].expect(/^CHAT\(.*\): thrifty #{i}$/, 1, 60)
+    end
+  end
+
+  members[1].cont
+  members[2].cont
+  members[0].say 'after'
+  members.each { |m| m.expect(/^CHAT\(.*\): after$/, 1, 60) }
+end
+
+puts 'thrifty: ok'
@@ -0,0 +1,40 @@
+#!/usr/bin/env ruby
+
+# Syncs a three-member session every few learns, so that its logs are
+# truncated over and over while two members chat at once, and checks that
+# every chat is learned everywhere.  Then one member is restarted from its
+# write-ahead log after missing a great many syncs, and must catch up on
+# everything it missed, by way of a snapshot if it fell behind the
+# truncation point.
+
+require_relative './group'
+
+COUNT = 2000
+
+scratch do
+  members = group 3 do |i|
+    { 'MOTMOT_SYNC_COUNT' => '16', 'MOTMOT_SYNC_DELAY' => '50',
+      'MOTMOT_PART_DELAY' => '10000', 'MOTMOT_WAL' => SCRATCH + "wal#{i}" }
+  end
+
+  COUNT.times do |i|
+    members[0].say "zero #{i}"
+    members[1].say "one #{i}"
+  end
+  members.each do |m|
+    m.expect(/^CHAT\(.*\): (zero|one) /, 2 * COUNT, 120)
+  end
+
+  members[2].kill
+  COUNT.times { |i| members[0].say "during #{i}" }
+  members[1].expect(/^CHAT\(.*\): during #{COUNT - 1}$/, 1, 120)
+
+  members[2].start
+  members[2].expect(/^Welcome/)
+  members[2].expect(/^CHAT\(.*\): during #{COUNT - 1}$/, 1, 120)
+
+  members[0].say 'after'
+  members.each { |m| m.expect(/^CHAT\(.*\): after$/) }
+end
+
+puts 'truncate: ok'
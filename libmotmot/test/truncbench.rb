@@ -0,0 +1,60 @@
+#!/usr/bin/env ruby
+
+# Measures how long a truncate stalls a session.  We hold off syncing until
+# a great many chats have been learned, so that the one sync we make frees
+# them all.  Each member reports the longest slice of main loop time it spent
+# freeing them; we also time the longest gap between consecutive chats
+# learned by a member while chats keep flowing through it.
+
+require_relative './group'
+require 'optparse'
+
+count = 100000
+
+OptionParser.new do |opts|
+  opts.banner = 'Usage: truncbench.rb [options]'
+
+  opts.on '-n', '--count N', Integer, 'Number of chats before the sync' do |n|
+    count = n
+  end
+end.parse!
+
+scratch do
+  members = group 3 do |i|
+    { 'MOTMOT_SYNC_COUNT' => count.to_s, 'MOTMOT_SYNC_DELAY' => '3600000',
+      'G_MESSAGES_DEBUG' => 'all' }
+  end
+
+  # Send twice as many chats as the sync needs, so that the truncate happens
+  # in the middle of the stream.
+  Thread.new do
+    (2 * count).times { |i| members[0].say "bench #{i}" }
+  end
+
+  # Member 1 reports its slice in among its chats.
+  slices = {}
+  worst, at, prev, i = 0, 0, nil, 0
+  while i < 2 * count || slices[1] == nil
+    line = members[1].expect(/^CHAT\(.*\): bench |paxos_truncate: /, 1, 600)
+    if line =~ /paxos_truncate: Longest slice took (\d+)us/
+      slices[1] = $1
+      next
+    end
+    if prev != nil && members[1].arrived - prev > worst
+      worst, at = members[1].arrived - prev, i
+    end
+    prev = members[1].arrived
+    i += 1
+  end
+
+  [0, 2].each do |j|
+    line = members[j].expect(/paxos_truncate: Longest slice took \d+us/, 1, 600)
+    slices[j] = line[/(\d+)us/, 1]
+  end
+
+  printf "longest gap between chats: %.1fms, before chat %d of %d\n",
+      worst * 1000, at, 2 * count
+  slices.keys.sort.each do |j|
+    printf "member %d: longest truncation slice %sus\n", j, slices[j]
+  end
+end
@@ -0,0 +1,61 @@
+#!/usr/bin/env ruby
+
+# Times chats through a three-member session whose members each keep a
+# write-ahead log, syncing it once per main loop iteration (group commit) or
+# after every record.  For each mode, we time a burst of chats for
+# throughput, and then chats sent one at a time for commit latency: from
+# sending a chat to learning it back.  Pass --mode to run only some modes;
+# "none" runs without a log, for comparison.
+
+require_relative './group'
+require 'optparse'
+
+count = 10000
+modes = ['group', 'each']
+
+OptionParser.new do |opts|
+  opts.banner = 'Usage: walbench.rb [options]'
+
+  opts.on '-n', '--count N', Integer, 'Number of chats to send' do |n|
+    count = n
+  end
+  opts.on '--mode M', Array, 'Modes to run: group, each, none' do |m|
+    modes = m
+  end
+end.parse!
+
+def percentile sorted, p
+  sorted[[(sorted.size * p).ceil - 1, 0].max]
+end
+
+modes.each do |mode|
+  scratch do
+    members = group 3 do |i|
+      case mode
+      when 'group' then { 'MOTMOT_WAL' => SCRATCH + "wal#{i}" }
+      when 'each' then { 'MOTMOT_WAL' => SCRATCH + "wal#{i}",
+                         'MOTMOT_WAL_EACH' => '1' }
+      else {}
+      end
+    end
+
+    start = Time.now
+    count.times { |i| members[0].say "burst #{i}" }
+    members[1].expect(/^CHAT\(.*\): burst /, count, 600)
+    elapsed = Time.now - start
+    members[0].expect(/^CHAT\(.*\): burst #{count - 1}$/, 1, 600)
+
+    samples = [count / 10, 100].max
+    latencies = samples.times.map do |i|
+      start = Time.now
+      members[0].say "ping #{i}"
+      members[0].expect(/^CHAT\(.*\): ping #{i}$/)
+      members[0].arrived - start
+    end.sort
+
+    printf "%-5s %d chats in %.2fs (%.0f/s); latency over %d: " \
+        "p50 %.2fms p90 %.2fms p99 %.2fms max %.2fms\n",
+        mode, count, elapsed, count / elapsed, samples,
+        *[0.5, 0.9, 0.99, 1.0].map { |p| percentile(latencies, p) * 1000 }
+  end
+end
@@ -0,0 +1,48 @@
+#!/usr/bin/env ruby
+
+# Restarts a member of a three-member session from its write-ahead log, and
+# checks that it resumes where it left off: it learns exactly the chats it
+# missed, and nothing twice.  The second run tears the tail off the log first,
+# as a crash mid-write would; replay should stop short of the torn record, and
+# the member should still catch up, if perhaps learning a few chats again.
+
+require_relative './group'
+
+def resume torn
+  scratch do
+    members = group 3 do |i|
+      { 'MOTMOT_WAL' => SCRATCH + "wal#{i}", 'MOTMOT_PART_DELAY' => '10000' }
+    end
+
+    100.times { |i| members[0].say "before #{i}" }
+    members[2].expect(/^CHAT\(.*\): before 99$/)
+    members[2].kill
+
+    if torn
+      log = Dir[SCRATCH + 'wal2/wal.*'].sort.last
+      File.truncate log, File.size(log) - 7
+    end
+
+    100.times { |i| members[0].say "during #{i}" }
+    members[1].expect(/^CHAT\(.*\): during 99$/)
+
+    members[2].start
+    members[2].expect(/^Welcome/)
+    if torn
+      members[2].expect(/^CHAT\(.*\): during 99$/)
+    else
+      100.times do |i|
+        line = members[2].expect(/^CHAT/)
+        abort "walreplay: expected during #{i}, got #{line}" unless
+            line.end_with? ": during #{i}"
+      end
+    end
+
+    members[0].say 'after'
+    members[2].expect(/^CHAT\(.*\): after$/)
+  end
+end
+
+resume false
+resume true
+puts 'walreplay: ok'